@@ -1,32 +1,46 @@
 #include "Buffer.h"
-#include "StaP.h"
 #include <string.h>
 
-#define CRITICAL_SECTIONS    0    // We don't believe in critical sectoins.
+// The producer owns inPtr and the consumer owns outPtr. Each side reads its
+// own index relaxed, the other side's index with acquire and publishes its
+// own index with release after the storage has been touched.
+
+#define LOAD_OWN(p)        atomic_load_explicit(&(p), memory_order_relaxed)
+#define LOAD_OTHER(p)      atomic_load_explicit(&(p), memory_order_acquire)
+#define PUBLISH(p, v)      atomic_store_explicit(&(p), (v), memory_order_release)
 
 void vpbuffer_init(VPBuffer_t *i, VPBufferSize_t size, char *storage)
 {
-  i->inPtr = i->outPtr = 0;
+  atomic_init(&i->inPtr, 0);
+  atomic_init(&i->outPtr, 0);
+  atomic_init(&i->watermark, 0);
+  atomic_init(&i->overrun, false);
   i->mask = size - 1;
   i->storage = storage;
 }
 
 void vpbuffer_flush(VPBuffer_t *i)
 {
-  i->outPtr = i->inPtr;
+  // Consumer side
+
+  PUBLISH(i->outPtr, LOAD_OTHER(i->inPtr));
 }
 
 void vpbuffer_adjust(VPBuffer_t *i, VPBufferIndex_t delta)
 {
+  // Producer side, retract unconsumed data from the head. Only safe when
+  // the consumer can't be reading the retracted region at the same time,
+  // this breaks the single producer, single consumer guarantee otherwise.
+
   if(!i->storage)
     return;
-  
+
   VPBufferSize_t g = vpbuffer_gauge(i);
-  
+
   if(delta > g)
     delta = g;
-  
-  i->inPtr = VPBUFFER_INDEX((*i), i->inPtr, -delta);
+
+  PUBLISH(i->inPtr, VPBUFFER_INDEX((*i), LOAD_OWN(i->inPtr), -delta));
 }
 
 VPBufferSize_t vpbuffer_insert(VPBuffer_t *i, const char *b, VPBufferSize_t s, bool overwrite)
@@ -37,11 +51,8 @@ VPBufferSize_t vpbuffer_insert(VPBuffer_t *i, const char *b, VPBufferSize_t s, b
   if(s > i->mask)
     s = i->mask;
 
-#if CRITICAL_SECTIONS
-  ForbidContext_T c = STAP_FORBID_SAFE;
-#endif
-  
-  VPBufferIndex_t space = vpbuffer_space(i);
+  VPBufferIndex_t inPtr = LOAD_OWN(i->inPtr);
+  VPBufferSize_t space = i->mask - ((inPtr - LOAD_OTHER(i->outPtr)) & i->mask);
 
   if(s > space) {
     if(overwrite) {
@@ -50,85 +61,62 @@ VPBufferSize_t vpbuffer_insert(VPBuffer_t *i, const char *b, VPBufferSize_t s, b
       vpbuffer_adjust(i, s - space + 3);
       vpbuffer_insert(i, " ~ ", 3, false);
       vpbuffer_insert(i, b, s, false);
-      
-      i->overrun = true;
-    
-#if CRITICAL_SECTIONS
-      STAP_PERMIT_SAFE(c);
-#endif
-      
+
+      atomic_store_explicit(&i->overrun, true, memory_order_relaxed);
+
       return s;
     } else
       // Truncate
       s = space;
   }
 
-  if(VPBUFFER_INDEX((*i), i->inPtr, s) < i->inPtr) {
-    VPBufferSize_t cut = i->mask + 1 - i->inPtr;
-    memcpy((char*) &i->storage[i->inPtr], b, cut);
-    
-    if(s > cut)
-      memcpy((char*) i->storage, &b[cut], s - cut);
+  if(s < 1)
+    return 0;
+
+  VPBufferSize_t cut = i->mask + 1 - inPtr;
+
+  if(s > cut) {
+    memcpy(&i->storage[inPtr], b, cut);
+    memcpy(i->storage, &b[cut], s - cut);
   } else {
-    memcpy((char*) &i->storage[i->inPtr], b, s);
+    memcpy(&i->storage[inPtr], b, s);
   }
-  
-#ifdef STAP_MEM_BARRIER
-  STAP_MEM_BARRIER;
-#endif
-  
-  i->inPtr = VPBUFFER_INDEX((*i), i->inPtr, s);
 
-#if CRITICAL_SECTIONS
-  STAP_PERMIT_SAFE(c);
-#endif
+  PUBLISH(i->inPtr, VPBUFFER_INDEX((*i), inPtr, s));
 
   return s;
 }
 
 bool vpbuffer_hasOverrun(VPBuffer_t *i)
 {
-  bool status = i->overrun;
-  i->overrun = false;
-  return status;
+  return atomic_exchange_explicit(&i->overrun, false, memory_order_relaxed);
 }
 
 VPBufferSize_t vpbuffer_extract(VPBuffer_t *i, char *b, VPBufferSize_t s)
 {
   if(!i->storage || s < 1)
     return 0;
-  
-#if CRITICAL_SECTIONS
-  ForbidContext_T c = STAP_FORBID_SAFE;
-#endif
-  
-  VPBufferIndex_t g = vpbuffer_gauge(i);
-  
+
+  VPBufferIndex_t outPtr = LOAD_OWN(i->outPtr);
+  VPBufferSize_t g = (LOAD_OTHER(i->inPtr) - outPtr) & i->mask;
+
   if(s > g)
     s = g;
 
-//  __DMB();
+  if(s < 1)
+    return 0;
 
-  if(VPBUFFER_INDEX((*i), i->outPtr, s) < i->outPtr) {
-    VPBufferSize_t cut = i->mask + 1 - i->outPtr;
+  VPBufferSize_t cut = i->mask + 1 - outPtr;
 
-#ifdef STAP_MEM_BARRIER
-    STAP_MEM_BARRIER;
-#endif
-    
-    memcpy(b, (char*) &i->storage[i->outPtr], cut);
-    if(s > cut)
-      memcpy(&b[cut], (char*) i->storage, s - cut);
+  if(s > cut) {
+    memcpy(b, &i->storage[outPtr], cut);
+    memcpy(&b[cut], i->storage, s - cut);
   } else {
-    memcpy(b, (char*) &i->storage[i->outPtr], s);
+    memcpy(b, &i->storage[outPtr], s);
   }
-  
-  i->outPtr = VPBUFFER_INDEX((*i), i->outPtr, s);
 
-#if CRITICAL_SECTIONS
-  STAP_PERMIT_SAFE(c);
-#endif
-  
+  PUBLISH(i->outPtr, VPBUFFER_INDEX((*i), outPtr, s));
+
   return s;
 }
 
@@ -136,42 +124,63 @@ void vpbuffer_insertChar(VPBuffer_t *i, char b)
 {
   if(!i->storage)
     return;
-  
-#if CRITICAL_SECTIONS
-  ForbidContext_T c = STAP_FORBID_SAFE;
-#endif
-  
-  VPBufferIndex_t ptrNew = VPBUFFER_INDEX((*i), i->inPtr, 1);
-
-  i->storage[i->inPtr] = b;
-  
-  if(ptrNew != i->outPtr)
-    i->inPtr = ptrNew;
-  else
-    i->overrun = true;
-
-#if CRITICAL_SECTIONS
-  STAP_PERMIT_SAFE(c);
-#endif
+
+  VPBufferIndex_t inPtr = LOAD_OWN(i->inPtr);
+  VPBufferIndex_t ptrNew = VPBUFFER_INDEX((*i), inPtr, 1);
+
+  if(ptrNew != LOAD_OTHER(i->outPtr)) {
+    i->storage[inPtr] = b;
+    PUBLISH(i->inPtr, ptrNew);
+  } else
+    atomic_store_explicit(&i->overrun, true, memory_order_relaxed);
 }
 
 char vpbuffer_extractChar(VPBuffer_t *i)
 {
   char b = 0xFE;
-  
-#if CRITICAL_SECTIONS
-  ForbidContext_T c = STAP_FORBID_SAFE;
-#endif
-  
-  if(i->storage && i->outPtr != i->inPtr) {
-    b = i->storage[i->outPtr];
-    i->outPtr = VPBUFFER_INDEX((*i), i->outPtr, 1);      
+  VPBufferIndex_t outPtr = LOAD_OWN(i->outPtr);
+
+  if(i->storage && outPtr != LOAD_OTHER(i->inPtr)) {
+    b = i->storage[outPtr];
+    PUBLISH(i->outPtr, VPBUFFER_INDEX((*i), outPtr, 1));
   }
 
-#if CRITICAL_SECTIONS
-  STAP_PERMIT_SAFE(c);
-#endif
-  
   return b;
 }
 
+VPBufferSize_t vpbuffer_peek(VPBuffer_t *i, VPBufferSpan_t span[2])
+{
+  span[0].size = span[1].size = 0;
+  span[0].data = span[1].data = i->storage;
+
+  if(!i->storage)
+    return 0;
+
+  VPBufferIndex_t outPtr = LOAD_OWN(i->outPtr);
+  VPBufferSize_t g = (LOAD_OTHER(i->inPtr) - outPtr) & i->mask;
+  VPBufferSize_t cut = i->mask + 1 - outPtr;
+
+  span[0].data = &i->storage[outPtr];
+
+  if(g > cut) {
+    span[0].size = cut;
+    span[1].size = g - cut;
+  } else
+    span[0].size = g;
+
+  return g;
+}
+
+void vpbuffer_consume(VPBuffer_t *i, VPBufferSize_t s)
+{
+  if(!i->storage || s < 1)
+    return;
+
+  VPBufferIndex_t outPtr = LOAD_OWN(i->outPtr);
+  VPBufferSize_t g = (LOAD_OTHER(i->inPtr) - outPtr) & i->mask;
+
+  if(s > g)
+    s = g;
+
+  PUBLISH(i->outPtr, VPBUFFER_INDEX((*i), outPtr, s));
+}
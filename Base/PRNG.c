@@ -1,31 +1,70 @@
+#include <string.h>
+#include <stdatomic.h>
 #include "PRNG.h"
-#include "CRC16.h"
 
-static uint16_t randomState;
+//
+// Counter based generator: a Weyl sequence advanced with one atomic add per
+// 32-bit output, run through a SplitMix style finalizer together with the
+// entropy pool. Tasks and ISRs share the state without locking, concurrent
+// callers never see the same counter value.
+//
+
+#define RANDOM_WEYL      0x9E3779B9UL
+
+static _Atomic uint32_t randomCounter, randomPool;
+
+static uint32_t randomMix(uint32_t x)
+{
+  x ^= x >> 16;
+  x *= 0x7FEB352DUL;
+  x ^= x >> 15;
+  x *= 0x846CA68BUL;
+  x ^= x >> 16;
+  return x;
+}
 
 void randomEntropyInput(uint16_t input)
 {
-    randomState = crc16_update(randomState, input);
+  uint32_t pool = atomic_load_explicit(&randomPool, memory_order_relaxed);
+
+  // Fold the input into the pool, a lost race only loses one input
+  
+  while(!atomic_compare_exchange_weak_explicit(&randomPool, &pool,
+					       randomMix(pool ^ input) + RANDOM_WEYL,
+					       memory_order_relaxed,
+					       memory_order_relaxed))
+    ;
+}
+
+uint32_t randomUI32(void)
+{
+  uint32_t count =
+    atomic_fetch_add_explicit(&randomCounter, RANDOM_WEYL, memory_order_relaxed);
+  
+  return randomMix(count ^ atomic_load_explicit(&randomPool, memory_order_relaxed));
 }
 
 void randomNumber(uint8_t *buffer, size_t size)
 {
-    while(size-- > 0) {
-        randomState = crc16_update(randomState, 0xFF);
-        *buffer++ = randomState & 0xFF;
-    }
+  while(size >= sizeof(uint32_t)) {
+    uint32_t value = randomUI32();
+    memcpy(buffer, &value, sizeof(value));
+    buffer += sizeof(value);
+    size -= sizeof(value);
+  }
+
+  if(size > 0) {
+    uint32_t value = randomUI32();
+    memcpy(buffer, &value, size);
+  }
 }
 
 uint8_t randomUI8(void)
 {
-    uint8_t value = 0;
-    randomNumber(&value, sizeof(value));
-    return value;
+  return (uint8_t) randomUI32();
 }
 
 uint16_t randomUI16(void)
 {
-    uint16_t value = 0;
-    randomNumber((uint8_t*) &value, sizeof(value));
-    return value;    
+  return (uint16_t) randomUI32();
 }
@@ -1,74 +1,297 @@
-#include <math.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include "StringFmt.h"
 
-int bufferPrintFP(char *buffer, int size, float v, int w, int p)
+//
+// Integer conversion. The number of digits is known before anything is
+// written so the digits go straight to their final position, decimal two
+// at a time from a table and power of two bases by shifting.
+//
+
+static const char decimalPairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+static const char digitChars[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+static const unsigned long decimalPowers[] = {
+  1UL, 10UL, 100UL, 1000UL, 10000UL, 100000UL, 1000000UL, 10000000UL,
+  100000000UL, 1000000000UL,
+#if ULONG_MAX > 0xFFFFFFFFUL
+  10000000000UL, 100000000000UL, 1000000000000UL, 10000000000000UL,
+  100000000000000UL, 1000000000000000UL, 10000000000000000UL,
+  100000000000000000UL, 1000000000000000000UL, 10000000000000000000UL
+#endif
+};
+
+#define DECIMAL_POWERS  ((int) (sizeof(decimalPowers)/sizeof(decimalPowers[0])))
+
+static int digitsDecimal(unsigned long v)
 {
-  int len = 0;
-  
-  if(isinf(v)) {
-    if(size > 3) {
-      strcpy(buffer, "inf");
-      return 3;
-    }
+  int n = 1;
+
+  while(n < DECIMAL_POWERS && v >= decimalPowers[n])
+    n++;
 
+  return n;
+}
+
+static int digitsGeneric(unsigned long v, uint8_t base)
+{
+  int n = 1;
+
+  while(v >= base) {
+    v /= base;
+    n++;
+  }
+
+  return n;
+}
+
+int bufferPrintUL(char *buf, int size, unsigned long v, uint8_t base, uint8_t p)
+{
+  int shift = 0, l = 0, n = 0;
+  char *ptr = NULL;
+
+  if(size < 1 || base < 2 || base > sizeof(digitChars) - 1)
     return 0;
-  } else if(isnan(v)) {
-    if(size > 3) {
-      strcpy(buffer, "nan");
-      return 3;
+
+  if((base & (base - 1)) == 0) {
+    // Power of two
+    
+    unsigned long rest = v;
+    
+    while((1U << shift) < base)
+      shift++;
+
+    do {
+      rest >>= shift;
+      l++;
+    } while(rest);
+  } else if(base == 10)
+    l = digitsDecimal(v);
+  else
+    l = digitsGeneric(v, base);
+
+  if(l < p)
+    l = p;
+
+  if(l > size)
+    // Only the least significant digits fit
+    l = size;
+
+  // Fill from the end, leading zeros come out when v runs out
+  
+  ptr = &buf[l];
+  n = l;
+  
+  if(shift) {
+    while(n-- > 0) {
+      *--ptr = digitChars[v & (base - 1)];
+      v >>= shift;
+    }
+  } else if(base == 10) {
+    while(n > 1 && v >= 10) {
+      unsigned long q = v / 100;
+      unsigned int r = (unsigned int) (v - q*100);
+      
+      *--ptr = decimalPairs[2*r+1];
+      *--ptr = decimalPairs[2*r];
+      v = q;
+      n -= 2;
     }
 
-    return 0;
+    while(n-- > 0) {
+      *--ptr = '0' + (char) (v % 10);
+      v /= 10;
+    }
   } else {
-    if(v < 0.0f) {
-      if(len < size)
-	buffer[len++] = '-';
-      v = -v;
+    while(n-- > 0) {
+      *--ptr = digitChars[v % base];
+      v /= base;
     }
+  }
 
-    float integerPart = 0.0;
-    float fraction = modff(v, &integerPart);
+  return l;
+}
 
-    len += bufferPrintUL(&buffer[len], size - len, (unsigned long) integerPart, 10, w);
-    
-    if(p > 0) {
-      if(len < size)
-	buffer[len++] = '.';
+//
+// Bulk hex, a byte at a time from a table of all 256 digit pairs
+//
 
-      fraction *= powf(10.0f, p);
-      len += bufferPrintUL(&buffer[len], size - len, (unsigned long) fraction, 10, p);
-    }
-  }
+#define HEX_ROW(h) \
+  h"0" h"1" h"2" h"3" h"4" h"5" h"6" h"7" h"8" h"9" h"A" h"B" h"C" h"D" h"E" h"F"
 
-  return len;
+static const char hexPairs[512] =
+  HEX_ROW("0") HEX_ROW("1") HEX_ROW("2") HEX_ROW("3")
+  HEX_ROW("4") HEX_ROW("5") HEX_ROW("6") HEX_ROW("7")
+  HEX_ROW("8") HEX_ROW("9") HEX_ROW("A") HEX_ROW("B")
+  HEX_ROW("C") HEX_ROW("D") HEX_ROW("E") HEX_ROW("F");
+
+int bufferPrintHex(char *buf, int size, const void *data, int n)
+{
+  const uint8_t *ptr = (const uint8_t*) data;
+  int i = 0;
+
+  if(n > size/2)
+    // Whole bytes only
+    n = size/2;
+
+  for(i = 0; i < n; i++)
+    memcpy(&buf[2*i], &hexPairs[2*ptr[i]], 2);
+
+  return n > 0 ? 2*n : 0;
 }
 
-int bufferPrintUL(char *buf, int size, unsigned long v, uint8_t base, uint8_t p)
+//
+// Float conversion. The value is taken apart into its mantissa and binary
+// exponent and scaled into an integer exactly, so the digits are correctly
+// rounded (to nearest, ties to even) without any float arithmetic. The
+// integer part of a float can be close to 2^128, it is kept in 32-bit limbs
+// and converted nine digits at a time.
+//
+
+#define FP_MAX_DECIMALS   9
+#define FP_LIMBS          4
+#define FP_CHUNKS         5
+#define FP_CHUNK          1000000000UL
+
+static int fpCopy(char *buffer, int size, const char *s, int n)
 {
-  int l = 0;
+  if(n > size)
+    n = size;
 
-  while(l < size) {
-    uint8_t digit = v % base;
-    buf[l++] = digit < 10 ? ('0' + digit) : ('A' + digit - 10);
-    v /= base;
+  if(n > 0)
+    memcpy(buffer, s, n);
+
+  return n > 0 ? n : 0;
+}
+
+int bufferPrintFP(char *buffer, int size, float v, int w, int p)
+{
+  union { float f; uint32_t u; } bits = { .f = v };
+  uint32_t mantissa = bits.u & 0x7FFFFFUL, integer = 0, fraction = 0;
+  int exponent = (bits.u >> 23) & 0xFF;
+  char digits[FP_CHUNKS*9], *ptr = &digits[sizeof(digits)];
+  int len = 0, i = 0;
+
+  if(p < 0)
+    p = 0;
+  else if(p > FP_MAX_DECIMALS)
+    p = FP_MAX_DECIMALS;
+  
+  if(exponent == 0xFF && mantissa)
+    return size > 3 ? fpCopy(buffer, size, "nan", 3) : 0;
+
+  if(bits.u >> 31)
+    len += fpCopy(buffer, size, "-", 1);
+
+  if(exponent == 0xFF)
+    return size - len > 3 ? len + fpCopy(&buffer[len], size - len, "inf", 3) : 0;
+
+  if(exponent)
+    mantissa |= 1UL << 23;
+  else
+    // Subnormal
+    exponent = 1;
+
+  exponent -= 127 + 23;
+
+  if(exponent > 8) {
+    // An integer beyond 32 bits, place the mantissa in the limbs
     
-    if(!v)
-      break;
-  }
+    uint32_t limb[FP_LIMBS] = { 0 };
+    int word = exponent / 32, shift = exponent % 32, top = FP_LIMBS;
+
+    limb[word] = mantissa << shift;
+    
+    if(shift > 8 && word < FP_LIMBS - 1)
+      limb[word+1] = mantissa >> (32 - shift);
+
+    do {
+      uint64_t rest = 0;
+
+      while(top > 0 && !limb[top-1])
+	top--;
+    
+      for(i = top - 1; i >= 0; i--) {
+	rest = (rest << 32) | limb[i];
+	limb[i] = (uint32_t) (rest / FP_CHUNK);
+	rest %= FP_CHUNK;
+      }
+
+      ptr -= 9;
+      bufferPrintUL(ptr, 9, (unsigned long) rest, 10, 9);
+
+      while(top > 0 && !limb[top-1])
+	top--;
+    } while(top > 0);
+
+    while(*ptr == '0')
+      ptr++;
+  } else {
+    if(exponent >= 0)
+      integer = mantissa << exponent;
+    else {
+      // Scale the fractional bits by 10^p and shift the binary point out,
+      // the product stays below 2^54 so anything shifted by more than
+      // that rounds to zero
+      
+      int shift = -exponent;
+      uint64_t scaled = 0, q = 0;
+
+      if(shift < 32) {
+	integer = mantissa >> shift;
+	mantissa &= (1UL << shift) - 1;
+      }
 
-  while(l < p)
-    buf[l++] = '0';
+      scaled = (uint64_t) mantissa * decimalPowers[p];
+	
+      if(shift < 64) {
+	uint64_t half = 1ULL << (shift - 1), rest = scaled & ((half << 1) - 1);
+	
+	q = scaled >> shift;
+
+	if(rest > half || (rest == half && ((p > 0 ? q : integer) & 1)))
+	  q++;
+      }
+
+      if(q == decimalPowers[p]) {
+	// Rounded up into the integer part
+	integer++;
+	q = 0;
+      }
 
-  if(l > 0) {
-    int i = 0, j = l-1;
-    while(i < j) {
-      char c = buf[j];
-      buf[j--] = buf[i];
-      buf[i++] = c;
+      fraction = (uint32_t) q;
     }
+
+    ptr -= digitsDecimal(integer);
+    bufferPrintUL(ptr, &digits[sizeof(digits)] - ptr, integer, 10, 0);
   }
 
-  return l;
+  for(i = &digits[sizeof(digits)] - ptr; i < w && len < size; i++)
+    buffer[len++] = '0';
+
+  len += fpCopy(&buffer[len], size - len, ptr, &digits[sizeof(digits)] - ptr);
+  
+  if(p > 0) {
+    char decimals[FP_MAX_DECIMALS];
+
+    len += fpCopy(&buffer[len], size - len, ".", 1);
+    bufferPrintUL(decimals, p, fraction, 10, p);
+    len += fpCopy(&buffer[len], size - len, decimals, p);
+  }
+
+  return len;
 }
 
 int bufferPrintL(char *buf, int size, long v, uint8_t base, uint8_t p)
@@ -80,59 +303,55 @@ int bufferPrintL(char *buf, int size, long v, uint8_t base, uint8_t p)
     return bufferPrintUL(buf, size, (unsigned long) v, base, p);
 }
 
-static void stringPad(char *b, int len, char c)
-{
-  while(len-- > 0)
-    *b++ = c;
-}
+//
+// Output goes to a sink in chunks, clipped at the limit. The buffer variants
+// use a sink that copies into the caller's buffer.
+//
 
-static int stringAppendPaddedLeft(char *b, int size, int w, const char *field, int fieldLen, char pad)
-{
-  int padLen = w - fieldLen;
+typedef struct {
+  StringFmtSink_t sink;
+  void *context;
+  int len, limit;
+} FmtOut_t;
 
-  if(padLen < 0)
-    padLen = 0;
+static void fmtEmit(FmtOut_t *o, const char *data, int size)
+{
+  if(size > o->limit - o->len)
+    size = o->limit - o->len;
 
-  if(padLen > size) {
-    stringPad(b, size, pad);
-    return size;
+  if(size > 0) {
+    (*o->sink)(o->context, data, size);
+    o->len += size;
   }
-
-  stringPad(b, padLen, pad);    
-    
-  if(padLen + fieldLen > size) {
-    strncpy(&b[padLen], field, size - padLen);
-    return size;
-  } else
-    strncpy(&b[padLen], field, fieldLen);
-  
-  return fieldLen + padLen;
 }
 
-static int stringAppendPaddedRight(char *b, int size, int w, const char *field, int fieldLen)
+static void fmtPad(FmtOut_t *o, char c, int size)
 {
-  int padLen = w - fieldLen;
+  char pad[PRINT_FMT_FIELD>>1];
 
-  if(padLen < 0)
-    padLen = 0;
-
-  if(fieldLen > size) {
-    strncpy(b, field, size);
-    return size;
-  }
+  if(size < 1)
+    return;
   
-  strncpy(b, field, fieldLen);
-  stringPad(&b[fieldLen], padLen, ' ');
+  memset(pad, c, size < (int) sizeof(pad) ? size : (int) sizeof(pad));
   
-  return fieldLen + padLen;
+  while(size > 0 && o->len < o->limit) {
+    int chunk = size < (int) sizeof(pad) ? size : (int) sizeof(pad);
+    fmtEmit(o, pad, chunk);
+    size -= chunk;
+  }
 }
 
-static int stringAppendPadded(char *b, int size, int w, const char *field, int fieldLen, char pad, bool leftJust)
+static void fmtPadded(FmtOut_t *o, int w, const char *field, int fieldLen, char pad, bool leftJust)
 {
-  if(leftJust)
-    return stringAppendPaddedRight(b, size, w, field, fieldLen);
-  else
-    return stringAppendPaddedLeft(b, size, w, field, fieldLen, pad);
+  int padLen = w - fieldLen;
+
+  if(leftJust) {
+    fmtEmit(o, field, fieldLen);
+    fmtPad(o, ' ', padLen);
+  } else {
+    fmtPad(o, pad, padLen);
+    fmtEmit(o, field, fieldLen);
+  }
 }
 
 const char *decodeSpec(const char *p, int *value)
@@ -148,142 +367,417 @@ const char *decodeSpec(const char *p, int *value)
   return p;
 }
 
-int vStringFmt(char *b, int size, const char *f, va_list args)
+//
+// Argument source, either a va_list or a record packed by stringFmtPack().
+// Packed records hold integers as 32-bit words, floating point values as
+// floats and strings as a length byte followed by the characters, all in
+// native byte order.
+//
+
+typedef struct {
+  va_list args;
+  const uint8_t *packed;
+  int packedSize;
+} FmtArgs_t;
+
+typedef union {
+  long l;
+  unsigned long ul;
+  double d;
+  struct {
+    const char *s;
+    int len;
+  } str;
+} FmtArgValue_t;
+
+typedef enum { fmt_arg_none, fmt_arg_int, fmt_arg_uint, fmt_arg_long, fmt_arg_ulong, fmt_arg_double, fmt_arg_string } FmtArgType_t;
+
+static FmtArgType_t fmtArgType(char conv)
 {
-  char field[PRINT_FMT_FIELD+1];
-  int fieldLen = 0, len = 0;
+  switch(conv) {
+  case 'c':
+  case 'd':
+  case 't':
+    return fmt_arg_int;
+  case 'u':
+    return fmt_arg_uint;
+  case 'D':
+  case 'p':
+    return fmt_arg_long;
+  case 'x':
+  case 'X':
+  case 'U':
+    return fmt_arg_ulong;
+  case 'f':
+    return fmt_arg_double;
+  case 's':
+    return fmt_arg_string;
+  default:
+    return fmt_arg_none;
+  }
+}
+
+static bool fmtArgUnpack(FmtArgs_t *a, void *value, int size)
+{
+  if(a->packedSize < size) {
+    a->packedSize = 0;
+    return false;
+  }
+
+  memcpy(value, a->packed, size);
+  a->packed += size;
+  a->packedSize -= size;
+  return true;
+}
+
+static void fmtArgFetch(FmtArgs_t *a, FmtArgType_t type, FmtArgValue_t *v)
+{
+  memset(v, 0, sizeof(*v));
+  v->str.s = "";
   
-  while(len < size && *f != '\0') {
-    int w = 0, p = -1;
-    char padChar = ' ';
-    bool leftJust = false, print0x = false;
-    const char *sp = NULL;
+  if(a->packed) {
+    int32_t word = 0;
+    float fp = 0.0f;
+    uint8_t len = 0;
     
-    while(len < size && *f != '\0' && *f != '%')
-      b[len++] = *f++;
-
-    if(*f != '%')
+    switch(type) {
+    case fmt_arg_int:
+    case fmt_arg_long:
+      if(fmtArgUnpack(a, &word, sizeof(word)))
+	v->l = (long) word;
+      break;
+    case fmt_arg_uint:
+    case fmt_arg_ulong:
+      if(fmtArgUnpack(a, &word, sizeof(word)))
+	v->ul = (unsigned long) (uint32_t) word;
+      break;
+    case fmt_arg_double:
+      if(fmtArgUnpack(a, &fp, sizeof(fp)))
+	v->d = fp;
+      break;
+    case fmt_arg_string:
+      if(fmtArgUnpack(a, &len, sizeof(len)) && len <= a->packedSize) {
+	v->str.s = (const char*) a->packed;
+	v->str.len = len;
+	a->packed += len;
+	a->packedSize -= len;
+      }
+      break;
+    default:
+      break;
+    }
+  } else {
+    switch(type) {
+    case fmt_arg_int:
+      v->l = (long) va_arg(a->args, int);
       break;
+    case fmt_arg_uint:
+      v->ul = (unsigned long) va_arg(a->args, unsigned int);
+      break;
+    case fmt_arg_long:
+      v->l = va_arg(a->args, long);
+      break;
+    case fmt_arg_ulong:
+      v->ul = va_arg(a->args, unsigned long);
+      break;
+    case fmt_arg_double:
+      v->d = va_arg(a->args, double);
+      break;
+    case fmt_arg_string:
+      v->str.s = (const char*) va_arg(a->args, const char*);
+      v->str.len = strlen(v->str.s);
+      break;
+    default:
+      break;
+    }
+  }
+}
 
-    // We have a formatting spec
+//
+// Conversion spec
+//
 
+static const char *decodeFormat(const char *f, StringFmtSpec_t *spec)
+{
+  // f points past the '%'
+  
+  int value = 0;
+  
+  spec->w = 0;
+  spec->p = -1;
+  spec->padChar = ' ';
+  spec->leftJust = spec->print0x = false;
+  
+  if(*f == '-') {
+    // Left justified
+    spec->leftJust = true;
+    f++;
+  }
+    
+  if(*f == '0') {
+    // Pad with zeroes
+    spec->padChar = '0';
     f++;
+  }
+    
+  if(*f == '#') {
+    // Precede hex numbers by 0x
+    spec->print0x = true;
+    f++;
+  }
+    
+  if(isdigit(*f)) {
+    f = decodeSpec(f, &value);
+    spec->w = value;
+  }
 
-    if(*f == '-') {
-      // Left justified
-      leftJust = true;
-      f++;
+  if(*f == '.') {
+    f++;
+    if(isdigit(*f)) {
+      f = decodeSpec(f, &value);
+      spec->p = value;
     }
+  }
+
+  spec->conv = *f;
+
+  if(*f != '\0')
+    f++;
+  
+  return f;
+}
+
+static void fmtConvert(FmtOut_t *o, const StringFmtSpec_t *spec, FmtArgs_t *args)
+{
+  FmtArgValue_t v;
+  char field[PRINT_FMT_FIELD+1];
+  int fieldLen = 0, p = 0;
+  
+  fmtArgFetch(args, fmtArgType(spec->conv), &v);
+  p = spec->p < 0 ? 0 : spec->p;
     
-    if(*f == '0') {
-      // Pad with zeroes
-      padChar = '0';
-      f++;
-    }
+  switch(spec->conv) {
+  case '%':
+    fmtEmit(o, "%", 1);
+    break;
+    
+  case 't':
+    // Our own extension - tabulator
+    fmtPad(o, spec->padChar, (int) v.l - o->len);
+    break;
+    
+  case 'c':
+    field[0] = (char) v.l;
+    fmtPadded(o, spec->w, field, 1, spec->padChar, spec->leftJust);
+    break;
+
+  case 's':
+    fmtPadded(o, spec->w, v.str.s, v.str.len, spec->padChar, spec->leftJust);
+    break;
+      
+  case 'd':
+  case 'D':
+    fieldLen = bufferPrintL(field, PRINT_FMT_FIELD, v.l, 10, p);
+    fmtPadded(o, spec->w, field, fieldLen, spec->padChar, spec->leftJust);
+    break;
+
+  case 'x':
+  case 'X':
+    if(spec->print0x) {
+      field[0] = '0';
+      field[1] = 'x';
+      fieldLen = 2 + bufferPrintUL(&field[2], PRINT_FMT_FIELD-2, v.ul, 16, p);
+    } else
+      fieldLen = bufferPrintUL(field, PRINT_FMT_FIELD, v.ul, 16, p);
+      
+    fmtPadded(o, spec->w, field, fieldLen, spec->padChar, spec->leftJust);
+    break;
+
+  case 'u':
+  case 'U':
+    fieldLen = bufferPrintUL(field, PRINT_FMT_FIELD, v.ul, 10, p);
+    fmtPadded(o, spec->w, field, fieldLen, spec->padChar, spec->leftJust);
+    break;
+
+  case 'p':
+    fmtEmit(o, "@", 1);
+    fieldLen = bufferPrintUL(field, PRINT_FMT_FIELD, (unsigned long) v.l, 16, p);
+    fmtPadded(o, spec->w, field, fieldLen, spec->padChar, spec->leftJust);
+    break;
+
+  case 'f':
+    fieldLen = bufferPrintFP(field, PRINT_FMT_FIELD, (float) v.d, 1, spec->p < 0 ? 5 : spec->p);
+    fmtPadded(o, spec->w, field, fieldLen, spec->padChar, spec->leftJust);
+    break;
+
+  default:
+    fmtEmit(o, "Blob", 4);
+    break;
+  }
+}
+
+static int fmtCore(FmtOut_t *o, const char *f, FmtArgs_t *args)
+{
+  while(o->len < o->limit && *f != '\0') {
+    StringFmtSpec_t spec;
+    const char *literal = f;
     
-    if(*f == '#') {
-      // Precede hex numbers by 0x
-      print0x = true;
+    while(*f != '\0' && *f != '%')
       f++;
-    }
+
+    fmtEmit(o, literal, f - literal);
     
-    if(isdigit(*f))
-      f = decodeSpec(f, &w);
+    if(*f != '%' || o->len >= o->limit)
+      break;
+
+    // We have a formatting spec
+
+    f = decodeFormat(f+1, &spec);
+    fmtConvert(o, &spec, args);
+  }
+
+  return o->len;
+}
 
-    if(*f == '.') {
+//
+// Compiled formats
+//
+
+bool stringFmtCompile(StringFmtCompiled_t *c, const char *f)
+{
+  const char *literal = f;
+
+  c->format = f;
+  c->specs = 0;
+  
+  while(*f != '\0') {
+    if(*f != '%') {
       f++;
-      if(isdigit(*f))
-	f = decodeSpec(f, &p);
+      continue;
     }
 
-    switch(*f++) {
-    case '%':
-      b[len++] = '%';
-      break;
-      
-    case 't':
-      // Our own extension - tabulator
-      fieldLen = va_arg(args, int);
+    if(c->specs >= STRING_FMT_MAX_SPECS || f - c->format > UINT16_MAX)
+      return false;
+    
+    c->item[c->specs].literal = literal - c->format;
+    c->item[c->specs].literalLen = f - literal;
+    literal = f = decodeFormat(f+1, &c->item[c->specs].spec);
+    c->specs++;
+  }
 
-      if(len < fieldLen)
-	len += stringAppendPadded(&b[len], size - len, fieldLen - len, "", 0, padChar, false);
-      break;
-      
-    case 'c':
-      field[0] =  (char) va_arg(args, int);
-      len += stringAppendPadded(&b[len], size - len, w, field, 1, padChar, leftJust);
-      break;
+  if(f - c->format > UINT16_MAX)
+    return false;
+  
+  c->tail = literal - c->format;
+  c->tailLen = f - literal;
+  
+  return true;
+}
 
-    case 's':
-      sp = (const char*) va_arg(args, const char*);
-      len += stringAppendPadded(&b[len], size - len, w, sp, strlen(sp), padChar, leftJust);
-      break;
-	
-    case 'd':
-      if(p < 0)
-	p = 0;
-      fieldLen = bufferPrintL(field, PRINT_FMT_FIELD, (long) va_arg(args, int), 10, p);
-      len += stringAppendPadded(&b[len], size - len, w, field, fieldLen, padChar, leftJust);
-      break;
+static int fmtCompiled(FmtOut_t *o, const StringFmtCompiled_t *c, FmtArgs_t *args)
+{
+  int i = 0;
 
-    case 'D':
-      if(p < 0)
-	p = 0;
-      fieldLen = bufferPrintL(field, PRINT_FMT_FIELD, (long) va_arg(args, long), 10, p);
-      len += stringAppendPadded(&b[len], size - len, w, field, fieldLen, padChar, leftJust);
+  for(i = 0; i < c->specs && o->len < o->limit; i++) {
+    fmtEmit(o, &c->format[c->item[i].literal], c->item[i].literalLen);
+    
+    if(o->len >= o->limit)
       break;
+    
+    fmtConvert(o, &c->item[i].spec, args);
+  }
 
-    case 'x':
-    case 'X':
-      if(p < 0)
-	p = 0;
-      if(print0x) {
-	field[0] = '0';
-	field[1] = 'x';
-	fieldLen = 2 + bufferPrintUL(&field[2], PRINT_FMT_FIELD-2, (unsigned long) va_arg(args, unsigned long), 16, p);
-      } else
-	fieldLen = bufferPrintUL(field, PRINT_FMT_FIELD, (unsigned long) va_arg(args, unsigned long), 16, p);
-	
-      len += stringAppendPadded(&b[len], size - len, w, field, fieldLen, padChar, leftJust);
-      break;
+  if(i == c->specs)
+    fmtEmit(o, &c->format[c->tail], c->tailLen);
 
-    case 'u':
-      if(p < 0)
-	p = 0;
-      fieldLen = bufferPrintUL(field, PRINT_FMT_FIELD, (unsigned long) va_arg(args, unsigned int), 10, p);
-      len += stringAppendPadded(&b[len], size - len, w, field, fieldLen, padChar, leftJust);
-      break;
+  return o->len;
+}
 
-    case 'U':
-      if(p < 0)
-	p = 0;
-      fieldLen = bufferPrintUL(field, PRINT_FMT_FIELD, (unsigned long) va_arg(args, unsigned long), 10, p);
-      len += stringAppendPadded(&b[len], size - len, w, field, fieldLen, padChar, leftJust);
-      break;
+int vStringFmtCompiled(StringFmtSink_t sink, void *context, int limit, const StringFmtCompiled_t *c, va_list args)
+{
+  FmtArgs_t a = { .packed = NULL, .packedSize = 0 };
+  FmtOut_t o = { .sink = sink, .context = context, .len = 0, .limit = limit };
+  int len = 0;
 
-    case 'p':
-      b[len++] = '@';
-      if(len < size) {
-	if(p < 0)
-	  p = 0;
-	fieldLen = bufferPrintUL(field, PRINT_FMT_FIELD, (unsigned long) va_arg(args, long), 16, p);
-	len += stringAppendPadded(&b[len], size - len, w, field, fieldLen, padChar, leftJust);
-      }
-      break;
+  va_copy(a.args, args);
+  len = fmtCompiled(&o, c, &a);
+  va_end(a.args);
 
-    case 'f':
-      if(p < 0)
-	p = 5;
-      fieldLen = bufferPrintFP(field, size - len, (float) va_arg(args, double), 1, p);
-      len += stringAppendPadded(&b[len], size - len, w, field, fieldLen, padChar, leftJust);
-      break;
+  return len;
+}
 
-    default:
-      strcpy(&b[len], "Blob");
-      len += 4;
-      break;
-    }
+#if STRING_FMT_CACHE_SLOTS > 0
+
+//
+// Format cache. Each slot is a sequence lock: a writer keeps the sequence
+// odd while it replaces the entry, readers copy the entry out and compile
+// the format themselves if the sequence moved under them. A miss replaces
+// the slot unless another task is already writing it.
+//
+
+typedef struct {
+  atomic_uint seq;
+  StringFmtCompiled_t compiled;
+} FmtCacheSlot_t;
+
+static FmtCacheSlot_t fmtCache[STRING_FMT_CACHE_SLOTS];
+
+static bool fmtCacheLookup(StringFmtCompiled_t *c, const char *f)
+{
+  uintptr_t key = (uintptr_t) f;
+  FmtCacheSlot_t *slot = &fmtCache[(key ^ (key >> 5)) % STRING_FMT_CACHE_SLOTS];
+  unsigned int seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+
+  if(!(seq & 1)) {
+    // Only the items in use, a torn count is caught by the sequence check
+    
+    int specs = slot->compiled.specs;
+    
+    if(specs > STRING_FMT_MAX_SPECS)
+      specs = STRING_FMT_MAX_SPECS;
+    
+    memcpy(c, &slot->compiled, offsetof(StringFmtCompiled_t, item) + specs*sizeof(c->item[0]));
+    atomic_thread_fence(memory_order_acquire);
+    
+    if(c->format == f && atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq)
+      return true;
+  }
+
+  // Miss
+
+  if(!stringFmtCompile(c, f))
+    return false;
+
+  if(!(seq & 1)
+     && atomic_compare_exchange_strong_explicit(&slot->seq, &seq, seq + 1,
+						memory_order_relaxed, memory_order_relaxed)) {
+    atomic_thread_fence(memory_order_release);
+    memcpy(&slot->compiled, c, sizeof(*c));
+    atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
   }
+  
+  return true;
+}
+
+#endif
+
+typedef struct {
+  char *b;
+  int len;
+} FmtBufferSink_t;
+
+static void fmtBufferSink(void *context, const char *data, int size)
+{
+  FmtBufferSink_t *buffer = (FmtBufferSink_t*) context;
+  memcpy(&buffer->b[buffer->len], data, size);
+  buffer->len += size;
+}
+
+static int fmtToBuffer(char *b, int size, const char *f, FmtArgs_t *args)
+{
+  FmtBufferSink_t buffer = { .b = b, .len = 0 };
+  FmtOut_t o = { .sink = fmtBufferSink, .context = &buffer, .len = 0, .limit = size };
+  int len = fmtCore(&o, f, args);
 
   if(len < size)
     // Only add terminator if space remains
@@ -292,6 +786,52 @@ int vStringFmt(char *b, int size, const char *f, va_list args)
   return len;
 }
 
+int vStringFmt(char *b, int size, const char *f, va_list args)
+{
+  FmtArgs_t a = { .packed = NULL, .packedSize = 0 };
+  int len = 0;
+
+  va_copy(a.args, args);
+  len = fmtToBuffer(b, size, f, &a);
+  va_end(a.args);
+
+  return len;
+}
+
+int vStringFmtSink(StringFmtSink_t sink, void *context, int limit, const char *f, va_list args)
+{
+  FmtArgs_t a = { .packed = NULL, .packedSize = 0 };
+  FmtOut_t o = { .sink = sink, .context = context, .len = 0, .limit = limit };
+  int len = 0;
+  
+  va_copy(a.args, args);
+  len = fmtCore(&o, f, &a);
+  va_end(a.args);
+
+  return len;
+}
+
+int vStringFmtSinkCached(StringFmtSink_t sink, void *context, int limit, const char *f, va_list args)
+{
+#if STRING_FMT_CACHE_SLOTS > 0
+  FmtArgs_t a = { .packed = NULL, .packedSize = 0 };
+  FmtOut_t o = { .sink = sink, .context = context, .len = 0, .limit = limit };
+  StringFmtCompiled_t c;
+  int len = 0;
+  
+  va_copy(a.args, args);
+  if(fmtCacheLookup(&c, f))
+    len = fmtCompiled(&o, &c, &a);
+  else
+    len = fmtCore(&o, f, &a);
+  va_end(a.args);
+
+  return len;
+#else
+  return vStringFmtSink(sink, context, limit, f, args);
+#endif
+}
+
 int stringFmt(char *b, int size, const char *f, ...)
 {
   int len = 0;
@@ -304,3 +844,68 @@ int stringFmt(char *b, int size, const char *f, ...)
   return len;
 }
 
+int stringFmtPack(uint8_t *b, int size, const char *f, va_list args)
+{
+  FmtArgs_t a = { .packed = NULL, .packedSize = 0 };
+  int len = 0;
+
+  va_copy(a.args, args);
+  
+  while((f = strchr(f, '%')) != NULL) {
+    StringFmtSpec_t spec;
+    FmtArgType_t type = fmt_arg_none;
+    FmtArgValue_t v;
+    int32_t word = 0;
+    float fp = 0.0f;
+    uint8_t strLen = 0;
+    
+    f = decodeFormat(f+1, &spec);
+    type = fmtArgType(spec.conv);
+    fmtArgFetch(&a, type, &v);
+
+    switch(type) {
+    case fmt_arg_int:
+    case fmt_arg_long:
+    case fmt_arg_uint:
+    case fmt_arg_ulong:
+      word = (int32_t) v.l;
+      if(len + (int) sizeof(word) <= size) {
+	memcpy(&b[len], &word, sizeof(word));
+	len += sizeof(word);
+      }
+      break;
+      
+    case fmt_arg_double:
+      fp = (float) v.d;
+      if(len + (int) sizeof(fp) <= size) {
+	memcpy(&b[len], &fp, sizeof(fp));
+	len += sizeof(fp);
+      }
+      break;
+
+    case fmt_arg_string:
+      if(len < size) {
+	strLen = v.str.len > 0xFF ? 0xFF : v.str.len;
+	if(strLen > size - len - 1)
+	  strLen = size - len - 1;
+	b[len++] = strLen;
+	memcpy(&b[len], v.str.s, strLen);
+	len += strLen;
+      }
+      break;
+      
+    default:
+      break;
+    }
+  }
+
+  va_end(a.args);
+  
+  return len;
+}
+
+int stringFmtUnpack(char *b, int size, const char *f, const uint8_t *packed, int packedSize)
+{
+  FmtArgs_t a = { .packed = packed, .packedSize = packedSize };
+  return fmtToBuffer(b, size, f, &a);
+}
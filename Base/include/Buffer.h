@@ -3,26 +3,75 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdatomic.h>
 
+//
+// Single producer, single consumer ring buffer. The producer only ever
+// stores inPtr and the consumer only ever stores outPtr, the indices are
+// published with release semantics and observed with acquire semantics so
+// the ring is safe between an ISR and a task as well as between tasks on
+// different cores.
+//
+// The index width is a build time choice (-DVPBUFFER_INDEX_BITS=8/16/32).
+// The ring size, a power of two, is limited to 1<<VPBUFFER_INDEX_BITS bytes
+// with 8 and 16 bit indices. With 32 bit indices sizes are still signed 32
+// bit (VPBufferSize_t) and the limit is 1<<30 bytes.
+//
+
+#ifndef VPBUFFER_INDEX_BITS
+#define VPBUFFER_INDEX_BITS    16
+#endif
+
+#if VPBUFFER_INDEX_BITS == 8
 typedef uint8_t VPBufferIndex_t;
 typedef int16_t VPBufferSize_t;
-
-#define VPBUFFER_INDEX(b, p, i) (((p)+(i)) & (b).mask)
-#define VPBUFFER_GAUGE(b)       (((b).inPtr - (b).outPtr) & (b).mask)
-#define VPBUFFER_SPACE(b)       ((b).mask - VPBUFFER_GAUGE(b))
+#elif VPBUFFER_INDEX_BITS == 16
+typedef uint16_t VPBufferIndex_t;
+typedef int32_t VPBufferSize_t;
+#elif VPBUFFER_INDEX_BITS == 32
+typedef uint32_t VPBufferIndex_t;
+typedef int32_t VPBufferSize_t;
+#else
+#error "VPBUFFER_INDEX_BITS must be 8, 16 or 32"
+#endif
 
 typedef struct VPBuffer {
-	volatile VPBufferIndex_t inPtr, outPtr, watermark;
+	_Atomic VPBufferIndex_t inPtr, outPtr, watermark;
 	VPBufferIndex_t mask;
-	volatile char *storage;
-	volatile bool overrun;
+	char *storage;
+	atomic_bool overrun;
 } VPBuffer_t;
 
-#define VPBUFFER_CONS_WM(store, wm) { 0, 0, wm, sizeof(store) - 1, (volatile char*) store }
-#define VPBUFFER_CONS(store) { 0, 0, 0, sizeof(store) - 1, (volatile char*) store }
+// A contiguous readable region of the ring, see vpbuffer_peek()
+
+typedef struct VPBufferSpan {
+  const char *data;
+  VPBufferSize_t size;
+} VPBufferSpan_t;
+
+#define VPBUFFER_CONS_WM(store, wm) { 0, 0, wm, sizeof(store) - 1, (char*) store }
+#define VPBUFFER_CONS(store) { 0, 0, 0, sizeof(store) - 1, (char*) store }
 #define VPBUFFER_CONS_NULL { 0, 0, 0, 0, NULL }
 
+static inline VPBufferIndex_t vpbuffer_gaugeOf(const VPBuffer_t *i)
+{
+  return (atomic_load_explicit(&i->inPtr, memory_order_acquire)
+	  - atomic_load_explicit(&i->outPtr, memory_order_acquire)) & i->mask;
+}
+
+#define VPBUFFER_INDEX(b, p, i) (((p)+(i)) & (b).mask)
+#define VPBUFFER_GAUGE(b)       vpbuffer_gaugeOf(&(b))
+#define VPBUFFER_SPACE(b)       ((b).mask - VPBUFFER_GAUGE(b))
+
 void vpbuffer_init(VPBuffer_t*, VPBufferSize_t size, char *storage);
+
+// Without room for all of it vpbuffer_insert() stores what fits, or with
+// overwrite set takes back the newest unconsumed data to make room. That
+// moves inPtr backwards under a consumer that may already be reading the
+// data, so overwrite is not safe with a concurrent consumer: use it only
+// when the consumer is locked out, or have the consumer side drop the
+// oldest data with vpbuffer_consume() instead.
+
 VPBufferSize_t vpbuffer_insert(VPBuffer_t*, const char *b, VPBufferSize_t s, bool overwrite);
 VPBufferSize_t vpbuffer_extract(VPBuffer_t*, char *, VPBufferSize_t);
 void vpbuffer_flush(VPBuffer_t*);
@@ -30,6 +79,14 @@ bool vpbuffer_hasOverrun(VPBuffer_t*);
 void vpbuffer_insertChar(VPBuffer_t*, char c);
 char vpbuffer_extractChar(VPBuffer_t*);
 
+// Zero-copy consumer access: peek returns the readable data as one or two
+// spans (the second one is empty unless the data wraps around) and the
+// total size, consume then releases the given number of bytes back to the
+// producer.
+
+VPBufferSize_t vpbuffer_peek(VPBuffer_t*, VPBufferSpan_t span[2]);
+void vpbuffer_consume(VPBuffer_t*, VPBufferSize_t);
+
 #define vpbuffer_space(i) VPBUFFER_SPACE(*i)
 #define vpbuffer_gauge(i) VPBUFFER_GAUGE(*i)
 
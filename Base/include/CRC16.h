@@ -1,11 +1,17 @@
 #ifndef CRC16_H
 #define CRC16_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 uint16_t crc16_update(uint16_t crc, uint8_t a);
 uint16_t crc16(uint16_t initial, const uint8_t *data, int len);
 
+// CRC of the concatenation A|B from crcA = crc16(initial, A) and
+// crcB = crc16(initial, B)
+
+uint16_t crc16_combine(uint16_t crcA, uint16_t crcB, uint16_t initial, size_t lenB);
+
 #endif
 
 
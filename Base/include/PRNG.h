@@ -16,6 +16,7 @@ void randomNumber(uint8_t *buffer, size_t size);
 
 uint8_t randomUI8(void);
 uint16_t randomUI16(void);
+uint32_t randomUI32(void);
 
 #endif	/* PRNG_H */
 
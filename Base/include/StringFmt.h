@@ -7,12 +7,69 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-#define PRINT_FMT_FIELD    (1<<5)
+#define PRINT_FMT_FIELD    (1<<6)
 
 int stringFmt(char *b, int size, const char *f, ...);
 int vStringFmt(char *b, int size, const char *f, va_list args);
+
+// Streaming variant: the output is handed to the sink in chunks as it is
+// produced, at most limit characters in total, no terminator
+
+typedef void (*StringFmtSink_t)(void *context, const char *data, int size);
+
+int vStringFmtSink(StringFmtSink_t sink, void *context, int limit, const char *f, va_list args);
 int bufferPrintFP(char *buffer, int size, float v, int w, int p);
 int bufferPrintUL(char *buf, int size, unsigned long v, uint8_t base, uint8_t p);
 int bufferPrintL(char *buf, int size, long v, uint8_t base, uint8_t p);
 
+// Upper case hex of n bytes, two characters each, as many whole bytes as
+// fit and no terminator
+
+int bufferPrintHex(char *buf, int size, const void *data, int n);
+
+// Deferred formatting: pack the arguments of a format into a compact binary
+// record on the target and rebuild the text elsewhere from the same format
+
+int stringFmtPack(uint8_t *b, int size, const char *f, va_list args);
+int stringFmtUnpack(char *b, int size, const char *f, const uint8_t *packed, int packedSize);
+
+// Compiled formats: the format is parsed once into literal runs and
+// conversion specs, executing it only walks the arguments. Formats with
+// more than STRING_FMT_MAX_SPECS conversions don't compile.
+//
+// vStringFmtSinkCached() keeps the most recently used formats compiled in
+// a small cache keyed by the format pointer (STRING_FMT_CACHE_SLOTS, 0 to
+// disable). Its formats must be string literals: a format rebuilt in the
+// same buffer or passed on from a caller would find the specs of another
+// one.
+
+#ifndef STRING_FMT_MAX_SPECS
+#define STRING_FMT_MAX_SPECS    8
+#endif
+
+#ifndef STRING_FMT_CACHE_SLOTS
+#define STRING_FMT_CACHE_SLOTS  8
+#endif
+
+typedef struct StringFmtSpec {
+  int16_t w, p;
+  char padChar, conv;
+  bool leftJust, print0x;
+} StringFmtSpec_t;
+
+typedef struct StringFmtCompiled {
+  const char *format;
+  uint16_t tail, tailLen;
+  uint8_t specs;
+  struct {
+    // Literal run preceding the conversion, as an offset into the format
+    uint16_t literal, literalLen;
+    StringFmtSpec_t spec;
+  } item[STRING_FMT_MAX_SPECS];
+} StringFmtCompiled_t;
+
+bool stringFmtCompile(StringFmtCompiled_t *c, const char *f);
+int vStringFmtCompiled(StringFmtSink_t sink, void *context, int limit, const StringFmtCompiled_t *c, va_list args);
+int vStringFmtSinkCached(StringFmtSink_t sink, void *context, int limit, const char *f, va_list args);
+
 #endif
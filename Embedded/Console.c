@@ -1,25 +1,78 @@
 #include <math.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
+#include <stdatomic.h>
 #include "Console.h"
 #include "Datagram.h"
 #include "Buffer.h"
 #include "StringFmt.h"
 #include "Scheduler.h"
+#include "Log.h"
 
 #define CONSOLE_BUFFER     (1<<6)
 #if STAP_MACHINE_BIG
 #define PRINT_FMT_BUFFER   (1<<8)
+#define CONSOLE_RING       (1<<10)
 #else
 #define PRINT_FMT_BUFFER   (1<<7)
+#define CONSOLE_RING       (1<<8)
 #endif
 
+// Frames are filled up to half the ring (and never beyond what a datagram
+// can carry), a throttled console sends an eighth of that per deadline
+
+#if CONSOLE_RING/2 < DG_TRANSMIT_MAX
+#define CONSOLE_FRAME      (CONSOLE_RING/2)
+#else
+#define CONSOLE_FRAME      DG_TRANSMIT_MAX
+#endif
+#define CONSOLE_FRAME_THROTTLED  (CONSOLE_FRAME>>3)
+#define CONSOLE_LATENCY          50    // ms
+#define CONSOLE_UTIL_WINDOW      200   // ms
+#define CONSOLE_UTIL_HIGH        750   // permille
+#define CONSOLE_UTIL_LOW         500
+#define CONSOLE_DEBUG_MARKS      8     // drops marked at most
+
+#ifndef CONSOLE_STAGES
+#if STAP_MACHINE_BIG
+#define CONSOLE_STAGES     8
+#else
+#define CONSOLE_STAGES     4
+#endif
+#endif
+
+#ifndef CONSOLE_STAGE_SIZE
+#define CONSOLE_STAGE_SIZE (1<<7)
+#endif
+
+#define CONSOLE_FLUSH_INTERVAL  (20*1000)
+
 DgLink_t *consoleLink;
-bool consoleThrottled;
+bool consoleThrottled, consoleBinary;
+uint32_t consoleLinkCapacity;
 
 static VPBuffer_t consoleBuffer;
-static char consoleBufferStore[CONSOLE_BUFFER];
+static char consoleBufferStore[CONSOLE_RING];
 static int column;
+
+//
+// Per-task staging. Once consoleFlushTask() runs, output from the tasks in
+// StaP_TaskList goes into a ring of its own without taking any lock and
+// the flusher merges the rings into the link a line at a time. Anything
+// else (tasks beyond CONSOLE_STAGES, code running before the scheduler)
+// still goes through the shared buffer under the mutex.
+//
+
+typedef struct {
+  VPBuffer_t buffer;
+  char store[CONSOLE_STAGE_SIZE];
+  int column;
+  uint32_t overruns;
+} ConsoleStage_t;
+
+static ConsoleStage_t consoleStage[CONSOLE_STAGES];
+static atomic_bool consoleStaging, consoleFlushRequest;
 #ifdef STAP_MutexCreate
 static STAP_MutexRef_T mutex = NULL;
 #endif
@@ -47,25 +100,180 @@ static void mutexRelease(void)
   STAP_MutexRelease(mutex);
 }
 
-static void consoleFlushUnsafe(void)
+//
+// Transport. Output is coalesced into DG_CONSOLE frames of up to
+// CONSOLE_FRAME bytes, a frame goes out once that much is pending, when
+// the oldest pending byte is CONSOLE_LATENCY old or on consoleFlush(). The
+// flusher task is what enforces the deadline, so until it runs a line goes
+// out as soon as it ends like it always did.
+//
+// With consoleLinkCapacity (bytes/s) set, the utilization of the console
+// link measured over CONSOLE_UTIL_WINDOW turns consoleThrottled on and off,
+// otherwise it's left to the application.
+//
+
+typedef struct {
+  VPBuffer_t *ring;
+  bool lines;             // Complete lines only
+  VPBufferSize_t ready;
+} ConsoleSource_t;
+
+static bool consolePending;
+static VP_TIME_MILLIS_T consolePendingSince;
+static uint32_t consoleFrames, consoleBytes;
+static uint16_t consoleUtilization;
+
+static char spanChar(const VPBufferSpan_t span[2], VPBufferSize_t i)
 {
-  char buffer[CONSOLE_BUFFER];
-  int8_t s = consoleThrottled ? 16 : sizeof(buffer);
+  return i < span[0].size ? span[0].data[i] : span[1].data[i - span[0].size];
+}
+
+static VPBufferSize_t consoleReady(ConsoleSource_t *source, bool *nearFull)
+{
+  VPBufferSpan_t span[2];
+  VPBufferSize_t size = vpbuffer_peek(source->ring, span);
+
+  if(size > source->ring->mask/2)
+    // Getting full, better send it before it overflows
+    *nearFull = true;
+
+  if(source->lines && size < source->ring->mask) {
+    while(size > 0 && spanChar(span, size - 1) != '\n' && spanChar(span, size - 1) != '\r')
+      size--;
+  }
+
+  return source->ready = size;
+}
+
+static void consoleMeasure(void)
+{
+  static VP_TIME_MILLIS_T windowStart;
+  static uint32_t windowBytes;
+  VP_TIME_MILLIS_T elapsed = VP_ELAPSED_MILLIS(windowStart);
+  uint32_t bytes = 0;
+  uint64_t permille = 0;
+
+  if(!consoleLinkCapacity || elapsed < CONSOLE_UTIL_WINDOW)
+    return;
 
+  // The line carries the framed bytes. The count is never cleared, it
+  // just wraps around
+  
+  bytes = consoleLink->totalTxBytesRaw - windowBytes;
+  permille = (uint64_t) bytes * 1000000U / elapsed / consoleLinkCapacity;
+  consoleUtilization = permille > 0xFFFF ? 0xFFFF : permille;
+
+  if(consoleUtilization > CONSOLE_UTIL_HIGH)
+    consoleThrottled = true;
+  else if(consoleUtilization < CONSOLE_UTIL_LOW)
+    consoleThrottled = false;
+  
+  windowStart += elapsed;
+  windowBytes += bytes;
+}
+
+static void consoleSendUnsafe(ConsoleSource_t *source, int sources, bool force)
+{
+  VPBufferSize_t pending = 0, room = 0;
+  VPBufferSize_t frameMax = consoleThrottled && !force ? CONSOLE_FRAME_THROTTLED : CONSOLE_FRAME;
+  VP_TIME_MILLIS_T latency =
+    atomic_load_explicit(&consoleStaging, memory_order_relaxed) ? CONSOLE_LATENCY : 0;
+  bool nearFull = false, open = false, stop = false;
+  int i = 0, frames = 0;
+  
   if(!consoleLink)
     // Not in use
     return;
 
-  s = vpbuffer_extract(&consoleBuffer, buffer, s);
+  consoleMeasure();
+  
+  for(i = 0; i < sources; i++)
+    pending += consoleReady(&source[i], &nearFull);
+
+  if(!pending) {
+    consolePending = false;
+    return;
+  }
+
+  if(!consolePending) {
+    consolePending = true;
+    consolePendingSince = vpTimeMillis();
+  }
+  
+  if(!force && VP_ELAPSED_MILLIS(consolePendingSince) < latency
+     && (consoleThrottled || (pending < CONSOLE_FRAME && !nearFull)))
+    // Not due yet
+    return;
+
+  for(i = 0; i < sources && !stop; i++) {
+    while(source[i].ready > 0) {
+      VPBufferSpan_t span[2];
+      VPBufferSize_t size = 0, first = 0;
+
+      if(!open) {
+	if(frames > 0 && frameMax == CONSOLE_FRAME_THROTTLED) {
+	  // One frame per deadline when throttled
+	  stop = true;
+	  break;
+	}
+	
+	datagramTxStart(consoleLink, DG_CONSOLE);
+	open = true;
+	room = frameMax;
+      }
+      
+      vpbuffer_peek(source[i].ring, span);
+      size = source[i].ready < room ? source[i].ready : room;
+      first = size < span[0].size ? size : span[0].size;
 
-  if(s > 0) {
-    datagramTxStart(consoleLink, DG_CONSOLE);
-    datagramTxOut(consoleLink, (const uint8_t*) buffer, s);
+      datagramTxOut(consoleLink, (const uint8_t*) span[0].data, first);
+      if(size > first)
+	datagramTxOut(consoleLink, (const uint8_t*) span[1].data, size - first);
+      
+      vpbuffer_consume(source[i].ring, size);
+      source[i].ready -= size;
+      pending -= size;
+      room -= size;
+      consoleBytes += size;
+      
+      if(!room) {
+	datagramTxEnd(consoleLink);
+	frames++;
+	open = false;
+      }
+    }
+  }
+  
+  if(open) {
     datagramTxEnd(consoleLink);
+    frames++;
   }
+
+  consoleFrames += frames;
+
+  // Anything left over waits for another deadline
+  
+  consolePendingSince = vpTimeMillis();
 }
 
-void consoleOut(const char *b, int8_t s)
+static void consoleFlushUnsafe(void)
+{
+  ConsoleSource_t shared = { .ring = &consoleBuffer, .lines = false };
+
+  consoleSendUnsafe(&shared, 1, true);
+}
+
+void consoleTransportStatus(uint32_t *frames, uint32_t *bytes, uint16_t *utilization)
+{
+  if(frames)
+    *frames = consoleFrames;
+  if(bytes)
+    *bytes = consoleBytes;
+  if(utilization)
+    *utilization = consoleUtilization;
+}
+
+static void consoleOutUnsafe(const char *b, int s)
 {
   if(failSafeMode) {
     datagramTxStart(consoleLink, DG_CONSOLE);    
@@ -75,17 +283,20 @@ void consoleOut(const char *b, int8_t s)
     return;
   }
 
-  mutexObtain();
-  
   if(!consoleBuffer.mask)
-    vpbuffer_init(&consoleBuffer, CONSOLE_BUFFER, consoleBufferStore);
+    vpbuffer_init(&consoleBuffer, CONSOLE_RING, consoleBufferStore);
   
-  int8_t space = vpbuffer_space(&consoleBuffer);
+  int space = vpbuffer_space(&consoleBuffer);
   
   if(space >= s || consoleThrottled) {
-    // There's room in the buffer or we must overwrite anyway
+    // There's room in the buffer or we must make room anyway. The oldest
+    // output goes, dropped from the consumer side: the flusher, the only
+    // other consumer, can't be reading the ring while we hold the mutex.
 
-    vpbuffer_insert(&consoleBuffer, b, s, true);
+    if(space < s)
+      vpbuffer_consume(&consoleBuffer, s - space);
+    
+    vpbuffer_insert(&consoleBuffer, b, s, false);
     column += s;
 
   } else {
@@ -94,18 +305,74 @@ void consoleOut(const char *b, int8_t s)
     do {
       consoleFlushUnsafe();
 
-      int8_t w = vpbuffer_insert(&consoleBuffer, b, s, false);
+      int w = vpbuffer_insert(&consoleBuffer, b, s, false);
       b += w;
       s -= w;
       column += w;
     } while(s > 0);
   }
+}
 
-  mutexRelease();
+static ConsoleStage_t *consoleStageOf(void)
+{
+  // The staging ring of the calling task, if it has one
+
+  struct TaskDecl *task = NULL;
+  int i = 0;
+  
+  if(failSafeMode || !atomic_load_explicit(&consoleStaging, memory_order_acquire))
+    return NULL;
+
+  if(!(task = StaP_CurrentTask()))
+    return NULL;
+
+  i = task - StaP_TaskList;
+  
+  return i < CONSOLE_STAGES ? &consoleStage[i] : NULL;
+}
+
+static void consoleStageOut(ConsoleStage_t *stage, const char *b, int s)
+{
+  // Never blocks, what doesn't fit is dropped and counted
+
+  if(vpbuffer_insert(&stage->buffer, b, s, false) < s)
+    stage->overruns++;
+
+  stage->column += s;
+}
+
+static void consoleOutTo(ConsoleStage_t *stage, const char *b, int s)
+{
+  if(stage)
+    consoleStageOut(stage, b, s);
+  else {
+    mutexObtain();
+    consoleOutUnsafe(b, s);
+    mutexRelease();
+  }
+}
+
+void consoleOut(const char *b, int s)
+{
+  consoleOutTo(consoleStageOf(), b, s);
+}
+
+static void consoleSink(void *context, const char *data, int size)
+{
+  if(context)
+    consoleStageOut((ConsoleStage_t*) context, data, size);
+  else
+    consoleOutUnsafe(data, size);
 }
 
 void consoleFlush()
 {
+  if(consoleStageOf()) {
+    // Staged output is the flusher's business
+    atomic_store_explicit(&consoleFlushRequest, true, memory_order_relaxed);
+    return;
+  }
+  
   mutexObtain();
   consoleFlushUnsafe();
   mutexRelease();
@@ -116,28 +383,145 @@ void consoleOutChar(char c)
   consoleOut(&c, 1);
 }
 
+static void consoleEndLine(char c)
+{
+  ConsoleStage_t *stage = consoleStageOf();
+
+  consoleOutTo(stage, &c, 1);
+
+  if(stage)
+    stage->column = 0;
+  else {
+    ConsoleSource_t shared = { .ring = &consoleBuffer, .lines = false };
+    
+    mutexObtain();
+    consoleSendUnsafe(&shared, 1, false);
+    column = 0;
+    mutexRelease();
+  }
+}
+
 void consoleNL(void)
 {
-  consoleOutChar('\n');
-  if(!consoleThrottled)
-    consoleFlush();
-  column = 0;
+  consoleEndLine('\n');
 }
 
 void consoleCR(void)
 {
-  consoleOutChar('\r');
-  if(!consoleThrottled)
-    consoleFlush();
-  column = 0;
+  consoleEndLine('\r');
 }
 
 void consoleTab(int i)
 {
-  int n = i - column;
+  ConsoleStage_t *stage = consoleStageOf();
+  int n = i - (stage ? stage->column : column);
   
   while(n-- > 0)
-    consoleOutChar(' ');
+    consoleOutTo(stage, " ", 1);
+}
+
+static int consoleFormat(StringFmtSink_t sink, void *context, int limit,
+			 const char *f, va_list args, bool literal)
+{
+  // Only a literal may be looked up in the compiled format cache, any
+  // other format could be a different one at the same address
+  
+  if(literal)
+    return vStringFmtSinkCached(sink, context, limit, f, args);
+  else
+    return vStringFmtSink(sink, context, limit, f, args);
+}
+
+static void consolevPrintfText(const char *f, va_list args, bool literal)
+{
+  // Formatted straight into the console ring, the mutex (or the ring of
+  // the task's own) keeps the output of one call together
+
+  ConsoleStage_t *stage = consoleStageOf();
+
+  if(stage)
+    consoleFormat(consoleSink, stage, INT_MAX, f, args, literal);
+  else {
+    mutexObtain();
+    consoleFormat(consoleSink, NULL, INT_MAX, f, args, literal);
+    mutexRelease();
+  }
+}
+
+VP_TIME_MICROS_T consoleFlushTask(void)
+{
+  ConsoleSource_t source[CONSOLE_STAGES+1];
+  int i = 0;
+  
+  if(!consoleLink)
+    return CONSOLE_FLUSH_INTERVAL;
+  
+  if(!atomic_load_explicit(&consoleStaging, memory_order_relaxed)) {
+    // First run, the rings are set up before anyone can see them
+    
+    for(i = 0; i < CONSOLE_STAGES; i++)
+      vpbuffer_init(&consoleStage[i].buffer, CONSOLE_STAGE_SIZE, consoleStage[i].store);
+
+    atomic_store_explicit(&consoleStaging, true, memory_order_release);
+  }
+  
+  // The shared buffer and the task rings coalesce into the same frames
+
+  source[0].ring = &consoleBuffer;
+  source[0].lines = false;
+  
+  for(i = 0; i < CONSOLE_STAGES; i++) {
+    source[i+1].ring = &consoleStage[i].buffer;
+    source[i+1].lines = true;
+  }
+  
+  // Suppressed log records are summarized from here too
+  
+  logSuppressedReport();
+  
+  mutexObtain();
+  consoleSendUnsafe(source, CONSOLE_STAGES+1,
+		    atomic_exchange_explicit(&consoleFlushRequest, false, memory_order_relaxed));
+  mutexRelease();
+  
+  return CONSOLE_FLUSH_INTERVAL;
+}
+
+uint32_t consoleOverruns(int task)
+{
+  return task < CONSOLE_STAGES ? consoleStage[task].overruns : 0;
+}
+
+static bool consoleBinaryRecord(uint8_t flags, const char *f, va_list args, bool canblock)
+{
+  // Returns true if binary logging took care of the record
+
+  if(!consoleBinary || !consoleLink || failSafeMode)
+    return false;
+
+  struct ConsoleBinaryHeader header =
+    { .format = (uint32_t) (uintptr_t) f, .flags = flags & ~CONSOLE_FMT_LITERAL };
+  uint8_t buffer[PRINT_FMT_BUFFER];
+  int len = stringFmtPack(buffer, sizeof(buffer), f, args);
+
+  if(canblock && consoleStageOf())
+    // Staged tasks must not block
+    canblock = false;
+  
+  if(canblock) {
+    // Text still sitting in the ring goes out first to keep the order
+    
+    consoleFlush();
+    datagramTxStart(consoleLink, DG_CONSOLE_BINARY);
+  } else if(!datagramTxStartNB(consoleLink, DG_CONSOLE_BINARY))
+    // Dropped
+    return true;
+
+  datagramTxOut(consoleLink, (const uint8_t*) &header, sizeof(header));
+  datagramTxOut(consoleLink, buffer, len);
+  datagramTxEnd(consoleLink);
+
+  return true;
 }
 
 void consoleNote(const char *s)
@@ -156,9 +540,16 @@ void consoleError(const char *s, ...)
 {
   va_list argp;
 
+  if(!logConsoleAdmit(LOG_LEVEL_ERROR, s))
+    return;
+  
   va_start(argp, s);
-  consolePrint("!! ");
-  consolevPrintf(s, argp);
+
+  if(!consoleBinaryRecord(CONSOLE_BIN_ERROR, s, argp, true)) {
+    consolePrint("!! ");
+    consolevPrintfText(s, argp, false);
+  }
+  
   va_end(argp);
 }
 
@@ -166,11 +557,12 @@ void consoleErrorLn(const char *s, ...)
 {
   va_list argp;
 
+  if(!logConsoleAdmit(LOG_LEVEL_ERROR, s))
+    return;
+  
   va_start(argp, s);
-  consolePrint("!! ");
-  consolevPrintf(s, argp);
+  consolevLog(CONSOLE_BIN_ERROR | CONSOLE_BIN_NL, s, argp);
   va_end(argp);
-  consoleNL();
 }
 
 void consoleNote_P(const char *s)
@@ -187,8 +579,14 @@ void consoleNoteLn_P(const char *s)
 
 void consolevNotef(const char *s, va_list argp)
 {
+  if(!logConsoleAdmit(LOG_LEVEL_NOTE, s))
+    return;
+  
+  if(consoleBinaryRecord(CONSOLE_BIN_NOTE, s, argp, true))
+    return;
+  
   consolePrint_P(CS_STRING("// "));
-  consolevPrintf(s, argp);
+  consolevPrintfText(s, argp, false);
 }
 
 void consoleNotef(const char *s, ...)
@@ -204,11 +602,12 @@ void consoleNotefLn(const char *s, ...)
 {
   va_list argp;
 
+  if(!logConsoleAdmit(LOG_LEVEL_NOTE, s))
+    return;
+  
   va_start(argp, s);
-  consolevNotef(s, argp);
+  consolevLog(CONSOLE_BIN_NOTE | CONSOLE_BIN_NL, s, argp);
   va_end(argp);
-  
-  consoleNL();
 }
 
 void consolePrintf(const char *s, ...)
@@ -225,46 +624,84 @@ void consolePrintfLn(const char *s, ...)
   va_list argp;
 
   va_start(argp, s);
-  consolevPrintf(s, argp);
+  consolevLog(CONSOLE_BIN_PLAIN | CONSOLE_BIN_NL, s, argp);
   va_end(argp);
-
-  consoleNL();
 }
 
 void consolevPrintf(const char *f, va_list args)
 {
-  char buffer[PRINT_FMT_BUFFER+1];
-  int len = vStringFmt(buffer, PRINT_FMT_BUFFER, f, args);
-  consoleOut(buffer, len);
+  if(!consoleBinaryRecord(CONSOLE_BIN_PLAIN, f, args, true))
+    consolevPrintfText(f, args, false);
 }
 
 extern uint8_t consoleDebugLevel;
 
-void consoleDebugf(uint8_t level, const char *f, ...)
+static void consoleDatagramSink(void *context, const char *data, int size)
+{
+  datagramTxOut((DgLink_t*) context, (const uint8_t*) data, size);
+}
+
+static void consolevDebugf(const char *f, va_list argp, bool literal)
 {
+  // Never blocks, a record that can't go out right away is dropped and
+  // marked in the next one
+  
   static int failCount = 0;
+  int marks = failCount < CONSOLE_DEBUG_MARKS ? failCount : CONSOLE_DEBUG_MARKS;
+  int i = 0;
+  
+  if(consoleBinaryRecord(CONSOLE_BIN_DEBUG | CONSOLE_BIN_NL, f, argp, false))
+    return;
+
+  if(!consoleLink)
+    return;
   
+  if(datagramTxStartNB(consoleLink, DG_CONSOLE)) {
+    datagramTxOut(consoleLink, (const uint8_t*) "## ", 3);
+      
+    for(i = 0; i < marks; i++)
+      datagramTxOut(consoleLink, (const uint8_t*) "~ ", 2);
+
+    failCount = 0;
+    
+    // Formatted straight into the datagram, what's left of it after the
+    // prefix, the marks and the newline
+      
+    consoleFormat(consoleDatagramSink, consoleLink,
+		  DG_TRANSMIT_MAX - 3 - 2*marks - 1, f, argp, literal);
+    datagramTxOutByte(consoleLink, '\n');
+    datagramTxEnd(consoleLink);
+  } else
+    failCount++;
+}
+
+void consoleDebugf(uint8_t level, const char *f, ...)
+{
   if(level <= consoleDebugLevel) {
-    char buffer[PRINT_FMT_BUFFER+2];
-    int len = 0;
     va_list argp;
 
     va_start(argp, f);
-    len = vStringFmt(buffer, PRINT_FMT_BUFFER, f, argp);
+    consolevDebugf(f, argp, false);
     va_end(argp);
+  }
+}
 
-    buffer[len] = '\n';
+void consolevLog(uint8_t flags, const char *f, va_list args)
+{
+  uint8_t kind = flags & CONSOLE_BIN_KIND;
+  
+  if(kind == CONSOLE_BIN_DEBUG)
+    consolevDebugf(f, args, flags & CONSOLE_FMT_LITERAL);
+  else if(!consoleBinaryRecord(flags, f, args, true)) {
+    if(kind == CONSOLE_BIN_NOTE)
+      consolePrint_P(CS_STRING("// "));
+    else if(kind == CONSOLE_BIN_ERROR)
+      consolePrint("!! ");
     
-    if(datagramTxStartNB(consoleLink, DG_CONSOLE)) {
-      datagramTxOut(consoleLink, (const uint8_t*) "## ", 3);
-      
-      while(failCount-- > 0)
-	datagramTxOut(consoleLink, (const uint8_t*) "~ ", 2);
-      
-      datagramTxOut(consoleLink, (const uint8_t*) buffer, len+1);
-      datagramTxEnd(consoleLink);
-    } else
-      failCount++;
+    consolevPrintfText(f, args, flags & CONSOLE_FMT_LITERAL);
+
+    if(flags & CONSOLE_BIN_NL)
+      consoleNL();
   }
 }
 
@@ -447,15 +884,67 @@ void consolePrintPoly(int degree, float *coeff, int p)
   }
 }
 
+static bool consoleBinaryBlob(const char *name, const uint8_t *data, size_t size)
+{
+  // Returns true if the blob went out as DG_CONSOLE_BLOB datagrams
+  
+  if(!consoleBinary || !consoleLink || failSafeMode)
+    return false;
+
+  size_t nameLen = strlen(name), offset = 0;
+  bool canblock = !consoleStageOf();
+
+  if(nameLen > CONSOLE_BLOB_NAME_MAX)
+    nameLen = CONSOLE_BLOB_NAME_MAX;
+  
+  struct ConsoleBlobHeader header =
+    { .size = size, .nameLen = nameLen };
+  size_t segment = DG_TRANSMIT_MAX - sizeof(header) - nameLen;
+
+  if(canblock)
+    // Text still sitting in the ring goes out first to keep the order
+    consoleFlush();
+  
+  do {
+    size_t len = size - offset < segment ? size - offset : segment;
+
+    if(canblock)
+      datagramTxStart(consoleLink, DG_CONSOLE_BLOB);
+    else if(!datagramTxStartNB(consoleLink, DG_CONSOLE_BLOB))
+      // Dropped, the host sees the rest missing
+      break;
+
+    header.offset = offset;
+    
+    datagramTxOut(consoleLink, (const uint8_t*) &header, sizeof(header));
+    datagramTxOut(consoleLink, (const uint8_t*) name, nameLen);
+    datagramTxOut(consoleLink, &data[offset], len);
+    datagramTxEnd(consoleLink);
+
+    offset += len;
+  } while(offset < size);
+
+  return true;
+}
+
 void consolePrintBlob(const char *name, const void *data, size_t size)
 {
-  int i = 0;
+  char buffer[CONSOLE_BUFFER];
+  size_t i = 0;
 
+  if(consoleBinaryBlob(name, (const uint8_t*) data, size))
+    return;
+  
   consolePrintf("  Blob %s = ", name);
   
-  for(i = 0; i < size; i++)
-    consolePrintf("%.2X", ((const uint8_t*) data)[i]);
-
+  while(i < size) {
+    size_t n = size - i < sizeof(buffer)/2 ? size - i : sizeof(buffer)/2;
+    
+    consoleOut(buffer, bufferPrintHex(buffer, sizeof(buffer),
+				      &((const uint8_t*) data)[i], n));
+    i += n;
+  }
+  
   consoleNL();
 }
  
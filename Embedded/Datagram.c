@@ -4,15 +4,19 @@
 #include "Datagram.h"
 #include "StaP.h"
 #include "CRC16.h"
+#include "Console.h"
+#include "Log.h"
+#include "HostLink.h"
 
 
 #define FLAG        ((uint8_t) 0x00)
 #define START(n)    ((~FLAG) - (n))
 #define START_MASK  ((FLAG - DG_MAX_NODES) & 0xFF)
 
-// #define DG_DEBUG    1
+// Wire level tracing (LOG_LEVEL_TRACE) of every link except the console
+// link, compiled in with DG_DEBUG or LOG_MAX_Datagram
 
-extern DgLink_t *consoleLink;
+#define DG_TRACE(link)  (LOG_ENABLED(Datagram, LOG_LEVEL_TRACE) && (link) != consoleLink)
 
 void datagramLinkInit(DgLink_t *link, uint8_t node,
 		      uint8_t *rxStore, size_t rxSize,
@@ -49,6 +53,28 @@ void datagramLinkInit(DgLink_t *link, uint8_t node,
   }
 }
 
+void datagramLinkSetTxStage(DgLink_t *link, uint8_t *stage, size_t size)
+{
+  link->txStage = stage;
+  link->txStageSize = stage ? size : 0;
+  link->txStageLen = 0;
+
+  if(link->txStageSize < DG_COBS_STAGE_MIN)
+    link->cobs = false;
+}
+
+bool datagramLinkSetCobs(DgLink_t *link, bool enable)
+{
+  if(enable && link->txStageSize < DG_COBS_STAGE_MIN)
+    return false;
+
+  link->cobs = enable;
+  link->rxBusy = link->overflow = false;
+  link->cobsRemain = 0;
+  
+  return true;
+}
+
 bool  datagramLinkAlive(DgLink_t *link)
 {
   if(VP_ELAPSED_MILLIS(link->datagramLastRxMillis) > 1500)
@@ -57,10 +83,126 @@ bool  datagramLinkAlive(DgLink_t *link)
   return link->alive;
 }
 
+static void txCommit(DgLink_t *link)
+{
+  if(link->txStageLen > 0) {
+    (link->txOut)(link->context, link->txStage, link->txStageLen);
+    link->txStageLen = 0;
+  }
+}
+
+static void txEmit(DgLink_t *link, const uint8_t *data, size_t l)
+{
+  if(!link->txStage) {
+    (link->txOut)(link->context, data, l);
+    return;
+  }
+
+  if(link->txStageLen + l > link->txStageSize) {
+    // Doesn't fit, the frame goes out in pieces after all
+    
+    txCommit(link);
+
+    if(l > link->txStageSize) {
+      (link->txOut)(link->context, data, l);
+      return;
+    }
+  }
+
+  memcpy(&link->txStage[link->txStageLen], data, l);
+  link->txStageLen += l;
+}
+
+//
+// COBS framing. Each block of up to 254 non-zero bytes is preceded by a
+// code byte which is filled in once the block ends, the part of the stage
+// before the open code byte is final and may go out when the stage fills.
+//
+
+static void cobsBlockOpen(DgLink_t *link)
+{
+  if(link->txStageLen + 1 > link->txStageSize)
+    txCommit(link);
+  
+  link->cobsCodePos = link->txStageLen++;
+  link->cobsCode = 1;
+  link->cobsOpen = true;
+  link->totalTxBytesRaw++;
+}
+
+static void cobsBlockClose(DgLink_t *link)
+{
+  link->txStage[link->cobsCodePos] = link->cobsCode;
+  link->cobsOpen = false;
+}
+
+static void cobsEncode(DgLink_t *link, const uint8_t *data, size_t l)
+{
+  link->totalTxBytes += l;
+  
+  while(l > 0) {
+    const uint8_t *zero = NULL;
+    size_t run = l;
+    
+    if(link->txStageLen >= link->txStageSize) {
+      // Out with what's final, the open block moves to the front
+      
+      size_t open = link->txStageLen - link->cobsCodePos;
+      
+      (link->txOut)(link->context, link->txStage, link->cobsCodePos);
+      memmove(link->txStage, &link->txStage[link->cobsCodePos], open);
+      link->txStageLen = open;
+      link->cobsCodePos = 0;
+    }
+    
+    if(*data == FLAG) {
+      cobsBlockClose(link);
+      cobsBlockOpen(link);
+      data++;
+      l--;
+      continue;
+    }
+
+    // A run of non-zero bytes up to the end of the block or the stage
+    
+    if(run > 0xFFU - link->cobsCode)
+      run = 0xFFU - link->cobsCode;
+
+    if(run > link->txStageSize - link->txStageLen)
+      run = link->txStageSize - link->txStageLen;
+
+    if((zero = memchr(data, FLAG, run)) != NULL)
+      run = zero - data;
+
+    memcpy(&link->txStage[link->txStageLen], data, run);
+    link->txStageLen += run;
+    link->totalTxBytesRaw += run;
+    link->cobsCode += run;
+    data += run;
+    l -= run;
+    
+    if(link->cobsCode == 0xFF) {
+      cobsBlockClose(link);
+      cobsBlockOpen(link);
+    }
+  }
+}
+
 static void outputBreak(DgLink_t *link)
 {
   const uint8_t buffer[] = { FLAG, FLAG };
-  (link->txOut)(link->context, buffer, sizeof(buffer));
+
+  if(link->cobs) {
+    // A single delimiter, also the end of the frame
+    
+    if(link->cobsOpen)
+      cobsBlockClose(link);
+    
+    txEmit(link, buffer, 1);
+    return;
+  }
+  
+  txEmit(link, buffer, sizeof(buffer));
 }
 
 static void flagRunEnd(DgLink_t *link)
@@ -69,7 +211,7 @@ static void flagRunEnd(DgLink_t *link)
     const uint16_t piece = link->flagRunLength > 0xFF
       ? 0xFF : link->flagRunLength;
     const uint8_t buffer[] = { FLAG, FLAG + (uint8_t) piece };
-    (link->txOut)(link->context, buffer, sizeof(buffer));
+    txEmit(link, buffer, sizeof(buffer));
     link->totalTxBytesRaw += sizeof(buffer);
     link->totalTxBytes += piece;
     link->flagRunLength -= piece;
@@ -81,180 +223,937 @@ void datagramTxOutByte(DgLink_t *link, const uint8_t c)
   datagramTxOut(link, &c, 1);
 }
 
+static void fecTxCollect(DgLink_t *link, const uint8_t *data, size_t l)
+{
+  size_t i = 0;
+  
+  if(link->fecOversize)
+    return;
+  
+  if(link->fecTxLen + l > link->fecStoreSize) {
+    link->fecOversize = true;
+    return;
+  }
+
+  for(i = 0; i < l; i++)
+    link->fecTxStore[link->fecTxLen + i] ^= data[i];
+
+  link->fecTxLen += l;
+}
+
+static void txEncode(DgLink_t *link, const uint8_t *data, size_t l)
+{
+  link->crcStateTx = crc16(link->crcStateTx, data, l);
+
+  if(link->fecCollect)
+    fecTxCollect(link, data, l);
+
+  if(link->cobs) {
+    cobsEncode(link, data, l);
+    return;
+  }
+
+  if(DG_TRACE(link)) {
+    size_t i = 0;
+    
+    for(i = 0; i < l; i++)
+      consolePrintUI8Hex(data[i]);
+  }
+    
+  while(l > 0) {
+    if(*data == FLAG) {
+      // Accumulate the FLAG run, it's escaped once it ends
+      
+      do {
+	link->flagRunLength++;
+	data++;
+	l--;
+      } while(l > 0 && *data == FLAG);
+    } else {
+      const uint8_t *runEnd = memchr(data, FLAG, l);
+      size_t runLength = runEnd ? (size_t) (runEnd - data) : l;
+      
+      if(link->flagRunLength > 0)
+	flagRunEnd(link);
+
+      txEmit(link, data, runLength);
+      link->totalTxBytesRaw += runLength;
+      link->totalTxBytes += runLength;
+      data += runLength;
+      l -= runLength;
+    }
+  }
+}
+
+static void txFrameBegin(DgLink_t *link, uint8_t node)
+{
+  if(link->fecGroup > 0 && !link->fecParity) {
+    if(link->fecTxCount > 0 && node != link->fecTxNode)
+      // Groups don't span nodes, this one can't be completed
+      link->fecTxCount = 0;
+    
+    if(link->fecTxCount == 0) {
+      // All of it, an oversize frame leaves behind what it XORed in
+      // before it overflowed
+      
+      memset(link->fecTxStore, '\0', link->fecStoreSize);
+      link->fecTxNode = node;
+      link->fecTxFirst = link->txSeq[node];
+      link->fecTxLenXor = link->fecTxMax = 0;
+      link->fecOversize = false;
+    }
+  }
+  
+  uint8_t buffer[] = { START(node), link->txSeq[node]++ };
+  
+  if(link->txBegin)
+    (link->txBegin)(link->context);
+  
+  if(failSafeMode || link->txBusy || link->datagramLastTxMillis == 0
+     || VP_ELAPSED_MILLIS(link->datagramLastTxMillis) > 500U)
+    outputBreak(link);
+
+  if(link->cobs)
+    cobsBlockOpen(link);
+  
+  link->crcStateTx = 0xFFFF;
+  link->flagRunLength = 0;
+    
+  if(DG_TRACE(link))
+    consolePrint("DGTX ");
+  
+  txEncode(link, buffer, sizeof(buffer));
+  link->txBusy = true;
+  link->totalTxBytes += sizeof(buffer);
+
+  if(link->fecGroup > 0 && !link->fecParity) {
+    link->fecCollect = true;
+    link->fecTxLen = 0;
+  }
+}
+
+static void txFrameEnd(DgLink_t *link);
+
+static void fecTxParity(DgLink_t *link)
+{
+  uint8_t buffer[] = { DG_FEC_PARITY, link->fecTxFirst, link->fecTxCount,
+		       link->fecTxLenXor & 0xFF, link->fecTxLenXor>>8 };
+
+  link->fecParity = true;
+  
+  txFrameBegin(link, link->fecTxNode);
+  txEncode(link, buffer, sizeof(buffer));
+  txEncode(link, link->fecTxStore, link->fecTxMax);
+  txFrameEnd(link);
+  
+  link->fecParity = false;
+  link->fecTxCount = 0;
+}
+
+static void txFrameEnd(DgLink_t *link)
+{
+  uint16_t crc = link->crcStateTx;
+
+  link->fecCollect = false;
+
+  txEncode(link, (const uint8_t*) &crc, sizeof(crc));
+  
+  flagRunEnd(link);
+  outputBreak(link);
+  txCommit(link);
+  
+  if(DG_TRACE(link))
+    consolePrint(" END ");
+  
+  if(link->txEnd)
+    (link->txEnd)(link->context);
+
+  if(!failSafeMode)
+    link->datagramLastTxMillis = vpTimeMillis();
+  
+  link->txBusy = false;
+  link->totalTxDatagrams++;
+
+  if(link->fecGroup > 0 && !link->fecParity) {
+    if(link->fecOversize)
+      // Not protected, neither is the rest of the group
+      link->fecTxCount = 0;
+    else {
+      link->fecTxLenXor ^= link->fecTxLen;
+      
+      if(link->fecTxLen > link->fecTxMax)
+	link->fecTxMax = link->fecTxLen;
+
+      if(++link->fecTxCount >= link->fecGroup)
+	fecTxParity(link);
+    }
+  }
+}
+
+void datagramLinkSetFec(DgLink_t *link, uint8_t group, uint8_t *txStore, uint8_t *rxStore, size_t size)
+{
+  link->fecGroup = txStore && rxStore
+    ? (group < DG_FEC_GROUP_MAX ? group : DG_FEC_GROUP_MAX) : 0;
+  link->fecTxStore = txStore;
+  link->fecRxStore = rxStore;
+  link->fecStoreSize = size;
+  link->fecTxCount = link->fecTxMax = link->fecRxMax = 0;
+  link->fecRxActive = false;
+
+  if(link->fecGroup > 0) {
+    memset(txStore, '\0', size);
+    memset(rxStore, '\0', size);
+  }
+}
+
+void datagramFecStatus(DgLink_t *link, uint16_t *recovered, uint16_t *failed)
+{
+  uint16_t r = link->fecRecovered - link->legacyRecovered,
+    f = link->fecFailed - link->legacyFailed;
+
+  link->legacyRecovered += r;
+  link->legacyFailed += f;
+  
+  if(recovered)
+    *recovered = r;
+  if(failed)
+    *failed = f;
+}
+
+//
+// Flow control
+//
+
+void datagramLinkSetFlow(DgLink_t *link, uint8_t window)
+{
+  link->flowWindow = window < DG_FLOW_WINDOW_MAX ? window : DG_FLOW_WINDOW_MAX;
+}
+
+// The millisecond clock wraps in a little over a minute, past this many
+// seconds a grant is old whatever the milliseconds say
+
+#define FLOW_EXPIRE_SECS   60
+
+#define FLOW_NODES  (DG_FLOW_NODES < ALN_BROADCAST ? DG_FLOW_NODES : ALN_BROADCAST)
+
+bool datagramFlowCredit(DgLink_t *link, uint8_t node)
+{
+  uint8_t ahead = 0;
+  
+  if(node >= FLOW_NODES || !(link->flowLimited & (1ULL<<node)))
+    return true;
+
+  if(VP_ELAPSED_SECS(link->flowGrantedSecs[node]) > FLOW_EXPIRE_SECS
+     || VP_ELAPSED_MILLIS(link->flowGranted[node]) >= DG_FLOW_EXPIRE) {
+    // The peer has gone quiet or stopped granting
+    
+    link->flowLimited &= ~(1ULL<<node);
+    return true;
+  }
+  
+  ahead = link->flowTxLimit[node] - link->txSeq[node];
+  
+  return ahead > 0 && ahead < 0x80;
+}
+
+static void flowGrant(DgLink_t *link, uint8_t node, bool fresh)
+{
+  uint8_t buffer[] = { link->rxSeqLast[node] + 1 + link->flowWindow,
+		       fresh ? link->flowWindow : 0 };
+
+  // Mostly called by the receiving task, it mustn't wait for the link
+  
+  if(!datagramTxStartNodeNB(link, node, DG_FLOW_CREDIT)) {
+    STAP_FORBID;
+    link->flowGrantPending |= 1ULL<<node;
+    STAP_PERMIT;
+    return;
+  }
+  
+  datagramTxOut(link, buffer, sizeof(buffer));
+  datagramTxEnd(link);
+  
+  STAP_FORBID;
+  link->flowGrantPending &= ~(1ULL<<node);
+  STAP_PERMIT;
+  
+  link->flowRxLimit[node] = buffer[0];
+  link->flowGrantsSent++;
+}
+
+static void flowRxUpdate(DgLink_t *link, uint8_t node, uint8_t seq, uint8_t header)
+{
+  uint8_t left = 0;
+  
+  if(!link->flowWindow || node >= FLOW_NODES)
+    return;
+
+  // Parity and grants aren't data, answering a grant with one would have
+  // two limited ends granting back and forth
+  
+  if(header == DG_FEC_PARITY || header == DG_FLOW_CREDIT)
+    return;
+
+  link->flowRxSeen |= 1ULL<<node;
+  link->flowRxHeard |= 1ULL<<node;
+
+  // Half of the window used or the sender beyond it (it didn't have a
+  // grant yet or lost ours)
+  
+  left = link->flowRxLimit[node] - (uint8_t) (seq + 1);
+  
+  if(left <= link->flowWindow/2 || left > link->flowWindow)
+    flowGrant(link, node, false);
+}
+
+static bool flowRxCredit(DgLink_t *link, const uint8_t *data, size_t size)
+{
+  uint8_t node = link->rxNode;
+  
+  if(size < 3 || data[0] != DG_FLOW_CREDIT)
+    return false;
+
+  if(node < FLOW_NODES) {
+    link->flowTxLimit[node] = data[2] ? link->txSeq[node] + data[2] : data[1];
+    link->flowGranted[node] = vpApproxMillis();
+    link->flowGrantedSecs[node] = vpTimeSecs();
+    link->flowLimited |= 1ULL<<node;
+    link->flowGrantsReceived++;
+  }
+
+  return true;
+}
+
+static bool flowOnRxTask(DgLink_t *link)
+{
+  if(!link->rxHandling)
+    return false;
+  
+#ifdef STAP_MutexCreate
+  return StaP_CurrentTask() == link->rxTask;
+#else
+  return true;
+#endif
+}
+
+// False if it gave up, the frame goes out without credit then
+
+static bool flowWait(DgLink_t *link, uint8_t node)
+{
+  VP_TIME_MILLIS_T waited = 0;
+
+  link->flowStalls++;
+
+  if(flowOnRxTask(link))
+    // Nothing would be received while we wait, the grant included
+    return false;
+  
+  while(!datagramFlowCredit(link, node)) {
+    if(waited >= DG_FLOW_STALL_MAX) {
+      link->flowTimeouts++;
+      return false;
+    }
+    
+    STAP_DelayMillis(1);
+    waited++;
+  }
+
+  return true;
+}
+
+VP_TIME_MICROS_T datagramFlowTick(DgLink_t *link)
+{
+  VP_TIME_MILLIS_T elapsed = VP_ELAPSED_MILLIS(link->flowRefreshed);
+  uint64_t pending = 0;
+  uint8_t node = 0;
+  
+  if(!link->initialized || !link->flowWindow)
+    return (VP_TIME_MICROS_T) DG_FLOW_REFRESH*1000;
+  
+  if(elapsed < DG_FLOW_REFRESH) {
+    // Grants that didn't get out at the time
+    
+    STAP_FORBID;
+    pending = link->flowGrantPending;
+    STAP_PERMIT;
+
+    if(!pending)
+      return (VP_TIME_MICROS_T) (DG_FLOW_REFRESH - elapsed)*1000;
+
+    for(node = 0; node < FLOW_NODES; node++)
+      if(pending & (1ULL<<node))
+	flowGrant(link, node, false);
+
+    return DG_FLOW_RETRY;
+  }
+
+  link->flowRefreshed = vpTimeMillis();
+  
+  // Nothing heard from a node since the last round, what it sent is
+  // either processed or lost and its window starts afresh
+  
+  for(node = 0; node < FLOW_NODES; node++)
+    if(link->flowRxSeen & (1ULL<<node))
+      flowGrant(link, node, !(link->flowRxHeard & (1ULL<<node)));
+
+  link->flowRxHeard = 0;
+
+  return (VP_TIME_MICROS_T) DG_FLOW_REFRESH*1000;
+}
+
+//
+// Transmit queue. The pool and the priority lists are only touched in
+// short critical sections, the frame being built belongs to the holder of
+// the link mutex and the frame being sent to the transmitter.
+//
+
+static uint8_t txPriorityDefault(uint8_t header)
+{
+  switch(header) {
+  case DG_HEARTBEAT:
+  case DG_RELIABLE_ACK:
+  case DG_FLOW_CREDIT:
+    return DG_PRIO_CONTROL;
+    
+  case DG_CONSOLE:
+  case DG_CONSOLE_BINARY:
+  case DG_CONSOLE_BLOB:
+    return DG_PRIO_CONSOLE;
+    
+  default:
+    return DG_PRIO_TELEMETRY;
+  }
+}
+
+void datagramLinkSetTxQueue(DgLink_t *link, DgTxQueue_t *queue,
+			    DgTxFrame_t *frames, int count,
+			    uint8_t (*priority)(uint8_t header))
+{
+  int i = 0;
+  
+  memset((void*) queue, '\0', sizeof(DgTxQueue_t));
+
+  for(i = 0; i < count; i++) {
+    frames[i].next = queue->pool;
+    queue->pool = &frames[i];
+  }
+
+  queue->priority = priority ? priority : txPriorityDefault;
+  link->txQueue = queue;
+}
+
+static DgTxFrame_t *txFrameAlloc(DgTxQueue_t *queue, uint8_t node, uint8_t header, bool canblock)
+{
+  DgTxFrame_t *frame = NULL;
+  
+  STAP_FORBID;
+
+  // The frame of a blocking start is lost, a non-blocking one just fails
+  
+  if((frame = queue->pool) != NULL)
+    queue->pool = frame->next;
+  else if(canblock)
+    queue->dropped++;
+  else
+    queue->refused++;
+  
+  STAP_PERMIT;
+
+  if(frame) {
+    uint8_t priority = (*queue->priority)(header);
+    
+    frame->next = NULL;
+    frame->node = node;
+    frame->priority = priority < DG_PRIORITIES ? priority : DG_PRIORITIES - 1;
+    frame->data[0] = header;
+    frame->size = 1;
+  }
+  
+  return frame;
+}
+
+static void txFrameFree(DgTxQueue_t *queue, DgTxFrame_t *frame)
+{
+  STAP_FORBID;
+  frame->next = queue->pool;
+  queue->pool = frame;
+  STAP_PERMIT;
+}
+
+static void txFrameQueue(DgTxQueue_t *queue, DgTxFrame_t *frame)
+{
+  frame->queued = vpTimeMillis();
+  
+  STAP_FORBID;
+  
+  if(queue->tail[frame->priority])
+    queue->tail[frame->priority]->next = frame;
+  else
+    queue->head[frame->priority] = frame;
+  
+  queue->tail[frame->priority] = frame;
+  
+  if(++queue->depth > queue->depthMax)
+    queue->depthMax = queue->depth;
+  
+  STAP_PERMIT;
+}
+
+static void histogramAdd(DgHistogram_t *histogram, VP_TIME_MILLIS_T value)
+{
+  int i = 0;
+
+  while(value > 0 && i < DG_HISTOGRAM_BINS-1) {
+    value >>= 1;
+    i++;
+  }
+
+  histogram->bin[i]++;
+}
+
+static DgTxFrame_t *txFrameDequeue(DgLink_t *link)
+{
+  DgTxQueue_t *queue = link->txQueue;
+  DgTxFrame_t *frame = NULL, *prev = NULL;
+  int i = 0;
+  
+  STAP_FORBID;
+
+  // The first frame in priority order its node has credit for, the order
+  // of the frames to any one node is kept
+  
+  for(i = 0; i < DG_PRIORITIES && !frame; i++) {
+    for(prev = NULL, frame = queue->head[i]; frame; prev = frame, frame = frame->next)
+      if(i == DG_PRIO_CONTROL || datagramFlowCredit(link, frame->node))
+	break;
+    
+    if(frame) {
+      if(prev)
+	prev->next = frame->next;
+      else
+	queue->head[i] = frame->next;
+
+      if(queue->tail[i] == frame)
+	queue->tail[i] = prev;
+      
+      queue->depth--;
+    }
+  }
+  
+  STAP_PERMIT;
+
+  if(frame) {
+    VP_TIME_MILLIS_T wait = VP_ELAPSED_MILLIS(frame->queued);
+
+    STAP_FORBID;
+    queue->waitTotal[frame->priority] += wait;
+    queue->waitCount[frame->priority]++;
+    if(wait > queue->waitMax[frame->priority])
+      queue->waitMax[frame->priority] = wait;
+    if(frame->node < link->histogramNodes)
+      histogramAdd(&link->histograms[frame->node].txWait, wait);
+    STAP_PERMIT;
+  }
+
+  return frame;
+}
+
+static void txQueueOut(DgLink_t *link, const uint8_t *data, size_t l)
+{
+  DgTxFrame_t *frame = link->txFrame;
+
+  if(!frame)
+    // Dropped at the start
+    return;
+  
+  if(frame->size + l > DG_TX_FRAME_SIZE) {
+    link->txErrors++;
+    
+    if(link->rxError)
+      (link->rxError)(link->context, "TX_FRAME", frame->size + l);
+
+    txFrameFree(link->txQueue, frame);
+    link->txFrame = NULL;
+
+    STAP_FORBID;
+    link->txQueue->dropped++;
+    STAP_PERMIT;
+    return;
+  }
+
+  memcpy(&frame->data[frame->size], data, l);
+  frame->size += l;
+}
+
+static void txRelease(DgLink_t *link)
+{
+#ifdef STAP_MutexCreate
+  if(!failSafeMode)
+    STAP_MutexRelease(link->mutex);
+#endif
+}
+
+VP_TIME_MICROS_T datagramTxDrain(DgLink_t *link)
+{
+  DgTxQueue_t *queue = link->txQueue;
+  
+  if(!link->initialized || !queue)
+    return DG_TX_DRAIN_IDLE;
+
+  for(;;) {
+    VP_TIME_MILLIS_T interDelay = VP_ELAPSED_MILLIS(link->datagramLastTxMillis);
+    DgTxFrame_t *frame = NULL;
+  
+    if(interDelay < link->minInterDelay)
+      return (VP_TIME_MICROS_T) (link->minInterDelay - interDelay) * 1000;
+
+    if(!(frame = txFrameDequeue(link))) {
+      if(queue->depth == 0)
+	return DG_TX_DRAIN_IDLE;
+
+      // Out of credit
+      
+      link->flowStalls++;
+      return DG_FLOW_RETRY;
+    }
+
+    // Encoded with the link's transmit state (sequence numbers, CRC, the
+    // stage), under the mutex like a frame built without the queue
+
+#ifdef STAP_MutexCreate
+    if(!failSafeMode)
+      STAP_MutexObtain(link->mutex);
+#endif
+    
+    txFrameBegin(link, frame->node);
+    txEncode(link, frame->data, frame->size);
+    txFrameEnd(link);
+
+    txRelease(link);
+    txFrameFree(queue, frame);
+
+    STAP_FORBID;
+    queue->sent++;
+    STAP_PERMIT;
+  }
+}
+
+void datagramTxQueueStatus(DgLink_t *link, DgTxQueueStats_t *stats)
+{
+  DgTxQueue_t *queue = link->txQueue;
+  int i = 0;
+
+  memset((void*) stats, '\0', sizeof(DgTxQueueStats_t));
+  
+  if(!queue)
+    return;
+
+  STAP_FORBID;
+  
+  stats->depth = queue->depth;
+  stats->depthMax = queue->depthMax;
+  stats->sent = queue->sent;
+  stats->dropped = queue->dropped;
+  stats->refused = queue->refused;
+  queue->depthMax = queue->depth;
+  
+  for(i = 0; i < DG_PRIORITIES; i++) {
+    if(queue->waitCount[i] > 0)
+      stats->waitAvg[i] = queue->waitTotal[i] / queue->waitCount[i];
+    stats->waitMax[i] = queue->waitMax[i];
+    queue->waitTotal[i] = queue->waitCount[i] = queue->waitMax[i] = 0;
+  }
+  
+  STAP_PERMIT;
+}
+
+//
+// Frame construction
+//
+
 void datagramTxOut(DgLink_t *link, const uint8_t *data, size_t l)
 {
-  uint16_t runLength = 0, i = 0;
-  const uint8_t *runStart = data;
-  
   if(!link->initialized)
     return;
   
   if(l > DG_TRANSMIT_MAX) {
+    link->txErrors++;
+    
     if(link->rxError)
       (link->rxError)(link->context, "TX_MAX", l);
     return;
   }
+
+  if(link->txQueued)
+    txQueueOut(link, data, l);
+  else
+    txEncode(link, data, l);
+}
+
+static bool datagramTxStartGeneric(DgLink_t *link, uint8_t node, uint8_t header, bool canblock)
+{
+  bool giveUp = false;
   
-  for(i = 0; i < l; i++) {
-    link->crcStateTx = crc16_update(link->crcStateTx, data[i]);
+  if(!link->initialized)
+    return true;
 
-#if DG_DEBUG > 2
-    if(link != consoleLink)
-      consolePrintUI8Hex(data[i]);
+  for(;;) {
+#ifdef STAP_MutexCreate
+    if(!failSafeMode) {
+      if(canblock) {
+	STAP_MutexObtain(link->mutex);
+      } else if(!STAP_MutexAttempt(link->mutex))
+	return false;
+    }
 #endif
-    
-    if(data[i] == FLAG) {
-      if(runLength > 0) {
-	(link->txOut)(link->context, runStart, runLength);
-	link->totalTxBytesRaw += runLength;
-	link->totalTxBytes += runLength;
-	runLength = 0;
-      }
 
-      link->flagRunLength++;
-    } else {
-        if(link->flagRunLength > 0) {
-//            printf("plop ");
-            flagRunEnd(link);
-        }
-
-      if(!runLength)
-	runStart = &data[i];
+    // The credit is checked and taken (txFrameBegin() advances the
+    // sequence) under the lock, two tasks can't both spend the last of it.
+    // A queued frame waits for credit in the drain instead.
+    
+    if(link->txQueue || failSafeMode || giveUp || datagramFlowCredit(link, node)
+       || txPriorityDefault(header) == DG_PRIO_CONTROL)
+      break;
 
-      runLength++;
+    // Waiting with the link free, whoever grants it may need to transmit
+    
+    txRelease(link);
+    
+    if(!canblock) {
+      link->flowStalls++;
+      return false;
     }
-  }
 
-  if(runLength > 0) {
-    (link->txOut)(link->context, runStart, runLength);
-    link->totalTxBytesRaw += runLength;
-    link->totalTxBytes += runLength;
+    giveUp = !flowWait(link, node);
   }
-}
 
-static bool datagramTxStartGeneric(DgLink_t *link, uint8_t node, bool canblock)
-{
-  if(!link->initialized)
-    return true;
-  
-#ifdef STAP_MutexCreate
-  if(!failSafeMode) {
-    if(canblock) {
-      STAP_MutexObtain(link->mutex);
-    } else if(!STAP_MutexAttempt(link->mutex))
+  if((link->txQueued = link->txQueue && !failSafeMode)) {
+    // Built into a pooled frame, a blocking start drops the frame if
+    // there's none left
+    
+    link->txFrame = txFrameAlloc(link->txQueue, node, header, canblock);
+
+    if(!link->txFrame && !canblock) {
+      link->txQueued = false;
+      txRelease(link);
       return false;
+    }
+    
+    return true;
   }
-#endif
-
+  
   VP_TIME_MILLIS_T interDelay = VP_ELAPSED_MILLIS(link->datagramLastTxMillis);
 
-  if(!failSafeMode && interDelay < link->minInterDelay)
-    STAP_DelayMillis(link->minInterDelay - interDelay);
-  
-  uint8_t buffer[] = { START(node), link->txSeq[node]++ };
-  
-  if(link->txBegin)
-    (link->txBegin)(link->context);
+  // A non-blocking start doesn't sleep out the gap either, the caller may
+  // be a staged console task or the receiving task sending a grant
   
-  if(failSafeMode || link->txBusy || link->datagramLastTxMillis == 0
-     || VP_ELAPSED_MILLIS(link->datagramLastTxMillis) > 500U)
-    outputBreak(link);
+  if(!failSafeMode && canblock && interDelay < link->minInterDelay)
+    STAP_DelayMillis(link->minInterDelay - interDelay);
 
-  link->crcStateTx = 0xFFFF;
-    link->flagRunLength = 0;
-    
-#if DG_DEBUG > 2
-  if(link != consoleLink)
-    consolePrint("DGTX ");
-#endif
-  
-  datagramTxOut(link, buffer, sizeof(buffer));
-  link->txBusy = true;
-  link->totalTxBytes += sizeof(buffer);
+  txFrameBegin(link, node);
+  txEncode(link, &header, 1);
 
   return true;
 }
 
 void datagramTxStart(DgLink_t *link, uint8_t header)
 {
-  if(!datagramTxStartGeneric(link, link->node, true))
+  if(!datagramTxStartGeneric(link, link->node, header, true))
     STAP_Panicf(STAP_ERR_MUTEX, "Blocking start failed");
-  
-  datagramTxOutByte(link, header);
 }
 
 void datagramTxStartNode(DgLink_t *link, uint8_t node, uint8_t header)
 {
-  if(!datagramTxStartGeneric(link, node, true))
+  if(!datagramTxStartGeneric(link, node, header, true))
     STAP_Panicf(STAP_ERR_MUTEX, "Blocking start failed");
-  
-  datagramTxOutByte(link, header);
 }
 
 bool datagramTxStartNB(DgLink_t *link, uint8_t header)
 {
-  bool success = datagramTxStartGeneric(link, link->node, false);
-  
-  if(success)
-    datagramTxOutByte(link, header);
-
-  return success;
+  return datagramTxStartGeneric(link, link->node, header, false);
 }
 
 bool datagramTxStartNodeNB(DgLink_t *link, uint8_t node, uint8_t header)
 {
-  bool success = datagramTxStartGeneric(link, node, false);
-
-  if(success)
-    datagramTxOutByte(link, header);
-
-  return success;
+  return datagramTxStartGeneric(link, node, header, false);
 }
 
 void datagramTxEnd(DgLink_t *link)
 {
-  uint16_t crc = link->crcStateTx;
-
   if(!link->initialized)
     return;
+
+  if(link->txQueued) {
+    if(link->txFrame)
+      txFrameQueue(link->txQueue, link->txFrame);
+
+    link->txFrame = NULL;
+    link->txQueued = false;
+  } else
+    txFrameEnd(link);
   
-  datagramTxOut(link, (const uint8_t*) &crc, sizeof(crc));
+  txRelease(link);
+}
+
+static void storeRun(DgLink_t *link, const uint8_t *data, size_t size)
+{
+  // Store a run of literal bytes (or zeroes if data is NULL). The CRC trails
+  // the stored data by two bytes so the checksum at the end of the frame
+  // never enters it and the check at the break is O(1).
   
-  flagRunEnd(link);
-  outputBreak(link);
+  size_t prev = link->datagramSize;
   
-#if DG_DEBUG > 2
-  if(link != consoleLink)
-    consolePrint(" END ");
-#endif
+  if(size > link->rxStoreSize - prev) {
+    size = link->rxStoreSize - prev;
+    link->overflow = true;
+  }
+
+  if(data)
+    memcpy(&link->rxStore[prev], data, size);
+  else
+    memset(&link->rxStore[prev], FLAG, size);
   
-  if(link->txEnd)
-    (link->txEnd)(link->context);
+  link->datagramSize += size;
 
-  if(!failSafeMode)
-    link->datagramLastTxMillis = vpTimeMillis();
+  if(link->datagramSize > sizeof(uint16_t)) {
+    size_t from = prev > sizeof(uint16_t) ? prev - sizeof(uint16_t) : 0;
+    
+    link->crcStateRx = crc16(link->crcStateRx, &link->rxStore[from],
+			     link->datagramSize - sizeof(uint16_t) - from);
+  }
+}
   
-  link->txBusy = false;
-  link->totalTxDatagrams++;
+static void rxDeliver(DgLink_t *link, void (*handler)(void*, uint8_t node, const uint8_t *data, size_t size), const uint8_t *data, size_t size)
+{
+  // Whoever sends from the handler is the receiving task
   
 #ifdef STAP_MutexCreate
-  if(!failSafeMode)
-    STAP_MutexRelease(link->mutex);
+  if(!link->rxTask)
+    link->rxTask = StaP_CurrentTask();
 #endif
+  
+  link->rxHandling = true;
+  
+  if(size > 0 && data[0] == DG_AGGREGATE) {
+    // Unpack, a truncated message ends it
+    
+    data++;
+    size--;
+    
+    while(size > 0 && data[0] > 0 && data[0] < size) {
+      if(!flowRxCredit(link, &data[1], data[0]) && handler)
+	(*handler)(link->context, link->rxNode, &data[1], data[0]);
+      size -= data[0] + 1;
+      data += data[0] + 1;
+    }
+  } else if(!flowRxCredit(link, data, size) && handler)
+    (*handler)(link->context, link->rxNode, data, size);
+
+  link->rxHandling = false;
 }
 
-static void storeByte(DgLink_t *link, const uint8_t c)
+static void fecRxReset(DgLink_t *link)
 {
-  if(link->datagramSize < link->rxStoreSize)
-    link->rxStore[link->datagramSize++] = c;
-  else {
-    link->overflow = true;
+  memset(link->fecRxStore, '\0', link->fecRxMax);
+  link->fecRxMask = 0;
+  link->fecRxLenXor = link->fecRxMax = 0;
+  link->fecRxActive = false;
+}
+
+static void fecRxFrame(DgLink_t *link, uint8_t seq, const uint8_t *data, size_t size)
+{
+  uint8_t index = seq - link->fecRxBase;
+  size_t i = 0;
+
+  if(size > link->fecStoreSize) {
+    // The sender abandons the group with an oversize frame, its next one
+    // starts a new group
+    
+    if(link->fecRxActive)
+      fecRxReset(link);
+    return;
+  }
+  
+  if(!link->fecRxActive || link->rxNode != link->fecRxNode
+     || index >= link->fecGroup) {
+    // A new group, whatever the old one had is of no use without parity
+    
+    fecRxReset(link);
+    link->fecRxActive = true;
+    link->fecRxNode = link->rxNode;
+    link->fecRxBase = seq;
+    index = 0;
   }
+
+  if(link->fecRxMask & (1UL<<index))
+    return;
+
+  for(i = 0; i < size; i++)
+    link->fecRxStore[i] ^= data[i];
+
+  if(size > link->fecRxMax)
+    link->fecRxMax = size;
+  
+  link->fecRxLenXor ^= size;
+  link->fecRxMask |= 1UL<<index;
 }
+
+static void fecRxParity(DgLink_t *link, void (*handler)(void*, uint8_t node, const uint8_t *data, size_t size), const uint8_t *data, size_t size)
+{
+  uint8_t first = 0, group = 0, offset = 0;
+  uint16_t length = 0;
+  uint32_t received = 0;
+  size_t i = 0;
+  int missing = 0;
+  
+  if(size < 4)
+    return;
+
+  first = data[0];
+  group = data[1];
+  length = data[2] | (uint16_t) data[3]<<8;
+  data += 4;
+  size -= 4;
+  offset = link->fecRxBase - first;
+  
+  if(group != link->fecGroup || !link->fecRxActive || link->rxNode != link->fecRxNode
+     || offset >= group || ((link->fecRxMask << offset) >> group) != 0) {
+    // Nothing or something else collected
+
+    if(link->fecRxActive)
+      fecRxReset(link);
+    return;
+  }
+
+  received = link->fecRxMask << offset;
+
+  for(i = 0; i < group; i++)
+    if(!(received & (1UL<<i)))
+      missing++;
+
+  length ^= link->fecRxLenXor;
+  
+  if(missing == 1 && length > 0 && length <= size && length <= link->fecStoreSize) {
+    for(i = 0; i < length; i++)
+      link->fecRxStore[i] ^= data[i];
+
+    link->fecRecovered++;
+    
+    rxDeliver(link, handler, link->fecRxStore, length);
+
+    if(length > link->fecRxMax)
+      link->fecRxMax = length;
+  } else if(missing > 0)
+    link->fecFailed++;
   
+  fecRxReset(link);
+}
+
 static void handleBreak(DgLink_t *link, void (*handler)(void*, uint8_t node, const uint8_t *data, size_t size))
 {
   if(link->overflow) {
+    link->overflows++;
+    
     if(link->rxError)
       (link->rxError)(link->context, "OVERFLOW", 0);
     return;
@@ -265,12 +1164,14 @@ static void handleBreak(DgLink_t *link, void (*handler)(void*, uint8_t node, con
       | link->rxStore[link->datagramSize-2];
     int payload = (int) link->datagramSize - sizeof(crc);
     
-    if(crc == crc16(link->crcStateRx, link->rxStore, payload)) {
+    if(crc == link->crcStateRx) {
       uint8_t rxExpected = ((link->rxSeqLast[link->rxNode] + 1) & 0xFF);
       uint8_t rxSeq = link->rxStore[0], lost = rxSeq - rxExpected;
 
-      link->datagramsGood[link->rxNode]++;
-      link->datagramsLost[link->rxNode] += lost;
+      if(link->rxNode < DG_STATS_NODES) {
+	link->datagramsGood[link->rxNode]++;
+	link->datagramsLost[link->rxNode] += lost;
+      }
       
       link->totalRxBytes += payload;
       link->totalRxDatagrams++;
@@ -279,16 +1180,40 @@ static void handleBreak(DgLink_t *link, void (*handler)(void*, uint8_t node, con
       link->datagramLastRxMillis = vpApproxMillis();
       link->alive = true;
 
-      if(handler)
-	(*handler)(link->context, link->rxNode, &link->rxStore[1], payload-1);
+      flowRxUpdate(link, link->rxNode, rxSeq, payload > 1 ? link->rxStore[1] : DG_HEARTBEAT);
+      
+      if(link->rxNode < link->histogramNodes) {
+	DgNodeHistograms_t *h = &link->histograms[link->rxNode];
+
+	if(h->arrived)
+	  histogramAdd(&h->arrival, link->datagramLastRxMillis - h->lastArrival);
+	
+	h->lastArrival = link->datagramLastRxMillis;
+	h->arrived = true;
+      }
+
+      if(link->fecGroup > 0) {
+	if(payload > 1 && link->rxStore[1] == DG_FEC_PARITY) {
+	  fecRxParity(link, handler, &link->rxStore[2], payload-2);
+	  link->datagramSize = 0;
+	  return;
+	}
+
+	fecRxFrame(link, rxSeq, &link->rxStore[1], payload-1);
+      }
+      
+      rxDeliver(link, handler, &link->rxStore[1], payload-1);
     } else {
-#if DG_DEBUG > 3
-    int i = 0;
+      if(DG_TRACE(link)) {
+	size_t i = 0;
 
-      for(i = 0; i < link->datagramSize; i++)
-	consolePrintUI8Hex(link->rxStore[i]);
-      consoleNL();
-#endif
+	for(i = 0; i < link->datagramSize; i++)
+	  consolePrintUI8Hex(link->rxStore[i]);
+	consoleNL();
+      }
+
+      link->crcErrors++;
+      
       if(link->rxError)
 	(link->rxError)(link->context, "CRC", crc);
     }
@@ -297,25 +1222,154 @@ static void handleBreak(DgLink_t *link, void (*handler)(void*, uint8_t node, con
   link->datagramSize = 0;
 }
 
+void datagramLinkSetHistograms(DgLink_t *link, DgNodeHistograms_t *histograms, uint8_t nodes)
+{
+  if(histograms)
+    memset((void*) histograms, '\0', nodes*sizeof(DgNodeHistograms_t));
+  
+  STAP_FORBID;
+  link->histograms = histograms;
+  link->histogramNodes = histograms ? nodes : 0;
+  STAP_PERMIT;
+}
+
+void datagramLinkSnapshot(DgLink_t *link, DgLinkStats_t *stats)
+{
+  memset((void*) stats, '\0', sizeof(DgLinkStats_t));
+  
+  STAP_FORBID;
+
+  stats->taken = vpTimeMicros();
+  stats->rxBytes = link->totalRxBytes;
+  stats->rxBytesRaw = link->totalRxBytesRaw;
+  stats->txBytes = link->totalTxBytes;
+  stats->txBytesRaw = link->totalTxBytesRaw;
+  stats->rxDatagrams = link->totalRxDatagrams;
+  stats->txDatagrams = link->totalTxDatagrams;
+  stats->crcErrors = link->crcErrors;
+  stats->overflows = link->overflows;
+  stats->badStarts = link->badStarts;
+  stats->txErrors = link->txErrors;
+  stats->fecRecovered = link->fecRecovered;
+  stats->fecFailed = link->fecFailed;
+  stats->flowStalls = link->flowStalls;
+  stats->flowTimeouts = link->flowTimeouts;
+  stats->flowGrantsSent = link->flowGrantsSent;
+  stats->flowGrantsReceived = link->flowGrantsReceived;
+
+  if(link->txQueue) {
+    stats->queueSent = link->txQueue->sent;
+    stats->queueDropped = link->txQueue->dropped;
+    stats->queueRefused = link->txQueue->refused;
+  }
+  
+  STAP_PERMIT;
+}
+
+void datagramNodeSnapshot(DgLink_t *link, uint8_t node, DgNodeStats_t *stats)
+{
+  memset((void*) stats, '\0', sizeof(DgNodeStats_t));
+
+  if(node >= DG_MAX_NODES)
+    return;
+  
+  STAP_FORBID;
+
+  if(node < DG_STATS_NODES) {
+    stats->good = link->datagramsGood[node];
+    stats->lost = link->datagramsLost[node];
+  }
+
+  if(node < link->histogramNodes) {
+    stats->arrival = link->histograms[node].arrival;
+    stats->txWait = link->histograms[node].txWait;
+  }
+  
+  STAP_PERMIT;
+}
+
+static uint32_t perSecond(uint32_t prev, uint32_t cur, VP_TIME_MICROS_T interval)
+{
+  // Modulo arithmetic takes care of the counters wrapping around
+  
+  return (uint32_t) ((uint64_t) (uint32_t) (cur - prev) * 1000000UL / interval);
+}
+
+void datagramLinkRates(const DgLinkStats_t *prev, const DgLinkStats_t *cur, DgLinkRates_t *rates)
+{
+  VP_TIME_MICROS_T interval = cur->taken - prev->taken;
+
+  memset((void*) rates, '\0', sizeof(DgLinkRates_t));
+
+  if(interval == 0)
+    return;
+
+  rates->rxBytes = perSecond(prev->rxBytes, cur->rxBytes, interval);
+  rates->rxBytesRaw = perSecond(prev->rxBytesRaw, cur->rxBytesRaw, interval);
+  rates->txBytes = perSecond(prev->txBytes, cur->txBytes, interval);
+  rates->txBytesRaw = perSecond(prev->txBytesRaw, cur->txBytesRaw, interval);
+  rates->rxDatagrams = perSecond(prev->rxDatagrams, cur->rxDatagrams, interval);
+  rates->txDatagrams = perSecond(prev->txDatagrams, cur->txDatagrams, interval);
+  rates->errors = perSecond(prev->crcErrors + prev->overflows + prev->badStarts + prev->txErrors,
+			    cur->crcErrors + cur->overflows + cur->badStarts + cur->txErrors,
+			    interval);
+}
+
+void datagramLinkStatsSend(DgLink_t *host, uint8_t id, DgLink_t *link)
+{
+  struct HostLinkStats buffer;
+
+  memset((void*) &buffer, '\0', sizeof(buffer));
+  buffer.link = id;
+  datagramLinkSnapshot(link, &buffer.stats);
+  
+  datagramTxStart(host, DG_HOST_LINKSTATS);
+  datagramTxOut(host, (const uint8_t*) &buffer, sizeof(buffer));
+  datagramTxEnd(host);
+}
+
+// The legacy calls report the difference to their own baselines, sixteen
+// bits of it is all they ever returned
+
 void datagramRxStatus(DgLink_t *link, uint8_t node, uint16_t *totalBuf, uint16_t *lostBuf)
 {
-    uint16_t lost = link->datagramsLost[node], total = lost + link->datagramsGood[node];
-    link->datagramsLost[node] = link->datagramsGood[node] = 0;
-        
-    if(lostBuf)
-        *lostBuf = lost;
-    if(totalBuf)
-        *totalBuf = total;
+  uint16_t good = 0, lost = 0;
+
+  if(node < DG_STATS_NODES) {
+    STAP_FORBID;
+  
+    good = link->datagramsGood[node] - link->legacyGood[node];
+    lost = link->datagramsLost[node] - link->legacyLost[node];
+    link->legacyGood[node] += good;
+    link->legacyLost[node] += lost;
+
+    STAP_PERMIT;
+  }
+  
+  if(lostBuf)
+    *lostBuf = lost;
+  if(totalBuf)
+    *totalBuf = lost + good;
 }
 
 void datagramLinkStatus(DgLink_t *link, uint16_t *totalRxBytesBuf, uint16_t *totalTxBytesBuf, uint16_t *totalRxDgBuf, uint16_t *totalTxDgBuf)
 {
-  uint16_t totalRx = link->totalRxBytesRaw, totalTx = link->totalTxBytesRaw,
-    totalRxDg = link->totalRxDatagrams, totalTxDg = link->totalTxDatagrams;
+  uint16_t totalRx = 0, totalTx = 0, totalRxDg = 0, totalTxDg = 0;
+
+  STAP_FORBID;
+  
+  totalRx = link->totalRxBytesRaw - link->legacyRxBytesRaw;
+  totalTx = link->totalTxBytesRaw - link->legacyTxBytesRaw;
+  totalRxDg = link->totalRxDatagrams - link->legacyRxDatagrams;
+  totalTxDg = link->totalTxDatagrams - link->legacyTxDatagrams;
 
-  link->totalRxBytesRaw = link->totalTxBytesRaw
-    = link->totalRxDatagrams = link->totalTxDatagrams = 0;
+  link->legacyRxBytesRaw += totalRx;
+  link->legacyTxBytesRaw += totalTx;
+  link->legacyRxDatagrams += totalRxDg;
+  link->legacyTxDatagrams += totalTxDg;
 
+  STAP_PERMIT;
+  
   if(totalRxBytesBuf)
     *totalRxBytesBuf = totalRx;
   
@@ -329,48 +1383,161 @@ void datagramLinkStatus(DgLink_t *link, uint16_t *totalRxBytesBuf, uint16_t *tot
     *totalTxDgBuf = totalTxDg;
 }
   
+static bool rxAccepted(DgLink_t *link)
+{
+  return link->node == 0 || link->rxNode == link->node || link->rxNode == ALN_BROADCAST;
+}
+
+static void rxInputCobs(DgLink_t *link, void (*handler)(void*, uint8_t node, const uint8_t *data, size_t size), const uint8_t *buffer, size_t size)
+{
+  // A zero byte implied by the previous block is stored only once another
+  // block follows, the last block of a frame has none
+
+  while(size > 0) {
+    uint8_t c = *buffer;
+
+    if(c == FLAG) {
+      // Delimiter
+      
+      if(link->rxBusy && !link->cobsStart && !link->cobsDiscard && rxAccepted(link))
+	handleBreak(link, handler);
+      
+      link->rxBusy = link->overflow = link->cobsDiscard = false;
+      link->cobsRemain = 0;
+      buffer++;
+      size--;
+    } else if(link->cobsRemain == 0) {
+      // Code byte
+      
+      if(!link->rxBusy) {
+	link->rxBusy = link->cobsStart = true;
+	link->datagramSize = 0;
+      } else if(link->cobsZero) {
+	if(link->cobsStart)
+	  // Starts with a zero, not a frame
+	  link->cobsDiscard = true;
+	else if(!link->cobsDiscard && rxAccepted(link))
+	  storeRun(link, NULL, 1);
+      }
+
+      link->cobsZero = c < 0xFF;
+      link->cobsRemain = c - 1;
+      link->totalRxBytesRaw++;
+      buffer++;
+      size--;
+    } else {
+      // Block data up to its end or a delimiter
+      
+      size_t runLength = size < link->cobsRemain ? size : link->cobsRemain;
+      const uint8_t *runEnd = memchr(buffer, FLAG, runLength);
+
+      if(runEnd)
+	runLength = runEnd - buffer;
+
+      if(link->cobsStart && runLength > 0) {
+	link->rxNode = (~FLAG) - *buffer;
+	link->cobsStart = false;
+	
+	if(link->rxNode < DG_MAX_NODES)
+	  link->crcStateRx = crc16_update(0xFFFF, *buffer);
+	else {
+	  link->badStarts++;
+	  
+	  if(link->rxError)
+	    (link->rxError)(link->context, "BAD", *buffer);
+	  link->cobsDiscard = true;
+	}
+	
+	buffer++;
+	size--;
+	link->cobsRemain--;
+	link->totalRxBytesRaw++;
+	runLength--;
+      }
+
+      if(!link->cobsDiscard && rxAccepted(link))
+	storeRun(link, buffer, runLength);
+      
+      link->totalRxBytesRaw += runLength;
+      link->cobsRemain -= runLength;
+      buffer += runLength;
+      size -= runLength;
+
+      if(runEnd)
+	// Cut short by a delimiter
+	link->cobsRemain = 0;
+    }
+  }
+}
+
 void datagramRxInputWithHandler(DgLink_t *link, void (*handler)(void*, uint8_t node, const uint8_t *data, size_t size), const uint8_t *buffer, size_t size)
 {
   if(!link->initialized)
     return;
+
+  if(link->cobs) {
+    rxInputCobs(link, handler, buffer, size);
+    return;
+  }
   
-  while(size-- > 0) {
-    uint8_t c = *buffer++;
+  while(size > 0) {
+    uint8_t c = *buffer;
 
-#if DG_DEBUG > 0
-    //    consolePrintUI8Hex(c);
-#endif
-    if(c != FLAG) {
-      if(link->overflow) {
-	// Ignore the rest
-      } else if(link->rxBusy) {
-          if(link->node == 0 || link->rxNode == link->node || link->rxNode == ALN_BROADCAST) {
-	          if(link->flagCnt) {
-	            while(c-- != FLAG)
-	              storeByte(link, FLAG);
-            } else {
-             storeByte(link, c);
-            }
-          }
-	      
-	      link->totalRxBytesRaw++;
-      } else {
-	//printf("S %x ", c);
-	link->rxNode = (~FLAG) - c;
+    if(c == FLAG) {
+      buffer++;
+      size--;
+      
+      if(++link->flagCnt > 1 && link->rxBusy) {
+	if(rxAccepted(link))
+	  handleBreak(link, handler);
+	link->rxBusy = link->overflow = false;
+      }
+    } else if(link->overflow) {
+      // Ignore the rest
+      
+      buffer++;
+      size--;
+      link->flagCnt = 0;
+    } else if(!link->rxBusy) {
+      //printf("S %x ", c);
+      link->rxNode = (~FLAG) - c;
 	  
-	if(link->rxNode < DG_MAX_NODES) {
-	  link->rxBusy = true;
-	  link->crcStateRx = crc16_update(0xFFFF, c);
-	  link->datagramSize = 0;
-	} else if(link->rxError)
+      if(link->rxNode < DG_MAX_NODES) {
+	link->rxBusy = true;
+	link->crcStateRx = crc16_update(0xFFFF, c);
+	link->datagramSize = 0;
+      } else {
+	link->badStarts++;
+	
+	if(link->rxError)
 	  (link->rxError)(link->context, "BAD", c);
       }
-    
+
+      buffer++;
+      size--;
+      link->flagCnt = 0;
+    } else if(link->flagCnt) {
+      // Escaped FLAG run
+      
+      if(rxAccepted(link))
+	storeRun(link, NULL, c);
+
+      link->totalRxBytesRaw++;
+      buffer++;
+      size--;
       link->flagCnt = 0;
-    } else if(++link->flagCnt > 1 && link->rxBusy) {
-      if(link->node == 0 || link->rxNode == link->node || link->rxNode == ALN_BROADCAST)
-          handleBreak(link, handler);
-      link->rxBusy = link->overflow = false;
+    } else {
+      // Literal run up to the next FLAG
+      
+      const uint8_t *runEnd = memchr(buffer, FLAG, size);
+      size_t runLength = runEnd ? (size_t) (runEnd - buffer) : size;
+      
+      if(rxAccepted(link))
+	storeRun(link, buffer, runLength);
+
+      link->totalRxBytesRaw += runLength;
+      buffer += runLength;
+      size -= runLength;
     }
   }
 }
@@ -380,5 +1547,67 @@ void datagramRxInput(DgLink_t *link, const uint8_t *data, size_t size)
   datagramRxInputWithHandler(link, link->rxHandler, data, size);
 }
 
+void datagramBatchInit(DgBatch_t *batch, DgLink_t *link, uint8_t node, uint8_t *buffer, size_t size, VP_TIME_MILLIS_T latency)
+{
+  memset((void*) batch, '\0', sizeof(DgBatch_t));
+  
+  batch->link = link;
+  batch->node = node;
+  batch->buffer = buffer;
+  batch->size = size < DG_TRANSMIT_MAX ? size : DG_TRANSMIT_MAX;
+  batch->latency = latency;
+}
+
+void datagramBatchFlush(DgBatch_t *batch)
+{
+  if(batch->len == 0)
+    return;
+
+  datagramTxStartNode(batch->link, batch->node, DG_AGGREGATE);
+  datagramTxOut(batch->link, batch->buffer, batch->len);
+  datagramTxEnd(batch->link);
+  
+  batch->len = 0;
+  batch->datagrams++;
+}
+
+void datagramBatchAdd(DgBatch_t *batch, uint8_t header, const uint8_t *data, size_t size)
+{
+  if(size + 2 > batch->size || size + 1 > DG_AGGREGATE_MAX) {
+    // Doesn't fit any batch, on its own then, after what's been
+    // collected so far to keep the order
+
+    datagramBatchFlush(batch);
+    datagramTxStartNode(batch->link, batch->node, header);
+    datagramTxOut(batch->link, data, size);
+    datagramTxEnd(batch->link);
+    return;
+  }
+
+  if(batch->len + size + 2 > batch->size)
+    datagramBatchFlush(batch);
+
+  if(batch->len == 0)
+    batch->since = vpTimeMillis();
+  
+  batch->buffer[batch->len++] = size + 1;
+  batch->buffer[batch->len++] = header;
+  memcpy(&batch->buffer[batch->len], data, size);
+  batch->len += size;
+  batch->messages++;
+}
+
+VP_TIME_MICROS_T datagramBatchPoll(DgBatch_t *batch)
+{
+  VP_TIME_MILLIS_T waited = 0;
+  
+  if(batch->len == 0)
+    return (VP_TIME_MICROS_T) batch->latency*1000;
 
+  if((waited = VP_ELAPSED_MILLIS(batch->since)) >= batch->latency) {
+    datagramBatchFlush(batch);
+    return (VP_TIME_MICROS_T) batch->latency*1000;
+  }
 
+  return (VP_TIME_MICROS_T) (batch->latency - waited)*1000;
+}
@@ -2,6 +2,7 @@
 #include <stdbool.h>
 #include "I2CDevice.h"
 #include "Console.h"
+#include "Log.h"
 #include "PRNG.h"
 #include "Scheduler.h"
 
@@ -44,7 +45,7 @@ bool I2CTargetIsStable(I2CTarget_t *device)
 static uint8_t I2CTargetInvoke(I2CTarget_t *device, uint8_t subId, uint8_t status)
 {
   if(status) {
-    consoleNotefLn("I2C(%s:%d) ERROR %#X", device->name, subId, status);
+    LOG_WARN(I2C, "I2C(%s:%d) ERROR %#X", device->name, subId, status);
 
     if(device->offLine) {
       device->backoff += device->backoff/BACKOFF_FRACTION;
@@ -55,7 +56,7 @@ static uint8_t I2CTargetInvoke(I2CTarget_t *device, uint8_t subId, uint8_t statu
       device->backoff += (randomUI16() & 0x1FF);
       
     } else if(device->failCount++ > MAX_FAILS) {
-      consoleNotefLn("I2C(%s) is OFFLINE", device->name);
+      LOG_WARN(I2C, "I2C(%s) is OFFLINE", device->name);
       device->offLine = true;
       device->backoff = BACKOFF_INITIAL;
     }
@@ -63,7 +64,7 @@ static uint8_t I2CTargetInvoke(I2CTarget_t *device, uint8_t subId, uint8_t statu
     device->offLineAt = vpTimeMillis();
   } else {    
     if(device->failCount > 0) {
-      consoleNotefLn("I2C(%s:%d) RECOVERED", device->name, subId);
+      LOG_NOTE(I2C, "I2C(%s:%d) RECOVERED", device->name, subId);
       device->failCount = 0;
       device->offLine;
     }
@@ -0,0 +1,145 @@
+#include "Log.h"
+#include "Console.h"
+
+uint8_t logLevelTable[Log_NumOfModules];
+
+static LogSite_t *logSites;
+static LogSite_t logConsoleSites[LOG_CONSOLE_SITES];
+
+void logLevelSet(LogModule_t module, uint8_t level)
+{
+  if(module < Log_NumOfModules)
+    logLevelTable[module] = level + 1;
+}
+
+void logPrintf(LogModule_t module, uint8_t level, const char *f, ...)
+{
+  uint8_t flags = CONSOLE_BIN_NL | CONSOLE_FMT_LITERAL;
+  va_list args;
+
+  if(level <= LOG_LEVEL_ERROR)
+    flags |= CONSOLE_BIN_ERROR;
+  else if(level <= LOG_LEVEL_NOTE)
+    flags |= CONSOLE_BIN_NOTE;
+  else
+    flags |= CONSOLE_BIN_DEBUG;
+  
+  va_start(args, f);
+  consolevLog(flags, f, args);
+  va_end(args);
+}
+
+static void logSuppressed(LogSite_t *site, uint16_t count)
+{
+  if(site->shared)
+    logPrintf(site->module, site->level, "%u similar messages suppressed",
+	      (unsigned int) count);
+  else
+    logPrintf(site->module, site->level, "%u similar messages suppressed (%s)",
+	      (unsigned int) count, site->format);
+}
+
+// The milliseconds wrap in 65.5 seconds, a site refilled longer ago than
+// this by the seconds is due a full burst
+
+#define LOG_IDLE_SECS   60
+
+bool logSiteAdmit(LogSite_t *site, const char *format)
+{
+  VP_TIME_MILLIS_T elapsed = 0;
+  uint16_t suppressed = 0;
+  bool admit = false;
+  
+  STAP_FORBID;
+
+  // Brings the seconds up to date as well
+  
+  elapsed = VP_ELAPSED_MILLIS(site->refilled);
+  
+  if(!site->format || VP_ELAPSED_SECS(site->refilledSecs) > LOG_IDLE_SECS) {
+    // New or quiet for longer than the milliseconds can tell
+    site->format = format;
+    site->tokens = LOG_BURST;
+    site->refilled = vpTimeMillis();
+    site->refilledSecs = vpTimeSecs();
+  } else if(elapsed >= LOG_REFILL_MILLIS) {
+    uint16_t refill = elapsed / LOG_REFILL_MILLIS;
+
+    if(site->tokens + refill >= LOG_BURST) {
+      site->tokens = LOG_BURST;
+      site->refilled = vpTimeMillis();
+      site->refilledSecs = vpTimeSecs();
+    } else {
+      site->tokens += refill;
+      site->refilled += refill * LOG_REFILL_MILLIS;
+      site->refilledSecs = vpTimeSecs();
+    }
+  }
+
+  if(site->tokens > 0) {
+    site->tokens--;
+    suppressed = site->suppressed;
+    site->suppressed = 0;
+    admit = true;
+  } else {
+    if(site->suppressed < 0xFFFF)
+      site->suppressed++;
+
+    if(!site->listed) {
+      // Remembered for the periodic report
+      site->next = logSites;
+      logSites = site;
+      site->listed = true;
+    }
+  }
+  
+  STAP_PERMIT;
+
+  if(suppressed > 0)
+    logSuppressed(site, suppressed);
+  
+  return admit;
+}
+
+bool logConsoleAdmit(uint8_t level, const char *format)
+{
+  LogSite_t *site = &logConsoleSites[((uintptr_t) format >> 2) % LOG_CONSOLE_SITES];
+
+  // A panic report goes through whatever the buckets say
+  
+  if(failSafeMode)
+    return true;
+
+  if(!site->shared) {
+    STAP_FORBID;
+    site->module = Log_App;
+    site->level = level;
+    site->shared = true;
+    STAP_PERMIT;
+  }
+  
+  return logSiteAdmit(site, format);
+}
+
+void logSuppressedReport(void)
+{
+  static VP_TIME_MILLIS_T lastReport;
+  LogSite_t *site = NULL;
+
+  if(VP_ELAPSED_MILLIS(lastReport) < LOG_REPORT_MILLIS)
+    return;
+
+  lastReport = vpTimeMillis();
+  
+  for(site = logSites; site; site = site->next) {
+    uint16_t suppressed = 0;
+
+    STAP_FORBID;
+    suppressed = site->suppressed;
+    site->suppressed = 0;
+    STAP_PERMIT;
+
+    if(suppressed > 0)
+      logSuppressed(site, suppressed);
+  }
+}
@@ -4,6 +4,7 @@
 #include "StaP.h"
 #include "NVStore.h"
 #include "Console.h"
+#include "Log.h"
 #include "CRC16.h"
 
 #define STARTUP_DELAY  10
@@ -21,9 +22,9 @@ static bool readBlock(NVStorePartition_t *p, uint32_t index, uint8_t *buffer)
     if((*p->device->deviceRead)(NVSTORE_ADDR(p, index), buffer, p->device->pageSize))
       status = true;
     else
-      consoleNotefLn("NVStore %s readBlock(%#x) read fail", p->name, index);
+      LOG_WARN(NVStore, "NVStore %s readBlock(%#x) read fail", p->name, index);
   } else
-    consoleNotefLn("NVStore %s readBlock(%#x) illegal index", p->name, index);
+    LOG_WARN(NVStore, "NVStore %s readBlock(%#x) illegal index", p->name, index);
 
   return status;
 }
@@ -65,13 +66,13 @@ static bool startup(NVStorePartition_t *p)
   uint32_t count = 0;
   bool valid = false;
 
-  consoleNotefLn("NVStore %s being initialized", p->name);
+  LOG_NOTE(NVStore, "NVStore %s being initialized", p->name);
 	
   while(ptr < p->size) {
     NVBlockHeader_t header;
     
     if(!readBlock(p, ptr, p->device->buffer)) {
-      consoleNotefLn("NVStore %s startup readBlock() fail", p->name);
+      LOG_WARN(NVStore, "NVStore %s startup readBlock() fail", p->name);
       return false;
     }
 
@@ -79,8 +80,8 @@ static bool startup(NVStorePartition_t *p)
       if(!valid) {
 	count = header.count;
 	index = ptr;
-	consoleNotefLn("  NVStore %s first valid block at %#x, count = %#x",
-		       p->name, ptr, count);
+	LOG_DEBUG(NVStore, "  NVStore %s first valid block at %#x, count = %#x",
+			   p->name, ptr, count);
 	valid = true;
 	
       } else if(header.count > count || (header.count < 0x10 && count > 0xFFFFFFF0UL)) {
@@ -95,7 +96,7 @@ static bool startup(NVStorePartition_t *p)
   p->index = (index + 1) % p->size;
   p->count = count;
   
-  consoleNotefLn("  NVStore(%s) MOUNTED (head at %#x, count = %#x)", p->name, p->index, p->count);
+  LOG_NOTE(NVStore, "  NVStore(%s) MOUNTED (head at %#x, count = %#x)", p->name, p->index, p->count);
   
   p->running = true;
 
@@ -133,9 +134,9 @@ static bool storeBlock(NVStorePartition_t *p, uint16_t type, const uint8_t *payH
       
       status = true;
     } else
-      consoleNotefLn("NVStore %s writeBlock() write fail", p->name);
+      LOG_WARN(NVStore, "NVStore %s writeBlock() write fail", p->name);
   } else
-    consoleNotefLn("NVStore %s writeBlock(%#x) illegal index", p->name, p->index);
+    LOG_WARN(NVStore, "NVStore %s writeBlock(%#x) illegal index", p->name, p->index);
 
   return status;
 }
@@ -182,8 +183,8 @@ static NVStore_Status_t recallBlob(NVStorePartition_t *p, uint32_t index, NVBlob
 	    
     if(remaining > 0) {
       // Ran out of data blocks
-      consoleNotefLn("NVStore %s ReadBlob(%s) data block(s) missing",
-		     p->name, blob->name);
+      LOG_WARN(NVStore, "NVStore %s ReadBlob(%s) data block(s) missing",
+			p->name, blob->name);
       status = NVStore_Status_ReadFailed;
     } else {
       uint16_t crc =
@@ -193,8 +194,8 @@ static NVStore_Status_t recallBlob(NVStorePartition_t *p, uint32_t index, NVBlob
       if(crc == blob->crc) {
 	status = NVStore_Status_OK;
       }  else {
-	consoleNotefLn("NVStore %s ReadBlob(%s) CRC fail (%#X vs %#X)",
-		       p->name, blob->name, (uint32_t) crc, (uint32_t) blob->crc);
+	LOG_WARN(NVStore, "NVStore %s ReadBlob(%s) CRC fail (%#X vs %#X)",
+			  p->name, blob->name, (uint32_t) crc, (uint32_t) blob->crc);
 	status = NVStore_Status_CRCFail;
       }
     }
@@ -205,7 +206,7 @@ static NVStore_Status_t recallBlob(NVStorePartition_t *p, uint32_t index, NVBlob
       memcpy(data, &p->device->buffer[NVSTORE_BLOB_OVERHEAD], blob->size);
       status = NVStore_Status_OK;
     } else {
-      consoleNotefLn("NVStore %s ReadBlob(%s) CRC fail", p->name, blob->name);
+      LOG_WARN(NVStore, "NVStore %s ReadBlob(%s) CRC fail", p->name, blob->name);
       status = NVStore_Status_CRCFail;
     }
   }
@@ -249,7 +250,7 @@ NVStore_Status_t NVStoreWriteBlob(NVStorePartition_t *p, const char *name, const
       size -= NVSTORE_BLOB_PAYLOAD(p);
 
       if(!storeBlock(p, nvb_blob_c, (const uint8_t*) &header, sizeof(header), data, size)) {
-	consoleNotefLn("NVStore WriteBlob blob write (2) fail", p->name);
+	LOG_WARN(NVStore, "NVStore WriteBlob blob write (2) fail", p->name);
 	status = NVStore_Status_WriteFailed;
       } else {
 	// Write the remaining data as data blocks
@@ -261,7 +262,7 @@ NVStore_Status_t NVStoreWriteBlob(NVStorePartition_t *p, const char *name, const
 	    segment = NVSTORE_BLOCK_PAYLOAD(p);
 	    
 	  if(!storeBlock(p, nvb_data_c, NULL, 0, data, size)) {
-	    consoleNotefLn("NVStore WriteBlob data write fail", p->name);
+	    LOG_WARN(NVStore, "NVStore WriteBlob data write fail", p->name);
 	    status = NVStore_Status_WriteFailed;
 	    break;
 	  }
@@ -278,7 +279,7 @@ NVStore_Status_t NVStoreWriteBlob(NVStorePartition_t *p, const char *name, const
       // The contents fit in the blob block
             
       if(!storeBlock(p, nvb_blob_c, (const uint8_t*) &header, sizeof(header), data, size)) {
-	consoleNotefLn("NVStore WriteBlob blob write (1) fail", p->name);
+	LOG_WARN(NVStore, "NVStore WriteBlob blob write (1) fail", p->name);
 	status = NVStore_Status_WriteFailed;
       } else
 	status = NVStore_Status_OK;
@@ -286,7 +287,7 @@ NVStore_Status_t NVStoreWriteBlob(NVStorePartition_t *p, const char *name, const
   }
 
   if(status == NVStore_Status_OK && p->device->deviceDrain && !p->device->deviceDrain()) {
-    consoleNotefLn("NVStore WriteBlob device drain fail", p->name);    
+    LOG_WARN(NVStore, "NVStore WriteBlob device drain fail", p->name);    
     status = NVStore_Status_WriteFailed;
   }
 
@@ -327,12 +328,12 @@ NVStore_Status_t NVStoreReadBlob(NVStorePartition_t *p, const char *name, uint8_
         	  continue;
           }
 
-          consoleNotefLn("NVStore %s ReadBlob(%s) delta = %#x, size = %d, crc = %#X",
-			 p->name, blob.name, delta, blob.size, (uint32_t) blob.crc);
+          LOG_DEBUG(NVStore, "NVStore %s ReadBlob(%s) delta = %#x, size = %d, crc = %#X",
+			     p->name, blob.name, delta, blob.size, (uint32_t) blob.crc);
 			 
           if(blob.size != size) {
-        	  consoleNotefLn("NVStore %s ReadBlob(%s) size mismatch (%d vs %d)",
-				 p->name, blob.name, blob.size, (uint16_t) size);
+        	  LOG_WARN(NVStore, "NVStore %s ReadBlob(%s) size mismatch (%d vs %d)",
+				    p->name, blob.name, blob.size, (uint16_t) size);
         	  status = NVStore_Status_SizeMismatch;
           } else {
 	    status = recallBlob(p, NVSTORE_DELTA(p, delta), &blob, data);
@@ -369,8 +370,8 @@ NVStore_Status_t NVStoreReadBlob(NVStorePartition_t *p, const char *name, uint8_
 	    
 	    if(remaining > 0) {
 	      // Ran out of data blocks
-	      consoleNotefLn("NVStore %s ReadBlob(%s) data block(s) missing",
-			     p->name, blob.name);
+	      LOG_WARN(NVStore, "NVStore %s ReadBlob(%s) data block(s) missing",
+				p->name, blob.name);
 	      status = NVStore_Status_ReadFailed;
 	    } else {
 	      uint16_t crc =
@@ -380,8 +381,8 @@ NVStore_Status_t NVStoreReadBlob(NVStorePartition_t *p, const char *name, uint8_
 	      if(crc == blob.crc) {
 		status = NVStore_Status_OK;
 	      }  else {
-		consoleNotefLn("NVStore %s ReadBlob(%s) CRC fail (%#X vs %#X)",
-			       p->name, blob.name, (uint32_t) crc, (uint32_t) blob.crc);
+		LOG_WARN(NVStore, "NVStore %s ReadBlob(%s) CRC fail (%#X vs %#X)",
+				  p->name, blob.name, (uint32_t) crc, (uint32_t) blob.crc);
 		status = NVStore_Status_CRCFail;
 	      }
 	    }
@@ -391,7 +392,7 @@ NVStore_Status_t NVStoreReadBlob(NVStorePartition_t *p, const char *name, uint8_
 	      memcpy(data, &p->device->buffer[sizeof(header) + sizeof(blob)], size);
 	      status = NVStore_Status_OK;
 	    } else {
-	      consoleNotefLn("NVStore %s ReadBlob(%s) CRC fail", p->name, blob.name);
+	      LOG_WARN(NVStore, "NVStore %s ReadBlob(%s) CRC fail", p->name, blob.name);
 	      status = NVStore_Status_CRCFail;
 	    }
 	  }
@@ -405,7 +406,7 @@ NVStore_Status_t NVStoreReadBlob(NVStorePartition_t *p, const char *name, uint8_
     }
 
     if(delta == p->size) {
-      consoleNotefLn("NVStore %s ReadBlob(%s) blob not found", p->name, name);
+      LOG_NOTE(NVStore, "NVStore %s ReadBlob(%s) blob not found", p->name, name);
       status = NVStore_Status_NotFound;
     }
   }
@@ -435,7 +436,7 @@ NVStore_Status_t NVStoreScanStartFrom(NVStoreScanState_t *s, NVStorePartition_t
       NVBlockHeader_t header;
       
       if((delta & 0xFF) == 0)
-	consoleNotefLn("NVStore %s ScanStart(%s) delta %#x", p->name, name, delta);
+	LOG_DEBUG(NVStore, "NVStore %s ScanStart(%s) delta %#x", p->name, name, delta);
 			   
       if(recallBlock(p, NVSTORE_DELTA(p, delta), &header, p->device->buffer) && header.type == nvb_blob_c) {
 	// Found a blob header
@@ -460,7 +461,7 @@ NVStore_Status_t NVStoreScanStartFrom(NVStoreScanState_t *s, NVStorePartition_t
     } while(delta < p->size-1);
 
     if(status != NVStore_Status_OK) {
-      consoleNotefLn("NVStore %s ScanStart(%s) blob not found", p->name, name);
+      LOG_NOTE(NVStore, "NVStore %s ScanStart(%s) blob not found", p->name, name);
       status = NVStore_Status_NotFound;
     }
   }
@@ -494,8 +495,8 @@ NVStore_Status_t NVStoreScan(NVStoreScanState_t *s, uint8_t *data, size_t size)
 
           if(!strncmp(blob.name, s->name, NVSTORE_NAME_MAX) && blob.size == size) {
 	    if((s->count & 0xFF) == 0)
-	      consoleNotefLn("NVStore %s Scan(%s) index = %#x",
-			     s->partition->name, blob.name, s->index);
+	      LOG_DEBUG(NVStore, "NVStore %s Scan(%s) index = %#x",
+				 s->partition->name, blob.name, s->index);
 	    status = recallBlob(s->partition, s->index, &blob, data);
 	  }
       } 
@@ -505,7 +506,7 @@ NVStore_Status_t NVStoreScan(NVStoreScanState_t *s, uint8_t *data, size_t size)
     }
 
     if(status != NVStore_Status_OK) {
-      consoleNotefLn("NVStore %s Scan(%s) finished", s->partition->name, s->name);
+      LOG_NOTE(NVStore, "NVStore %s Scan(%s) finished", s->partition->name, s->name);
       status = NVStore_Status_NotFound;
     }
   }
@@ -0,0 +1,413 @@
+#include <string.h>
+#include "Reliable.h"
+#include "StaP.h"
+
+#define SEQ_DIFF(a, b)   ((uint8_t) ((a) - (b)))
+#define SLOT(s, seq)     (&(s)[(seq) % ch->window])
+#define ACK_SIZE         (1 + sizeof(uint32_t))
+
+static void channelObtain(DgReliable_t *ch)
+{
+#ifdef STAP_MutexCreate
+  if(!failSafeMode)
+    STAP_MutexObtain(ch->mutex);
+#endif
+}
+
+static void channelRelease(DgReliable_t *ch)
+{
+#ifdef STAP_MutexCreate
+  if(!failSafeMode)
+    STAP_MutexRelease(ch->mutex);
+#endif
+}
+
+void reliableInit(DgReliable_t *ch, DgLink_t *link, uint8_t node,
+		  DgReliableSlot_t *tx, DgReliableSlot_t *rx, uint8_t window,
+		  void *context,
+		  void (*deliver)(void*, uint8_t header, const uint8_t *data, size_t size))
+{
+  if(window > DG_RELIABLE_WINDOW_MAX)
+    window = DG_RELIABLE_WINDOW_MAX;
+
+  // Slots are indexed by the 8-bit sequence number modulo the window, that
+  // stays consistent across the wrap only if the window divides 256
+  
+  if(window == 0 || (window & (window - 1)) != 0)
+    STAP_Panicf(STAP_ERR_DATAGRAM, "Reliable window %u", window);
+  
+  memset((void*) ch, '\0', sizeof(DgReliable_t));
+  memset((void*) tx, '\0', window*sizeof(DgReliableSlot_t));
+  memset((void*) rx, '\0', window*sizeof(DgReliableSlot_t));
+
+  ch->link = link;
+  ch->node = node;
+  ch->tx = tx;
+  ch->rx = rx;
+  ch->window = window;
+  ch->context = context;
+  ch->deliver = deliver;
+  ch->rto = DG_RELIABLE_RTO_INITIAL;
+
+#ifdef STAP_MutexCreate
+  ch->mutex = STAP_MutexCreate;
+
+  if(!ch->mutex)
+    STAP_Panic(STAP_ERR_MUTEX_CREATE);
+#endif
+}
+
+void reliableEnable(DgReliable_t *ch, uint8_t header)
+{
+  ch->types[header>>3] |= 1<<(header & 7);
+}
+
+static bool reliableEnabled(DgReliable_t *ch, uint8_t header)
+{
+  return (ch->types[header>>3] & (1<<(header & 7))) != 0;
+}
+
+//
+// Sender
+//
+
+// Called with the channel held, it's taken before the link (see
+// Reliable.h)
+
+static void transmit(DgReliable_t *ch, DgReliableSlot_t *slot, uint8_t seq)
+{
+  datagramTxStartNode(ch->link, ch->node, slot->header);
+  datagramTxOut(ch->link, &seq, sizeof(seq));
+  datagramTxOut(ch->link, slot->data, slot->size);
+  datagramTxEnd(ch->link);
+
+  if(slot->transmissions > 0)
+    ch->retransmitted++;
+  else
+    ch->sent++;
+
+  // Saturated, a wrap back to one would make the RTT sample look clean
+  
+  if(slot->transmissions < 0xFF)
+    slot->transmissions++;
+
+  slot->sent = vpTimeMillis();
+}
+
+bool reliableSend(DgReliable_t *ch, uint8_t header, const uint8_t *data, size_t size)
+{
+  bool success = false;
+
+  if(size > DG_RELIABLE_PAYLOAD)
+    return false;
+
+  channelObtain(ch);
+
+  if(SEQ_DIFF(ch->txNext, ch->txBase) < ch->window) {
+    DgReliableSlot_t *slot = SLOT(ch->tx, ch->txNext);
+
+    slot->header = header;
+    slot->size = size;
+    slot->transmissions = 0;
+    slot->busy = true;
+    memcpy(slot->data, data, size);
+
+    transmit(ch, slot, ch->txNext++);
+    success = true;
+  }
+
+  channelRelease(ch);
+
+  return success;
+}
+
+static void rttSample(DgReliable_t *ch, DgReliableSlot_t *slot)
+{
+  VP_TIME_MILLIS_T sample = 0, rto = 0;
+
+  if(slot->transmissions != 1)
+    // Ambiguous (Karn)
+    return;
+
+  sample = VP_ELAPSED_MILLIS(slot->sent);
+
+  if(ch->srtt == 0) {
+    ch->srtt = sample > 0 ? sample : 1;
+    ch->rttvar = sample/2;
+  } else {
+    VP_TIME_MILLIS_T error = ch->srtt > sample ? ch->srtt - sample : sample - ch->srtt;
+
+    // Rounded up, truncation would let the variance decay to nothing
+
+    ch->rttvar = (3*ch->rttvar + error + 3)/4;
+    ch->srtt = (7*ch->srtt + sample + 7)/8;
+  }
+
+  // The receiver may hold an acknowledgement for DG_RELIABLE_ACK_DELAY,
+  // that much margin there must always be
+
+  rto = ch->srtt + (4*ch->rttvar > DG_RELIABLE_ACK_DELAY
+		    ? 4*ch->rttvar : DG_RELIABLE_ACK_DELAY);
+
+  ch->rto = rto < DG_RELIABLE_RTO_MIN ? DG_RELIABLE_RTO_MIN
+    : rto > DG_RELIABLE_RTO_MAX ? DG_RELIABLE_RTO_MAX : rto;
+}
+
+static void handleAck(DgReliable_t *ch, const uint8_t *data, size_t size)
+{
+  uint8_t inFlight = 0, next = 0, seq = 0, highest = 0;
+  uint32_t sack = 0;
+  int i = 0;
+
+  if(size < ACK_SIZE)
+    return;
+
+  next = data[0];
+  sack = (uint32_t) data[1] | (uint32_t) data[2]<<8
+    | (uint32_t) data[3]<<16 | (uint32_t) data[4]<<24;
+
+  channelObtain(ch);
+
+  inFlight = SEQ_DIFF(ch->txNext, ch->txBase);
+
+  if(SEQ_DIFF(next, ch->txBase) <= inFlight) {
+    highest = next;
+
+    // Cumulative part
+
+    for(seq = ch->txBase; seq != next; seq++) {
+      DgReliableSlot_t *slot = SLOT(ch->tx, seq);
+
+      if(slot->busy) {
+	rttSample(ch, slot);
+	slot->busy = false;
+      }
+    }
+
+    // Selective part
+
+    for(i = 0; i < DG_RELIABLE_WINDOW_MAX; i++) {
+      seq = next + 1 + i;
+
+      if(SEQ_DIFF(seq, ch->txBase) >= inFlight)
+	break;
+
+      if(sack & (1UL<<i)) {
+	DgReliableSlot_t *slot = SLOT(ch->tx, seq);
+
+	if(slot->busy) {
+	  rttSample(ch, slot);
+	  slot->busy = false;
+	}
+
+	highest = seq;
+      }
+    }
+
+    while(ch->txBase != ch->txNext && !SLOT(ch->tx, ch->txBase)->busy)
+      ch->txBase++;
+
+    // Holes below the highest frame received were lost, repeat the ones
+    // that have had a round trip's time to arrive. Only once, the repeat
+    // is covered by the timer.
+
+    for(seq = ch->txBase; seq != highest; seq++) {
+      DgReliableSlot_t *slot = SLOT(ch->tx, seq);
+
+      if(slot->busy && slot->transmissions == 1
+	 && VP_ELAPSED_MILLIS(slot->sent) >= ch->srtt)
+	transmit(ch, slot, seq);
+    }
+  }
+
+  channelRelease(ch);
+}
+
+//
+// Receiver
+//
+
+// Built with the channel held and sent once it's released, the receiving
+// task doesn't wait for the link holding the channel. Acknowledgements
+// from different tasks may go out in the wrong order then, the sender
+// ignores one that's behind.
+
+static void ackBuildUnsafe(DgReliable_t *ch, uint8_t *buffer)
+{
+  uint32_t sack = 0;
+  int i = 0;
+
+  for(i = 0; i < DG_RELIABLE_WINDOW_MAX && i+1 < ch->window; i++)
+    if(SLOT(ch->rx, (uint8_t) (ch->rxNext + 1 + i))->busy)
+      sack |= 1UL<<i;
+
+  buffer[0] = ch->rxNext;
+  buffer[1] = sack & 0xFF;
+  buffer[2] = (sack>>8) & 0xFF;
+  buffer[3] = (sack>>16) & 0xFF;
+  buffer[4] = (sack>>24) & 0xFF;
+
+  ch->rxUnacked = 0;
+  ch->ackPending = false;
+}
+
+static void ackSend(DgReliable_t *ch, const uint8_t *buffer)
+{
+  datagramTxStartNode(ch->link, ch->node, DG_RELIABLE_ACK);
+  datagramTxOut(ch->link, buffer, ACK_SIZE);
+  datagramTxEnd(ch->link);
+}
+
+bool reliableRxInput(DgReliable_t *ch, uint8_t node, const uint8_t *data, size_t size)
+{
+  DgReliableSlot_t *slot = NULL;
+  uint8_t header = 0, seq = 0, ahead = 0, ack[ACK_SIZE];
+  bool ackNow = false;
+
+  if(node != ch->node || size < 1)
+    return false;
+
+  header = data[0];
+
+  if(header == DG_RELIABLE_ACK) {
+    handleAck(ch, &data[1], size - 1);
+    return true;
+  }
+
+  if(!reliableEnabled(ch, header))
+    return false;
+
+  if(size < 2 || size - 2 > DG_RELIABLE_PAYLOAD)
+    // Malformed
+    return true;
+
+  seq = data[1];
+  ahead = SEQ_DIFF(seq, ch->rxNext);
+
+  channelObtain(ch);
+
+  if(ahead >= ch->window || SLOT(ch->rx, seq)->busy) {
+    // Behind the window the frame is a repeat of one delivered already,
+    // the acknowledgement must have been lost. Too far ahead it can't be
+    // buffered.
+
+    if((ackNow = ahead >= 0x80 || ahead < ch->window)) {
+      ch->duplicates++;
+      ackBuildUnsafe(ch, ack);
+    }
+
+    channelRelease(ch);
+
+    if(ackNow)
+      ackSend(ch, ack);
+    return true;
+  }
+
+  slot = SLOT(ch->rx, seq);
+  slot->header = header;
+  slot->size = size - 2;
+  memcpy(slot->data, &data[2], size - 2);
+  slot->busy = true;
+
+  // Out of order, let the sender know about the hole right away
+
+  ackNow = ahead > 0;
+
+  channelRelease(ch);
+
+  // Deliver what's in order. Only the receiving task touches the receive
+  // slots so the callback can run without the channel held.
+
+  while((slot = SLOT(ch->rx, ch->rxNext))->busy) {
+    if(ch->deliver)
+      (*ch->deliver)(ch->context, slot->header, slot->data, slot->size);
+
+    channelObtain(ch);
+    slot->busy = false;
+    ch->rxNext++;
+    ch->rxUnacked++;
+    ch->delivered++;
+    channelRelease(ch);
+  }
+
+  channelObtain(ch);
+
+  if((ackNow = ackNow || ch->rxUnacked >= DG_RELIABLE_ACK_EVERY))
+    ackBuildUnsafe(ch, ack);
+  else if(ch->rxUnacked > 0 && !ch->ackPending) {
+    ch->ackPending = true;
+    ch->ackSince = vpTimeMillis();
+  }
+
+  channelRelease(ch);
+
+  if(ackNow)
+    ackSend(ch, ack);
+
+  return true;
+}
+
+//
+// Timers
+//
+
+VP_TIME_MICROS_T reliableTick(DgReliable_t *ch)
+{
+  VP_TIME_MILLIS_T due = DG_RELIABLE_RTO_MAX;
+  bool expired = false, ackNow = false;
+  uint8_t seq = 0, ack[ACK_SIZE];
+
+  channelObtain(ch);
+
+  if(ch->ackPending) {
+    VP_TIME_MILLIS_T elapsed = VP_ELAPSED_MILLIS(ch->ackSince);
+
+    if((ackNow = elapsed >= DG_RELIABLE_ACK_DELAY))
+      ackBuildUnsafe(ch, ack);
+    else if(DG_RELIABLE_ACK_DELAY - elapsed < due)
+      due = DG_RELIABLE_ACK_DELAY - elapsed;
+  }
+
+  for(seq = ch->txBase; seq != ch->txNext; seq++) {
+    DgReliableSlot_t *slot = SLOT(ch->tx, seq);
+
+    if(slot->busy) {
+      VP_TIME_MILLIS_T elapsed = VP_ELAPSED_MILLIS(slot->sent);
+
+      if(elapsed >= ch->rto) {
+	transmit(ch, slot, seq);
+	expired = true;
+	elapsed = 0;
+      }
+
+      if(ch->rto - elapsed < due)
+	due = ch->rto - elapsed;
+    }
+  }
+
+  if(expired)
+    // Back off
+    ch->rto = 2*ch->rto < DG_RELIABLE_RTO_MAX ? 2*ch->rto : DG_RELIABLE_RTO_MAX;
+
+  channelRelease(ch);
+
+  if(ackNow)
+    ackSend(ch, ack);
+
+  return (VP_TIME_MICROS_T) due*1000;
+}
+
+void reliableStatus(DgReliable_t *ch, DgReliableStats_t *stats)
+{
+  channelObtain(ch);
+
+  stats->sent = ch->sent;
+  stats->retransmitted = ch->retransmitted;
+  stats->delivered = ch->delivered;
+  stats->duplicates = ch->duplicates;
+  stats->srtt = ch->srtt;
+  stats->rto = ch->rto;
+  stats->inFlight = SEQ_DIFF(ch->txNext, ch->txBase);
+
+  channelRelease(ch);
+}
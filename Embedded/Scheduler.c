@@ -2,13 +2,13 @@
 #include <string.h>
 #include <ctype.h>
 #include "Console.h"
+#include "Log.h"
 #include "StaP.h"
 #include "PRNG.h"
 #include "Scheduler.h"
 #include "FreeRTOS.h"
 #include "task.h"
 
-#define SERIAL_BLOCKSIZE   (1<<5)
 // #define STAP_TEST_TASK     1
 
 TaskHandle_t signalOwner[StaP_NumOfSignals];
@@ -59,6 +59,11 @@ void STAP_Panicf(uint8_t reason, const char *format, ...)
   
   STAP_FailSafe;
 
+  // Straight to the console rather than through the log layer: a panic
+  // prints whatever the module levels say, and the format comes with a
+  // va_list the LOG() macros can't take. The console skips its rate limits
+  // in fail safe mode.
+  
   while(1) {
     va_start(argp, format);
   
@@ -156,11 +161,30 @@ StaP_SignalSet_T STAP_SignalWait(StaP_SignalSet_T mask)
   return STAP_SignalWaitTimeout(mask, VP_TIME_MILLIS_MAX);
 }
 
+// Every console call asks for the calling task, each task keeps its own
+// declaration in a thread local storage slot (the last) when there's one
+// rather than have StaP_CurrentTask() search the task list
+
+#if configNUM_THREAD_LOCAL_STORAGE_POINTERS > 0
+#define STAP_TLS_TASK   (configNUM_THREAD_LOCAL_STORAGE_POINTERS - 1)
+#endif
+
+static void taskDeclSelf(struct TaskDecl *appTask)
+{
+#ifdef STAP_TLS_TASK
+  vTaskSetThreadLocalStoragePointer(NULL, STAP_TLS_TASK, (void*) appTask);
+#else
+  (void) appTask;
+#endif
+}
+
 static void periodTaskWrapper( void *pvParameters )
 {
   struct TaskDecl *appTask = (struct TaskDecl*) pvParameters;
   TickType_t activation = 0;
   
+  taskDeclSelf(appTask);
+  
   if(appTask->type != StaP_Task_Period)
     STAP_Panic(STAP_ERR_TASK_TYPE);
     
@@ -187,6 +211,8 @@ static void signalTaskWrapper( void *pvParameters )
 {
   struct TaskDecl *appTask = (struct TaskDecl*) pvParameters;
   
+  taskDeclSelf(appTask);
+  
   if(appTask->type != StaP_Task_Signal)
     STAP_Panic(STAP_ERR_TASK_TYPE);
     
@@ -217,6 +243,8 @@ static void serialTaskWrapper( void *pvParameters )
   
   VP_TIME_MICROS_T invokeAgain = 0;
   
+  taskDeclSelf(appTask);
+  
   if(appTask->type != StaP_Task_Serial && appTask->type != StaP_Task_Datagram)
     STAP_Panic(STAP_ERR_TASK_TYPE);
     
@@ -279,12 +307,20 @@ static void serialTaskWrapper( void *pvParameters )
     }
 
     if(appTask->type == StaP_Task_Datagram) {
-      char buffer[SERIAL_BLOCKSIZE];
+      // Decode straight out of the link ring, no intermediate copy
+
+      VPBufferSpan_t span[2];
+      VPBufferSize_t size = vpbuffer_peek(&StaP_LinkTable[link].buffer, span);
+      int i = 0;
 
-      datagramRxInputWithHandler(appTask->typeSpecific.datagram.state, 
-				 appTask->code.handler,
-				 (const uint8_t*) buffer,
-				 STAP_LinkGet(link, buffer, sizeof(buffer)));
+      for(i = 0; i < 2; i++)
+	if(span[i].size > 0)
+	  datagramRxInputWithHandler(appTask->typeSpecific.datagram.state, 
+				     appTask->code.handler,
+				     (const uint8_t*) span[i].data,
+				     span[i].size);
+
+      vpbuffer_consume(&StaP_LinkTable[link].buffer, size);
       
       invokeAgain = 0;
     } else
@@ -299,7 +335,7 @@ static void STAP_TestTask(void *params)
   for(;;) {
     (void) STAP_Status();
 
-    consolePrintfLn("micros = %U", vpTimeMicros());
+    LOG_NOTE(Scheduler, "micros = %U", vpTimeMicros());
     STAP_DelayMillis(100);
   } 
 } 
@@ -399,6 +435,27 @@ void StaP_SchedulerStart( void )
 	      STAP_MemoryFree());
 }
 
+struct TaskDecl *StaP_CurrentTask(void)
+{
+  if(!FreeRTOSUp)
+    return NULL;
+
+#ifdef STAP_TLS_TASK
+  return (struct TaskDecl*) pvTaskGetThreadLocalStoragePointer(NULL, STAP_TLS_TASK);
+#else
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+  int i = 0;
+  
+  while(i < StaP_NumOfTasks && StaP_TaskList[i].handle != self)
+    i++;
+
+  return i < StaP_NumOfTasks ? &StaP_TaskList[i] : NULL;
+#endif
+}
+
+// A status screen drawn on request, not a log record, so it isn't subject
+// to log levels or rate limits and stays on the console calls
+
 void StaP_SchedulerReport(void)
 {
   static VP_TIME_MICROS_T prev;
@@ -409,8 +466,8 @@ void StaP_SchedulerReport(void)
   consolePrintfLn("OS STATUS (CPU load %d%%) %u bytes free",
 		  (1000 - STAP_CPUIdlePermille())/10,
 		  STAP_MemoryFree());
-  consolePrintLn("Task           Stack   CPU");
-  consolePrintLn("---------------------------");
+  consolePrintLn("Task           Stack   CPU     Drop");
+  consolePrintLn("-----------------------------------");
 
   while(i < StaP_NumOfTasks) {
     if(StaP_TaskList[i].handle) {
@@ -422,10 +479,11 @@ void StaP_SchedulerReport(void)
 #else
         0;
 #endif
-      consolePrintfLn("%s %t%u %t %.1f%%",
+      consolePrintfLn("%s %t%u %t %.1f%% %t%U",
 		      StaP_TaskList[i].name,
 		      15, watermark,
-		      22, 100.0f * (float) (runtime - StaP_TaskList[i].runTime) / delta);
+		      22, 100.0f * (float) (runtime - StaP_TaskList[i].runTime) / delta,
+		      30, (unsigned long) consoleOverruns(i));
 
       StaP_TaskList[i].runTime = runtime;
     }
@@ -1,5 +1,6 @@
 #include "StaP.h"
 #include "Console.h"
+#include "Log.h"
 
 static StaP_ErrorStatus_T StaP_ErrorState;
 
@@ -63,9 +64,9 @@ StaP_ErrorStatus_T STAP_Status(void)
 	const char *text = STAP_ErrorDecode(i);
 
 	if(text)
-	  STAP_DEBUG(0, "StaP error %s", text);
+	  LOG_WARN(Scheduler, "StaP error %s", text);
 	else
-	  STAP_DEBUG(0, "StaP error (%d)", i);
+	  LOG_WARN(Scheduler, "StaP error (%d)", i);
       }
     }
   }
@@ -6,13 +6,62 @@
 #include "Datagram.h"
 
 extern DgLink_t *consoleLink;
-extern bool consoleThrottled, consoleDebug;
+extern bool consoleThrottled, consoleDebug, consoleBinary;
 extern uint8_t consoleDebugLevel;
 
+// Console link capacity in bytes per second, when set the console throttles
+// itself by the measured link utilization instead of consoleThrottled being
+// set by the application
+
+extern uint32_t consoleLinkCapacity;
+
+//
+// Binary logging (consoleBinary set): the formatted console calls send a
+// DG_CONSOLE_BINARY datagram holding this header followed by the arguments
+// packed with stringFmtPack(). The host looks the format string up in the
+// firmware image by its address, rebuilds the text with stringFmtUnpack()
+// and applies the prefix and newline given by the flags.
+//
+
+#define CONSOLE_BIN_PLAIN     0
+#define CONSOLE_BIN_NOTE      1      // "// " prefix
+#define CONSOLE_BIN_ERROR     2      // "!! " prefix
+#define CONSOLE_BIN_DEBUG     3      // "## " prefix
+#define CONSOLE_BIN_KIND      0x0F
+#define CONSOLE_BIN_NL        0x80   // Followed by a newline
+
+// Not sent: the format of a consolevLog() record is a string literal and
+// its compiled form may be cached (see vStringFmtSinkCached())
+
+#define CONSOLE_FMT_LITERAL   0x40
+
+struct ConsoleBinaryHeader {
+  uint32_t format;
+  uint8_t flags;
+  uint8_t _pad[3];
+};
+
+//
+// With binary logging consolePrintBlob() sends the bytes intact as
+// DG_CONSOLE_BLOB datagrams, each holding this header, the name (nameLen
+// bytes, not terminated) and the blob bytes from offset on. A blob larger
+// than a datagram is split, the host collects the segments by offset up to
+// the size and shows the result like the text form, bufferPrintHex() does
+// the conversion.
+//
+
+#define CONSOLE_BLOB_NAME_MAX  32
+
+struct ConsoleBlobHeader {
+  uint32_t size, offset;
+  uint8_t nameLen;
+  uint8_t _pad[3];
+};
+
 int bufferPrintUL(char *buf, int size, unsigned long v, uint8_t base, uint8_t p);
 int bufferPrintL(char *buf, int size, long v, uint8_t base, uint8_t p);
 
-void consoleOut(const char *b, int8_t s);
+void consoleOut(const char *b, int s);
 void consoleOutChar(char c);
 void consolePrintULGeneric(unsigned long v, uint8_t base, uint8_t p);
 void consoleAssert(bool, const char *);
@@ -64,7 +113,28 @@ void consolevPrintf(const char *s, va_list argp);
 void consolePrintf(const char *s, ...);
 void consolePrintfLn(const char *s, ...);
 void consoleDebugf(uint8_t level, const char *s, ...);
+
+// A whole record of the kind given by CONSOLE_BIN_* flags, prefixed and
+// terminated like the corresponding call above (debug records never block)
+
+void consolevLog(uint8_t flags, const char *f, va_list args);
 void consolePrintBlob(const char *name, const void *data, size_t size);
 
+//
+// Lock-free console staging: schedule consoleFlushTask() as a low priority
+// task in StaP_TaskList, e.g. PERIODIC_TASK("Console", 0, consoleFlushTask,
+// 0, 0), after which logging from the listed tasks never blocks. Output
+// that doesn't fit a task's ring is dropped, consoleOverruns() tells how
+// many times that happened for the task at the given StaP_TaskList index.
+//
+
+VP_TIME_MICROS_T consoleFlushTask(void);
+uint32_t consoleOverruns(int task);
+
+// Console transport totals: frames and payload bytes sent, and the last
+// measured link utilization in permille
+
+void consoleTransportStatus(uint32_t *frames, uint32_t *bytes, uint16_t *utilization);
+
 
 #endif
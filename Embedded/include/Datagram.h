@@ -11,12 +11,37 @@
 #define DG_TRANSMIT_MAX  (1<<9)
 #define DG_MAX_NODES     0x40
 
+// Worst case encoded size of a frame carrying a payload of n bytes: start,
+// sequence, header and CRC around the payload, every byte escaped, and a
+// break at both ends
+
+#define DG_FRAME_ENCODED_MAX(n)  (2*((n) + 5) + 4)
+#define DG_TX_STAGE_SIZE         DG_FRAME_ENCODED_MAX(DG_TRANSMIT_MAX)
+
+// COBS framing (datagramLinkSetCobs()) replaces the zero run escapes with
+// consistent overhead byte stuffing: a frame is the COBS encoding of the
+// same start, sequence, header, payload and CRC between zero delimiters.
+// The overhead is one byte per 254 plus the delimiters whatever the data,
+// so a frame carrying n bytes (header included) never encodes to more
+// than DG_COBS_ENCODED_SIZE(n) and a stage of that size holds it whole.
+// The mode needs a stage of at least DG_COBS_STAGE_MIN and both ends of
+// the link must use it.
+
+#define DG_COBS_ENCODED_SIZE(n)  ((n) + 4 + ((n) + 4)/254 + 1 + 2)
+#define DG_COBS_STAGE_MIN        0x100
+
 //
 // Generic DG types
 //
 
 #define DG_HEARTBEAT       0
 #define DG_CONSOLE         1
+#define DG_CONSOLE_BINARY  2
+#define DG_CONSOLE_BLOB    3
+#define DG_RELIABLE_ACK    4
+#define DG_FEC_PARITY      5
+#define DG_AGGREGATE       6
+#define DG_FLOW_CREDIT     7
 
 //
 // Application specific datagram type blocks
@@ -26,26 +51,238 @@
 #define DG_ALPHALINK       0x80
 #define DG_HOSTLINK        0xC0
 
+//
+// Queued transmission (optional, see datagramLinkSetTxQueue()). Frames are
+// built into buffers from a pool and queued by priority, the link mutex is
+// only held while a frame is being built. The transmitter of the link
+// calls datagramTxDrain(), which sends the queue in priority order
+// honoring minInterDelay and returns the microseconds until it wants to be
+// called again, so it can be the code of a zero period task. When the pool
+// runs out non-blocking starts fail (counted as refused) and blocking ones
+// drop the frame (counted as dropped), neither waits. Fail-safe mode
+// bypasses the queue.
+//
+
+#define DG_PRIO_CONTROL    0
+#define DG_PRIO_TELEMETRY  1
+#define DG_PRIO_CONSOLE    2
+#define DG_PRIORITIES      3
+
+#ifndef DG_TX_FRAME_SIZE
+#define DG_TX_FRAME_SIZE   (DG_TRANSMIT_MAX+1)
+#endif
+
+// Microseconds the transmitter sleeps with the queue empty
+
+#ifndef DG_TX_DRAIN_IDLE
+#define DG_TX_DRAIN_IDLE   2000
+#endif
+
+typedef struct DgTxFrame {
+  struct DgTxFrame *next;
+  VP_TIME_MILLIS_T queued;
+  uint16_t size;
+  uint8_t node, priority;
+  uint8_t data[DG_TX_FRAME_SIZE];   // Header byte and payload
+} DgTxFrame_t;
+
+typedef struct DgTxQueue {
+  DgTxFrame_t *pool;
+  DgTxFrame_t *head[DG_PRIORITIES], *tail[DG_PRIORITIES];
+  uint8_t (*priority)(uint8_t header);
+  uint16_t depth, depthMax;
+  uint32_t sent, dropped, refused;
+  uint32_t waitTotal[DG_PRIORITIES];
+  uint16_t waitCount[DG_PRIORITIES];
+  VP_TIME_MILLIS_T waitMax[DG_PRIORITIES];
+} DgTxQueue_t;
+
+// Queue totals, the maximum depth and the waits (milliseconds from the end
+// of a frame to it going out) are since the previous call
+
+typedef struct DgTxQueueStats {
+  uint16_t depth, depthMax;
+  uint32_t sent, dropped, refused;
+  VP_TIME_MILLIS_T waitAvg[DG_PRIORITIES], waitMax[DG_PRIORITIES];
+} DgTxQueueStats_t;
+
+//
+// Forward error correction (optional, see datagramLinkSetFec()). After
+// every group of K frames to the same node the sender adds a parity frame
+//
+//   DG_FEC_PARITY | first seq | K | length XOR (LE16) | payload XOR
+//
+// where the XORs run over the header and payload of the frames in the
+// group, zero padded to the longest. A receiver with the same K rebuilds
+// a frame of the group that was lost or failed its CRC from the parity
+// and the others and hands it to the handler, late but without a round
+// trip. Two losses in a group are beyond repair. The parity frame follows
+// the last of its group immediately, minInterDelay isn't applied to it.
+//
+
+#define DG_FEC_GROUP_MAX   16
+
+//
+// Flow control (optional, see datagramLinkSetFlow()). A receiver with a
+// window grants each node that sends to it credit in sequence number
+// space,
+//
+//   DG_FLOW_CREDIT | limit | fresh
+//
+// addressed to the node, limit being the first sequence number it may not
+// send yet. Grants go out whenever half the window has been received (so
+// the backlog of unprocessed datagrams never exceeds the window) and from
+// datagramFlowTick() every DG_FLOW_REFRESH, a lost one costs nothing and
+// one in an aggregate works as well. The refresh of a node not heard from
+// since the previous one is fresh (non-zero, the window): whatever the
+// node sent is processed or lost and it counts the window from its next
+// sequence number, a limit counted from what was received would stall it
+// for good after losing the last frames it sent.
+//
+// Grants never wait for the link, one that can't be sent right away is
+// retried from datagramFlowTick() every DG_FLOW_RETRY.
+//
+// A sender obeys the grants of a node once it has one and until it hasn't
+// heard a new one for DG_FLOW_EXPIRE, peers that don't grant aren't
+// limited. Out of credit a blocking start waits (DG_FLOW_STALL_MAX at
+// most, then sends anyway) and a non-blocking one fails, a transmit queue
+// skips ahead to frames for nodes with credit. A blocking start from the
+// receiving task (a handler answering) doesn't wait, the grant it would
+// wait for arrives through that task. Control priority frames are never
+// held back and broadcasts aren't flow controlled.
+//
+
+#ifndef DG_FLOW_REFRESH
+#define DG_FLOW_REFRESH    500
+#endif
+
+#ifndef DG_FLOW_EXPIRE
+#define DG_FLOW_EXPIRE     2000
+#endif
+
+#ifndef DG_FLOW_STALL_MAX
+#define DG_FLOW_STALL_MAX  200
+#endif
+
+// Microseconds the transmitter waits for credit with frames queued
+
+#ifndef DG_FLOW_RETRY
+#define DG_FLOW_RETRY      1000
+#endif
+
+#define DG_FLOW_WINDOW_MAX 0x7F
+
+// Flow control covers the nodes below this, the others aren't limited
+// and aren't granted credit. Every link keeps 8 bytes per node.
+
+#ifndef DG_FLOW_NODES
+#define DG_FLOW_NODES      8
+#endif
+
+//
+// Statistics. The link counters are monotonic and only ever wrap, a
+// snapshot copies them without disturbing anyone else and the difference
+// of two snapshots gives rates. The read-and-clear calls at the end keep
+// working from baselines of their own.
+//
+// Histograms of datagram inter-arrival time and transmit queue wait (per
+// destination node) are kept for the nodes below the count given to
+// datagramLinkSetHistograms(). Bin 0 counts zero milliseconds, bin i
+// [2^(i-1), 2^i) milliseconds and the last one everything above.
+//
+// Good and lost datagram counts are kept for the nodes below
+// DG_STATS_NODES, at 12 bytes per node in every link. Links with only a
+// few peers can do with less.
+//
+
+#ifndef DG_STATS_NODES
+#define DG_STATS_NODES     DG_MAX_NODES
+#endif
+
+#define DG_HISTOGRAM_BINS  12
+
+typedef struct DgHistogram {
+  uint32_t bin[DG_HISTOGRAM_BINS];
+} DgHistogram_t;
+
+typedef struct DgNodeHistograms {
+  VP_TIME_MILLIS_T lastArrival;
+  bool arrived;
+  DgHistogram_t arrival, txWait;
+} DgNodeHistograms_t;
+
+typedef struct DgLinkStats {
+  VP_TIME_MICROS_T taken;
+  uint32_t rxBytes, rxBytesRaw, txBytes, txBytesRaw;
+  uint32_t rxDatagrams, txDatagrams;
+  uint32_t crcErrors, overflows, badStarts, txErrors;
+  uint32_t fecRecovered, fecFailed;
+  uint32_t queueSent, queueDropped, queueRefused;
+  uint32_t flowStalls, flowTimeouts, flowGrantsSent, flowGrantsReceived;
+} DgLinkStats_t;
+
+typedef struct DgNodeStats {
+  uint32_t good, lost;
+  DgHistogram_t arrival, txWait;
+} DgNodeStats_t;
+
+// Per second between two snapshots, errors counting CRC, overflow, bad
+// start and transmit errors
+
+typedef struct DgLinkRates {
+  uint32_t rxBytes, rxBytesRaw, txBytes, txBytesRaw;
+  uint32_t rxDatagrams, txDatagrams, errors;
+} DgLinkRates_t;
+
 typedef struct DatagramLink {
-  bool initialized, txBusy, rxBusy, alive, overflow;
+  bool initialized, txBusy, rxBusy, alive, overflow, txQueued;
   uint8_t node;
   uint8_t flagCnt, rxNode;
   uint16_t crcStateTx, crcStateRx;
   uint16_t flagRunLength;
   size_t datagramSize;
+  bool rxHandling;
   uint8_t rxSeqLast[DG_MAX_NODES];
-  uint16_t datagramsGood[DG_MAX_NODES], datagramsLost[DG_MAX_NODES];
+  uint32_t datagramsGood[DG_STATS_NODES], datagramsLost[DG_STATS_NODES];
+  uint16_t legacyGood[DG_STATS_NODES], legacyLost[DG_STATS_NODES];
   uint8_t txSeq[DG_MAX_NODES];
-  uint16_t totalRxBytes, totalRxBytesRaw;
-  uint16_t totalTxBytes, totalTxBytesRaw;
-  uint16_t totalRxDatagrams, totalTxDatagrams;
+  uint32_t totalRxBytes, totalRxBytesRaw;
+  uint32_t totalTxBytes, totalTxBytesRaw;
+  uint32_t totalRxDatagrams, totalTxDatagrams;
+  uint32_t crcErrors, overflows, badStarts, txErrors;
+  uint16_t legacyRxBytesRaw, legacyTxBytesRaw, legacyRxDatagrams, legacyTxDatagrams;
+  DgNodeHistograms_t *histograms;
+  uint8_t histogramNodes;
   VP_TIME_MILLIS_T datagramLastTxMillis, datagramLastRxMillis;
   uint8_t *rxStore;
   size_t rxStoreSize;
+  uint8_t *txStage;
+  size_t txStageSize, txStageLen;
   void *context;
   VP_TIME_MILLIS_T minInterDelay;
+  DgTxQueue_t *txQueue;
+  DgTxFrame_t *txFrame;
+  uint8_t fecGroup;
+  uint8_t *fecTxStore, *fecRxStore;
+  size_t fecStoreSize;
+  bool fecCollect, fecParity, fecOversize, fecRxActive;
+  uint8_t fecTxNode, fecTxFirst, fecTxCount, fecRxNode, fecRxBase;
+  uint16_t fecTxLen, fecTxMax, fecTxLenXor, fecRxMax, fecRxLenXor;
+  uint32_t fecRxMask;
+  uint32_t fecRecovered, fecFailed;
+  uint16_t legacyRecovered, legacyFailed;
+  uint8_t flowWindow;
+  uint8_t flowTxLimit[DG_FLOW_NODES], flowRxLimit[DG_FLOW_NODES];
+  VP_TIME_MILLIS_T flowGranted[DG_FLOW_NODES], flowRefreshed;
+  VP_TIME_SECS_T flowGrantedSecs[DG_FLOW_NODES];
+  uint64_t flowLimited, flowRxSeen, flowRxHeard, flowGrantPending;
+  uint32_t flowStalls, flowTimeouts, flowGrantsSent, flowGrantsReceived;
+  bool cobs, cobsOpen, cobsStart, cobsZero, cobsDiscard;
+  uint8_t cobsCode, cobsRemain;
+  size_t cobsCodePos;
 #ifdef STAP_MutexCreate
   STAP_MutexRef_T mutex;
+  struct TaskDecl *rxTask;
 #endif
   void (*txBegin)(void*);
   void (*txEnd)(void*);
@@ -63,8 +300,42 @@ void datagramLinkInit(DgLink_t *link, uint8_t node,
 		      void (*txBegin)(void*),
 		      void (*txEnd)(void*));
 
+// Encode whole frames into a staging area and hand each to txOut in one
+// call at datagramTxEnd(), a stage of DG_TX_STAGE_SIZE never splits a frame
+
+void datagramLinkSetTxStage(DgLink_t*, uint8_t *stage, size_t size);
+bool datagramLinkSetCobs(DgLink_t*, bool enable);
+
+// Switch the link to queued transmission with a pool of count frames. The
+// priority of a frame is given by its header, the default puts heartbeats
+// first and console output last.
+
+void datagramLinkSetTxQueue(DgLink_t*, DgTxQueue_t *queue,
+			    DgTxFrame_t *frames, int count,
+			    uint8_t (*priority)(uint8_t header));
+VP_TIME_MICROS_T datagramTxDrain(DgLink_t*);
+
+// Parity over groups of the given number of frames (0 disables), the
+// stores hold the running XOR of the frames sent and received, frames
+// longer than that aren't protected
+
+void datagramLinkSetFec(DgLink_t*, uint8_t group, uint8_t *txStore, uint8_t *rxStore, size_t size);
+void datagramFecStatus(DgLink_t *link, uint16_t *recovered, uint16_t *failed);
+
+// Grant window (up to DG_FLOW_WINDOW_MAX) datagrams, 0 stops granting.
+// The tick returns the microseconds until it's due again.
+
+void datagramLinkSetFlow(DgLink_t*, uint8_t window);
+VP_TIME_MICROS_T datagramFlowTick(DgLink_t*);
+bool datagramFlowCredit(DgLink_t*, uint8_t node);
+void datagramTxQueueStatus(DgLink_t*, DgTxQueueStats_t *stats);
 bool datagramLinkAlive(DgLink_t*);
 // void datagramTxStartGeneric(DgLink_t*, uint8_t node);
+
+// The NB starts never wait: they fail where a blocking start would wait
+// for the link, credit or a pooled frame, and without a transmit queue
+// they skip the wait for minInterDelay since the last frame.
+
 void datagramTxStart(DgLink_t *link, uint8_t header);
 void datagramTxStartNode(DgLink_t*, uint8_t node, uint8_t header);
 bool datagramTxStartNB(DgLink_t *link, uint8_t header);
@@ -73,6 +344,48 @@ void datagramTxOutByte(DgLink_t*, const uint8_t c);
 void datagramTxOut(DgLink_t*, const uint8_t *data, size_t l);
 void datagramTxEnd(DgLink_t*);
 void datagramRxInput(DgLink_t*, const uint8_t *data, size_t s);
+
+//
+// Aggregation. A DG_AGGREGATE datagram carries small messages back to back
+// as
+//
+//   length | header | payload
+//
+// with the length counting the header and payload, and the receiving link
+// hands each to the handler as if it had come in a datagram of its own. A
+// batch collects messages for a node until the next one wouldn't fit its
+// buffer or the oldest has waited the latency budget, datagramBatchPoll()
+// sends an overdue batch and returns the microseconds until the next one
+// is due. A message too big for any batch is sent on its own, after the
+// batch collected so far. A batch belongs to a single task.
+//
+
+#define DG_AGGREGATE_MAX   0xFF
+
+typedef struct DgBatch {
+  DgLink_t *link;
+  uint8_t node;
+  uint8_t *buffer;
+  size_t size, len;
+  VP_TIME_MILLIS_T latency, since;
+  uint16_t messages, datagrams;
+} DgBatch_t;
+
+void datagramBatchInit(DgBatch_t*, DgLink_t *link, uint8_t node, uint8_t *buffer, size_t size, VP_TIME_MILLIS_T latency);
+void datagramBatchAdd(DgBatch_t*, uint8_t header, const uint8_t *data, size_t size);
+void datagramBatchFlush(DgBatch_t*);
+VP_TIME_MICROS_T datagramBatchPoll(DgBatch_t*);
+void datagramLinkSetHistograms(DgLink_t*, DgNodeHistograms_t *histograms, uint8_t nodes);
+void datagramLinkSnapshot(DgLink_t*, DgLinkStats_t *stats);
+void datagramNodeSnapshot(DgLink_t*, uint8_t node, DgNodeStats_t *stats);
+void datagramLinkRates(const DgLinkStats_t *prev, const DgLinkStats_t *cur, DgLinkRates_t *rates);
+
+// Send a snapshot to the host as DG_HOST_LINKSTATS (see HostLink.h)
+
+void datagramLinkStatsSend(DgLink_t *host, uint8_t id, DgLink_t *link);
+
+// Read-and-clear since the previous call
+
 void datagramRxStatus(DgLink_t *link, uint8_t node, uint16_t *totalBuf, uint16_t *lostBuf);
 void datagramLinkStatus(DgLink_t *link, uint16_t *totalRxBytesBuf, uint16_t *totalTxBytesBuf, uint16_t *totalRxDgBuf, uint16_t *totalTxDgBuf);
 void datagramRxInputWithHandler(DgLink_t *link, void (*handler)(void*, uint8_t node, const uint8_t *data, size_t size), const uint8_t *buffer, size_t size);
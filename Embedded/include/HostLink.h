@@ -13,6 +13,7 @@
 #define DG_HOST_PONG          (DG_HOSTLINK+7)
 #define DG_HOST_LOGNAME       (DG_HOSTLINK+8)
 #define DG_HOST_LOGTXT        (DG_HOSTLINK+9)
+#define DG_HOST_LINKSTATS     (DG_HOSTLINK+10)
 
 struct SimLinkSensor {
   float alpha, alt, ias;
@@ -25,5 +26,14 @@ struct SimLinkControl {
   float aileron, elevator, throttle, rudder;
 };
 
+// Link statistics snapshot, the host derives the rates from consecutive
+// ones
+
+struct HostLinkStats {
+  uint8_t link;
+  uint8_t _pad[3];
+  DgLinkStats_t stats;
+};
+
 #endif
 
@@ -0,0 +1,148 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <stdarg.h>
+#include "StaP.h"
+
+//
+// Leveled logging by module. A call is compiled out entirely when its
+// level is above the compile time maximum of the module (LOG_MAX_<module>,
+// LOG_MAX_DEFAULT unless set) and otherwise the runtime level of the module
+// is checked before any of the arguments are evaluated.
+//
+//   LOG_NOTE(NVStore, "NVStore %s MOUNTED", p->name);
+//
+// Errors print like consoleErrorLn(), warnings and notes like
+// consoleNotefLn() and debug and trace records like consoleDebugf().
+//
+// Every call site also has a token bucket of LOG_BURST records refilled at
+// one per LOG_REFILL_MILLIS. A record beyond that is dropped before its
+// arguments are evaluated and counted, the count goes out as "N similar
+// messages suppressed" ahead of the next record the site gets through or
+// from logSuppressedReport() at most every LOG_REPORT_MILLIS, whichever
+// comes first. The console flusher task calls logSuppressedReport().
+//
+// consoleNotef(), consoleNotefLn(), consoleError() and consoleErrorLn()
+// called directly have no site of their own, logConsoleAdmit() gives them
+// one of LOG_CONSOLE_SITES buckets by the address of the format. Their
+// summaries leave the format out as it needn't be a literal.
+//
+
+#define LOG_LEVEL_NONE      0
+#define LOG_LEVEL_ERROR     1
+#define LOG_LEVEL_WARN      2
+#define LOG_LEVEL_NOTE      3
+#define LOG_LEVEL_DEBUG     4
+#define LOG_LEVEL_TRACE     5
+
+typedef enum {
+  Log_App,
+  Log_NVStore,
+  Log_Datagram,
+  Log_I2C,
+  Log_Scheduler,
+  Log_NumOfModules
+} LogModule_t;
+
+// Runtime level of a module until set otherwise
+
+#ifndef LOG_DEFAULT_LEVEL
+#define LOG_DEFAULT_LEVEL   LOG_LEVEL_NOTE
+#endif
+
+#ifndef LOG_MAX_DEFAULT
+#define LOG_MAX_DEFAULT     LOG_LEVEL_DEBUG
+#endif
+
+#ifndef LOG_MAX_App
+#define LOG_MAX_App         LOG_MAX_DEFAULT
+#endif
+#ifndef LOG_MAX_NVStore
+#define LOG_MAX_NVStore     LOG_MAX_DEFAULT
+#endif
+#ifndef LOG_MAX_Datagram
+#ifdef DG_DEBUG
+#define LOG_MAX_Datagram    LOG_LEVEL_TRACE
+#else
+#define LOG_MAX_Datagram    LOG_MAX_DEFAULT
+#endif
+#endif
+#ifndef LOG_MAX_I2C
+#define LOG_MAX_I2C         LOG_MAX_DEFAULT
+#endif
+#ifndef LOG_MAX_Scheduler
+#define LOG_MAX_Scheduler   LOG_MAX_DEFAULT
+#endif
+
+#ifndef LOG_BURST
+#define LOG_BURST           5
+#endif
+
+#ifndef LOG_REFILL_MILLIS
+#define LOG_REFILL_MILLIS   1000
+#endif
+
+#ifndef LOG_REPORT_MILLIS
+#define LOG_REPORT_MILLIS   5000
+#endif
+
+#ifndef LOG_CONSOLE_SITES
+#define LOG_CONSOLE_SITES   8
+#endif
+
+typedef struct LogSite {
+  struct LogSite *next;
+  const char *format;
+  VP_TIME_MILLIS_T refilled;
+  VP_TIME_SECS_T refilledSecs;
+  uint16_t suppressed;
+  uint8_t tokens, level;
+  unsigned module : 6;
+  bool listed : 1, shared : 1;
+} LogSite_t;
+
+bool logSiteAdmit(LogSite_t *site, const char *format);
+bool logConsoleAdmit(uint8_t level, const char *format);
+void logSuppressedReport(void);
+
+// The table holds the level plus one, zero means LOG_DEFAULT_LEVEL
+
+extern uint8_t logLevelTable[Log_NumOfModules];
+
+static inline uint8_t logLevelOf(LogModule_t module)
+{
+  uint8_t value = logLevelTable[module];
+  return value ? value - 1 : LOG_DEFAULT_LEVEL;
+}
+
+void logLevelSet(LogModule_t module, uint8_t level);
+
+// The format of logPrintf() must be a string literal like the ones the
+// LOG() macros take
+
+void logPrintf(LogModule_t module, uint8_t level, const char *f, ...);
+
+#define LOG_ENABLED(mod, level)						\
+  ((level) <= LOG_MAX_##mod && (level) <= logLevelOf(Log_##mod))
+
+#define LOG_FORMAT_(f, ...)  f
+#define LOG_FORMAT(...)      LOG_FORMAT_(__VA_ARGS__, 0)
+
+// The "" makes sure the format is a string literal, the console caches
+// its compiled form by address
+
+#define LOG(mod, lvl, ...)						\
+  do {									\
+    static LogSite_t logSite_ = { .module = Log_##mod, .level = lvl };	\
+    if(LOG_ENABLED(mod, lvl) && logSiteAdmit(&logSite_, "" LOG_FORMAT(__VA_ARGS__))) \
+      logPrintf(Log_##mod, lvl, __VA_ARGS__);				\
+  } while(0)
+
+#define LOG_ERR(mod, ...)    LOG(mod, LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(mod, ...)   LOG(mod, LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_NOTE(mod, ...)   LOG(mod, LOG_LEVEL_NOTE, __VA_ARGS__)
+#define LOG_DEBUG(mod, ...)  LOG(mod, LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_TRACE(mod, ...)  LOG(mod, LOG_LEVEL_TRACE, __VA_ARGS__)
+
+#endif
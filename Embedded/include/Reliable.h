@@ -0,0 +1,116 @@
+#ifndef RELIABLE_H
+#define RELIABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "Datagram.h"
+
+//
+// Selective repeat ARQ between a link and one of its nodes, for the
+// datagram types enabled with reliableEnable(). A reliable datagram has
+// its own sequence number after the header byte,
+//
+//   header | seq | payload
+//
+// and the receiver answers with DG_RELIABLE_ACK datagrams holding the next
+// sequence number it expects followed by a bitmap (LSB first, little
+// endian) of the frames it has buffered beyond that,
+//
+//   DG_RELIABLE_ACK | next | sack[4]
+//
+// Out of order and duplicate frames are acknowledged immediately, so a
+// hole in the bitmap works as a NACK and the sender repeats just the
+// missing frames. Everything else is acknowledged every
+// DG_RELIABLE_ACK_EVERY frames or after DG_RELIABLE_ACK_DELAY. Unanswered
+// frames are repeated after a timeout derived from the measured round trip
+// time (SRTT + 4 RTTVAR, Karn's rule, doubled on every expiry).
+//
+// Frames are handed to the deliver callback in order, once. The
+// application passes everything it receives from the node through
+// reliableRxInput() first and calls reliableTick() periodically, it
+// returns the microseconds until the next timer is due.
+//
+// Frames are sent holding the channel's mutex, so the channel comes before
+// the link in the lock order. Nothing is called with the link held that
+// would take the channel. The deliver callback runs without the channel
+// held, and acknowledgements are sent after it's released.
+//
+
+#ifndef DG_RELIABLE_PAYLOAD
+#define DG_RELIABLE_PAYLOAD    (1<<7)
+#endif
+
+#define DG_RELIABLE_WINDOW_MAX  32
+
+#ifndef DG_RELIABLE_RTO_INITIAL
+#define DG_RELIABLE_RTO_INITIAL 300
+#endif
+
+#ifndef DG_RELIABLE_RTO_MIN
+#define DG_RELIABLE_RTO_MIN     20
+#endif
+
+#ifndef DG_RELIABLE_RTO_MAX
+#define DG_RELIABLE_RTO_MAX     3000
+#endif
+
+#ifndef DG_RELIABLE_ACK_EVERY
+#define DG_RELIABLE_ACK_EVERY   2
+#endif
+
+#ifndef DG_RELIABLE_ACK_DELAY
+#define DG_RELIABLE_ACK_DELAY   10
+#endif
+
+typedef struct DgReliableSlot {
+  VP_TIME_MILLIS_T sent;
+  uint16_t size;
+  uint8_t header, transmissions;
+  bool busy;
+  uint8_t data[DG_RELIABLE_PAYLOAD];
+} DgReliableSlot_t;
+
+typedef struct DgReliableStats {
+  uint32_t sent, retransmitted, delivered, duplicates;
+  VP_TIME_MILLIS_T srtt, rto;
+  uint8_t inFlight;
+} DgReliableStats_t;
+
+typedef struct DgReliable {
+  DgLink_t *link;
+  uint8_t node, window;
+  uint8_t types[256/8];
+  DgReliableSlot_t *tx, *rx;
+  uint8_t txBase, txNext, rxNext, rxUnacked;
+  bool ackPending;
+  VP_TIME_MILLIS_T ackSince;
+  VP_TIME_MILLIS_T srtt, rttvar, rto;
+  uint32_t sent, retransmitted, delivered, duplicates;
+  void *context;
+  void (*deliver)(void *context, uint8_t header, const uint8_t *data, size_t size);
+#ifdef STAP_MutexCreate
+  STAP_MutexRef_T mutex;
+#endif
+} DgReliable_t;
+
+// The slot arrays hold window (at most DG_RELIABLE_WINDOW_MAX) entries
+// each, the window must be a power of two
+
+void reliableInit(DgReliable_t*, DgLink_t *link, uint8_t node,
+		  DgReliableSlot_t *tx, DgReliableSlot_t *rx, uint8_t window,
+		  void *context,
+		  void (*deliver)(void*, uint8_t header, const uint8_t *data, size_t size));
+void reliableEnable(DgReliable_t*, uint8_t header);
+
+// False if the window is full (or the payload too big), try again later
+
+bool reliableSend(DgReliable_t*, uint8_t header, const uint8_t *data, size_t size);
+
+// True if the datagram belonged to the channel and was taken care of
+
+bool reliableRxInput(DgReliable_t*, uint8_t node, const uint8_t *data, size_t size);
+VP_TIME_MICROS_T reliableTick(DgReliable_t*);
+void reliableStatus(DgReliable_t*, DgReliableStats_t *stats);
+
+#endif
@@ -102,6 +102,5 @@ extern const int StaP_NumOfTasks;
 void StaP_SchedulerInit( void );
 void StaP_SchedulerStart( void );
 void StaP_SchedulerReport(void);
-struct TaskDecl *StaP_CurrentTask(void);
 
 #endif
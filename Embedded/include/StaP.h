@@ -105,6 +105,7 @@ size_t STAP_MemoryFree(void);
 void STAP_DelayMillis(uint16_t);
 void STAP_SchedulerReport(void);
 uint8_t STAP_CPUIdlePercent(void);
+struct TaskDecl *StaP_CurrentTask(void);
 
 //
 // Serial link definition
@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Datagram.h"
+
+//
+// Wire cost and latency of a typical telemetry mix sent one datagram per
+// message and collected in DG_AGGREGATE batches, with both framings.
+// Every message carries a sequence number, the receiver looks up when it
+// was queued to measure the latency the batching adds and checks that the
+// messages arrive in the order they were queued, also when one too big
+// for a batch goes out on its own.
+//
+//   AggregateBench [seconds [batch [latency]]]
+//
+
+#define BENCH_SEQ_MAX   0x10000
+
+typedef struct BenchStream {
+  const char *name;
+  uint8_t header;
+  uint16_t hz;
+  size_t size;
+} BenchStream_t;
+
+static const BenchStream_t streams[] = {
+  { "attitude", DG_TELEMLINK, 50, 6 },
+  { "air data", DG_TELEMLINK+1, 20, 4 },
+  { "IMU", DG_TELEMLINK+2, 50, 24 },
+  { "position", DG_TELEMLINK+3, 10, 24 },
+  { "status", DG_TELEMLINK+4, 5, 8 },
+  { "parameters", DG_TELEMLINK+5, 1, 40 },
+  { "snapshot", DG_TELEMLINK+6, 2, 160 }
+};
+
+#define STREAMS (sizeof(streams)/sizeof(streams[0]))
+
+static DgLink_t tx, rx;
+static VP_TIME_JIFFIES_T queued[BENCH_SEQ_MAX];
+static uint32_t received, reordered;
+static uint16_t nextSeq;
+static uint64_t latencySum;
+static VP_TIME_JIFFIES_T latencyMax;
+
+static void loopback(void *context, const uint8_t *data, size_t size)
+{
+  (void) context;
+  
+  datagramRxInput(&rx, data, size);
+}
+
+static void discard(void *context, const uint8_t *data, size_t size)
+{
+  (void) context;
+  (void) data;
+  (void) size;
+}
+
+static void receive(void *context, uint8_t node, const uint8_t *data, size_t size)
+{
+  VP_TIME_JIFFIES_T latency = 0;
+  uint16_t seq = 0;
+  
+  (void) context;
+  (void) node;
+
+  if(size < 1 + sizeof(seq))
+    return;
+
+  memcpy(&seq, &data[1], sizeof(seq));
+  latency = STAP_TimeJiffies() - queued[seq];
+
+  if(seq != nextSeq)
+    reordered++;
+
+  nextSeq = seq + 1;
+  
+  latencySum += latency;
+
+  if(latency > latencyMax)
+    latencyMax = latency;
+  
+  received++;
+}
+
+static void run(uint32_t seconds, size_t batchSize, VP_TIME_MILLIS_T budget, bool cobs)
+{
+  static uint8_t txRxStore[DG_TRANSMIT_MAX+0x40], rxStore[DG_TRANSMIT_MAX+0x40];
+  static uint8_t txStage[DG_TX_STAGE_SIZE], rxStage[DG_TX_STAGE_SIZE];
+  static uint8_t buffer[DG_TRANSMIT_MAX];
+  uint8_t data[DG_TRANSMIT_MAX];
+  DgLinkStats_t stats;
+  DgBatch_t batch;
+  uint32_t millis = 0, messages = 0;
+  uint64_t payload = 0;
+  uint16_t seq = 0;
+  size_t i = 0, j = 0;
+  
+  datagramLinkInit(&tx, 0, txRxStore, sizeof(txRxStore), NULL, NULL, NULL,
+		   loopback, NULL, NULL);
+  datagramLinkSetTxStage(&tx, txStage, sizeof(txStage));
+  datagramLinkSetCobs(&tx, cobs);
+  datagramLinkInit(&rx, 0, rxStore, sizeof(rxStore), NULL, receive, NULL,
+		   discard, NULL, NULL);
+  datagramLinkSetTxStage(&rx, rxStage, sizeof(rxStage));
+  datagramLinkSetCobs(&rx, cobs);
+
+  if(batchSize > 0)
+    datagramBatchInit(&batch, &tx, 0, buffer, batchSize, budget);
+
+  received = reordered = 0;
+  nextSeq = 0;
+  latencySum = 0;
+  latencyMax = 0;
+
+  for(millis = 0; millis < seconds*1000; millis++) {
+    for(i = 0; i < STREAMS; i++) {
+      if(millis % (1000 / streams[i].hz) != 0)
+	continue;
+      
+      for(j = 0; j < streams[i].size; j++)
+	data[j] = 1 + rand() % 60;
+
+      memcpy(data, &seq, sizeof(seq));
+      queued[seq++] = STAP_TimeJiffies();
+      
+      if(batchSize > 0)
+	datagramBatchAdd(&batch, streams[i].header, data, streams[i].size);
+      else {
+	datagramTxStart(&tx, streams[i].header);
+	datagramTxOut(&tx, data, streams[i].size);
+	datagramTxEnd(&tx);
+      }
+
+      messages++;
+      payload += streams[i].size + 1;
+    }
+    
+    if(batchSize > 0)
+      datagramBatchPoll(&batch);
+    
+    hostTimeAdvance(1000);
+  }
+
+  if(batchSize > 0)
+    datagramBatchFlush(&batch);
+
+  datagramLinkSnapshot(&tx, &stats);
+  
+  printf("%-9s %-6s %6u %6u %7.1f %7.1f %7.1f %7.1f %s%s\n",
+	 batchSize > 0 ? "batched" : "single", cobs ? "COBS" : "escape",
+	 (unsigned) messages, (unsigned) stats.txDatagrams,
+	 (double) stats.txBytesRaw / messages, (double) payload / messages,
+	 (double) latencySum / (received ? received : 1) / 1000,
+	 (double) latencyMax / 1000, received != messages ? "LOSS " : "",
+	 reordered > 0 ? "ORDER" : "");
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t seconds = argc > 1 ? atoi(argv[1]) : 10;
+  size_t batchSize = argc > 2 ? atoi(argv[2]) : 128;
+  VP_TIME_MILLIS_T budget = argc > 3 ? atoi(argv[3]) : 20;
+
+  if(seconds*1000 > BENCH_SEQ_MAX)
+    seconds = BENCH_SEQ_MAX/1000;
+
+  srand(1);
+  
+  // Frames sent after a pause start with a break, let there be one
+  
+  hostTimeAdvance(1000000);
+  
+  printf("%u s of telemetry, %u byte batches, %u ms budget\n",
+	 (unsigned) seconds, (unsigned) batchSize, (unsigned) budget);
+  printf("%-9s %-6s %6s %6s %7s %7s %7s %7s\n", "", "mode", "msgs", "frames",
+	 "B/msg", "payload", "mean ms", "max ms");
+  
+  run(seconds, 0, budget, false);
+  run(seconds, 0, budget, true);
+  run(seconds, batchSize, budget, false);
+  run(seconds, batchSize, budget, true);
+  
+  return 0;
+}
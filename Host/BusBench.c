@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "BusSim.h"
+#include "AlphaLink.h"
+
+//
+// AlphaLink bus with a master and a growing number of sensor nodes, each
+// taking samples at the same rate. The nodes either answer the master's
+// round robin queries with their latest sample or send every sample as
+// soon as it's taken, with and without carrier sense. The latency is the
+// age of a sample when it arrives at the master.
+//
+//   BusBench [rate [payload [seconds]]]
+//
+
+#define BENCH_TIMEOUT   5000    // us, a query without an answer
+#define BENCH_TURN      100     // us, node task period
+
+typedef struct BenchNode {
+  VP_TIME_MICROS_T period;
+  VP_TIME_JIFFIES_T nextSample, sampled;
+  bool queried;
+} BenchNode_t;
+
+typedef struct BenchResult {
+  uint32_t samples, answers, timeouts;
+  uint64_t ageTotal;
+  VP_TIME_MICROS_T ageMax;
+} BenchResult_t;
+
+static BusSimNode_t simNode[BUS_SIM_NODES_MAX];
+static BenchNode_t benchNode[BUS_SIM_NODES_MAX];
+static BenchResult_t result;
+static bool polled;
+static int nodes;
+static size_t payload;
+static uint32_t random32;
+
+// Master state
+
+static int pollNext, pollOutstanding;
+static VP_TIME_JIFFIES_T pollAsked, pollDue;
+static VP_TIME_MICROS_T pollInterval;
+
+static uint32_t nextRandom(void)
+{
+  // xorshift32
+
+  random32 ^= random32 << 13;
+  random32 ^= random32 >> 17;
+  random32 ^= random32 << 5;
+
+  return random32;
+}
+
+static void sendSample(BusSimNode_t *node, BenchNode_t *bench)
+{
+  uint8_t data[DG_TRANSMIT_MAX];
+  uint32_t sampled = (uint32_t) bench->sampled;
+
+  memset(data, 0x55, payload);
+  memcpy(data, &sampled, sizeof(sampled));
+
+  datagramTxStart(&node->link, DG_ALPHA_RESPONSE);
+  datagramTxOut(&node->link, data, payload);
+  datagramTxEnd(&node->link);
+}
+
+static void nodeReceive(void *context, uint8_t node, const uint8_t *data, size_t size)
+{
+  BusSimNode_t *self = (BusSimNode_t*) context;
+
+  (void) size;
+
+  if(node == self->link.node && data[0] == DG_ALPHA_QUERY)
+    benchNode[self - simNode].queried = true;
+}
+
+static VP_TIME_MICROS_T nodeTask(BusSimNode_t *node, void *context)
+{
+  BenchNode_t *bench = (BenchNode_t*) context;
+  VP_TIME_JIFFIES_T now = STAP_TimeJiffies();
+
+  if(now >= bench->nextSample) {
+    bench->sampled = now;
+    bench->nextSample += bench->period;
+    result.samples++;
+
+    if(!polled)
+      sendSample(node, bench);
+  }
+
+  if(bench->queried) {
+    bench->queried = false;
+    sendSample(node, bench);
+  }
+
+  return BENCH_TURN;
+}
+
+static void masterReceive(void *context, uint8_t node, const uint8_t *data, size_t size)
+{
+  VP_TIME_MICROS_T age = 0;
+  uint32_t sampled = 0;
+
+  (void) context;
+
+  if(data[0] != DG_ALPHA_RESPONSE || size != payload + 1)
+    return;
+
+  memcpy(&sampled, &data[1], sizeof(sampled));
+  age = (uint32_t) STAP_TimeJiffies() - sampled;
+
+  result.answers++;
+  result.ageTotal += age;
+
+  if(age > result.ageMax)
+    result.ageMax = age;
+
+  if(polled && node == pollOutstanding)
+    pollOutstanding = 0;
+}
+
+static VP_TIME_MICROS_T masterTask(BusSimNode_t *node, void *context)
+{
+  VP_TIME_JIFFIES_T now = STAP_TimeJiffies();
+  uint8_t query[sizeof(struct ALQueryHeader)];
+
+  (void) context;
+
+  if(!polled)
+    return 1000000;
+
+  if(pollOutstanding) {
+    if(now - pollAsked < BENCH_TIMEOUT)
+      return BENCH_TURN;
+
+    result.timeouts++;
+    pollOutstanding = 0;
+  }
+
+  if(now < pollDue)
+    return BENCH_TURN;
+
+  // Round robin at the rate the nodes sample, a late answer pushes the
+  // rest of the round back
+
+  pollOutstanding = 1 + pollNext;
+  pollNext = (pollNext + 1) % nodes;
+  pollAsked = now;
+  pollDue = (pollDue + pollInterval > now ? pollDue : now) + pollInterval;
+
+  memset(query, '\0', sizeof(query));
+  datagramTxStartNode(&node->link, pollOutstanding, DG_ALPHA_QUERY);
+  datagramTxOut(&node->link, query, sizeof(query));
+  datagramTxEnd(&node->link);
+
+  return BENCH_TURN;
+}
+
+static void run(int count, bool poll, bool carrierSense, uint32_t rate,
+		VP_TIME_MICROS_T duration)
+{
+  static BusSimNode_t master;
+  DgLinkStats_t stats;
+  BusSim_t bus;
+  uint64_t collided = 0, frames = 0;
+  int i = 0;
+
+  memset((void*) &result, '\0', sizeof(result));
+  nodes = count;
+  polled = poll;
+  pollNext = pollOutstanding = 0;
+  pollInterval = 1000000 / rate / count;
+
+  // Every node has a sample by the first query, the phases are the same
+  // for every scheme
+  
+  pollAsked = STAP_TimeJiffies();
+  pollDue = pollAsked + 1000000 / rate;
+  random32 = 1;
+
+  busSimInit(&bus, AL_BITRATE, carrierSense);
+  busSimNodeAdd(&bus, &master, 0, NULL, masterReceive, masterTask);
+
+  for(i = 0; i < count; i++) {
+    benchNode[i].period = 1000000 / rate;
+    benchNode[i].nextSample = STAP_TimeJiffies() + nextRandom() % benchNode[i].period;
+    benchNode[i].queried = false;
+    busSimNodeAdd(&bus, &simNode[i], 1 + i, &benchNode[i], nodeReceive, nodeTask);
+  }
+
+  busSimRun(&bus, duration);
+
+  for(i = 0; i < count; i++) {
+    frames += simNode[i].frames;
+    collided += simNode[i].collisions;
+  }
+
+  datagramLinkSnapshot(&master.link, &stats);
+
+  printf("%5d %-8s %-3s %6.1f%% %7.1f%% %8u %8u %6u %6u %9.0f %9u\n",
+	 count, poll ? "polled" : "periodic", carrierSense ? "yes" : "no",
+	 100.0 * bus.busy / (bus.slots ? bus.slots : 1),
+	 frames ? 100.0 * collided / frames : 0.0,
+	 (unsigned) result.samples, (unsigned) result.answers,
+	 (unsigned) result.timeouts, (unsigned) stats.crcErrors,
+	 result.answers ? (double) result.ageTotal / result.answers : 0.0,
+	 (unsigned) result.ageMax);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t rate = argc > 1 ? atoi(argv[1]) : 10;
+  VP_TIME_MICROS_T duration = 1000000UL * (argc > 3 ? atoi(argv[3]) : 5);
+  const int counts[] = { 4, 8, 16, 32 };
+  size_t i = 0;
+  int mode = 0;
+
+  payload = argc > 2 ? atoi(argv[2]) : 16;
+
+  if(payload < sizeof(uint32_t))
+    payload = sizeof(uint32_t);
+  else if(payload > DG_TRANSMIT_MAX)
+    payload = DG_TRANSMIT_MAX;
+
+  printf("%u Hz samples of %u bytes, %u bps, %.0f s\n",
+	 (unsigned) rate, (unsigned) payload, (unsigned) AL_BITRATE, duration / 1e6);
+  printf("%5s %-8s %-3s %7s %8s %8s %8s %6s %6s %9s %9s\n", "nodes", "scheme", "CS",
+	 "busy", "collided", "samples", "answers", "t/o", "CRC", "age us", "max us");
+
+  for(i = 0; i < sizeof(counts)/sizeof(counts[0]); i++) {
+    for(mode = 0; mode < 4; mode++)
+      run(counts[i], mode < 2, mode & 1, rate, duration);
+  }
+
+  return 0;
+}
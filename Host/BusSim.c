@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <string.h>
+#include "BusSim.h"
+
+static VP_TIME_JIFFIES_T busSimTime(BusSim_t *bus, uint64_t slot)
+{
+  // Ten bit times per byte, computed from the start so nothing drifts
+  
+  return bus->start + slot * 10 * 1000000UL / bus->bitrate;
+}
+
+static void busSimBegin(void *context)
+{
+  BusSimNode_t *node = (BusSimNode_t*) context;
+
+  node->queued = STAP_TimeJiffies();
+}
+
+static void busSimOut(void *context, const uint8_t *data, size_t size)
+{
+  BusSimNode_t *node = (BusSimNode_t*) context;
+
+  while(size-- > 0) {
+    if(node->txIn - node->txOut < BUS_SIM_TX_SIZE)
+      node->txData[node->txIn++ % BUS_SIM_TX_SIZE] = *data;
+    else
+      node->overflows++;
+
+    data++;
+  }
+}
+
+static void busSimEnd(void *context)
+{
+  BusSimNode_t *node = (BusSimNode_t*) context;
+  BusSimFrame_t *frame = NULL;
+
+  if(node->frameCount == BUS_SIM_FRAMES) {
+    // Latency no longer tracked for this one
+
+    node->overflows++;
+    return;
+  }
+  
+  frame = &node->frame[(node->frameHead + node->frameCount++) % BUS_SIM_FRAMES];
+  frame->end = node->txIn;
+  frame->queued = node->queued;
+}
+
+void busSimInit(BusSim_t *bus, uint32_t bitrate, bool carrierSense)
+{
+  memset((void*) bus, '\0', sizeof(BusSim_t));
+
+  bus->bitrate = bitrate > 0 ? bitrate : AL_BITRATE;
+  bus->carrierSense = carrierSense;
+  bus->start = STAP_TimeJiffies();
+}
+
+bool busSimNodeAdd(BusSim_t *bus, BusSimNode_t *node, uint8_t address, void *context,
+		   void (*rxHandler)(void*, uint8_t node, const uint8_t *data, size_t size),
+		   VP_TIME_MICROS_T (*task)(BusSimNode_t*, void *context))
+{
+  if(bus->nodes >= BUS_SIM_NODES_MAX || address >= DG_MAX_NODES)
+    return false;
+
+  memset((void*) node, '\0', sizeof(BusSimNode_t));
+
+  node->bus = bus;
+  node->context = context;
+  node->task = task;
+  node->wake = STAP_TimeJiffies();
+
+  datagramLinkInit(&node->link, address, node->rxStore, sizeof(node->rxStore),
+		   node, rxHandler, NULL, busSimOut, busSimBegin, busSimEnd);
+  datagramLinkSetTxStage(&node->link, node->txStage, sizeof(node->txStage));
+
+  bus->node[bus->nodes++] = node;
+  
+  return true;
+}
+
+static void busSimFrameDone(BusSimNode_t *node, VP_TIME_JIFFIES_T now)
+{
+  BusSimFrame_t *frame = &node->frame[node->frameHead];
+  VP_TIME_MICROS_T latency = (VP_TIME_MICROS_T) (now - frame->queued);
+  
+  node->frames++;
+  node->latencyTotal += latency;
+
+  if(latency > node->latencyMax)
+    node->latencyMax = latency;
+
+  if(node->collided)
+    node->collisions++;
+  
+  node->frameHead = (node->frameHead + 1) % BUS_SIM_FRAMES;
+  node->frameCount--;
+  node->sending = node->collided = false;
+}
+
+static void busSimSlot(BusSim_t *bus, VP_TIME_JIFFIES_T now, VP_TIME_JIFFIES_T next)
+{
+  BusSimNode_t *sender[BUS_SIM_NODES_MAX];
+  uint8_t senders = 0, value = 0xFF;
+  int i = 0;
+
+  for(i = 0; i < bus->nodes; i++) {
+    BusSimNode_t *node = bus->node[i];
+
+    if(node->wake <= now && node->task) {
+      VP_TIME_MICROS_T delay = (*node->task)(node, node->context);
+      node->wake = now + (delay > 0 ? delay : 1);
+    }
+  }
+
+  for(i = 0; i < bus->nodes; i++) {
+    BusSimNode_t *node = bus->node[i];
+
+    if(node->txIn == node->txOut
+       || (!node->sending && bus->carrierSense && bus->busyLast))
+      continue;
+
+    value &= node->txData[node->txOut++ % BUS_SIM_TX_SIZE];
+    node->sending = true;
+    node->bytes++;
+    sender[senders++] = node;
+  }
+
+  bus->busyLast = senders > 0;
+  
+  if(senders == 0)
+    return;
+
+  bus->busy++;
+
+  if(senders > 1) {
+    bus->collisions++;
+    
+    for(i = 0; i < senders; i++)
+      sender[i]->collided = true;
+  }
+
+  // Everyone not talking hears the byte
+  
+  for(i = 0; i < bus->nodes; i++) {
+    BusSimNode_t *node = bus->node[i];
+
+    if(!node->sending)
+      datagramRxInput(&node->link, &value, 1);
+  }
+
+  // The last byte of a frame is out at the end of the slot
+  
+  for(i = 0; i < senders; i++) {
+    BusSimNode_t *node = sender[i];
+
+    if(node->frameCount > 0 && node->txOut == node->frame[node->frameHead].end)
+      busSimFrameDone(node, next);
+    else if(node->txIn == node->txOut)
+      // Untracked frame
+      node->sending = node->collided = false;
+  }
+}
+
+void busSimRun(BusSim_t *bus, VP_TIME_MICROS_T duration)
+{
+  VP_TIME_JIFFIES_T end = STAP_TimeJiffies() + duration;
+
+  for(;;) {
+    VP_TIME_JIFFIES_T now = busSimTime(bus, bus->slots),
+      next = busSimTime(bus, bus->slots + 1);
+
+    if(now >= end)
+      break;
+    
+    hostTimeAdvanceTo(now);
+    busSimSlot(bus, now, next);
+    bus->slots++;
+  }
+
+  hostTimeAdvanceTo(end);
+}
+
+void busSimReportPrint(BusSim_t *bus)
+{
+  int i = 0;
+  
+  printf("Bus %lu bps, %s, %.3f s: utilization %.1f%%, collisions %.1f%% of busy slots\n",
+	 (unsigned long) bus->bitrate, bus->carrierSense ? "carrier sense" : "no carrier sense",
+	 (double) (STAP_TimeJiffies() - bus->start) / 1e6,
+	 bus->slots ? 100.0 * bus->busy / bus->slots : 0.0,
+	 bus->busy ? 100.0 * bus->collisions / bus->busy : 0.0);
+
+  printf("Node  Frames  Collided  Latency avg/max (us)   RX good  CRC   Overflows\n");
+  
+  for(i = 0; i < bus->nodes; i++) {
+    BusSimNode_t *node = bus->node[i];
+    DgLinkStats_t stats;
+
+    datagramLinkSnapshot(&node->link, &stats);
+    
+    printf("0x%02X %7u %9u %10.0f / %-10u %8u %5u %7u\n",
+	   node->link.node, node->frames, node->collisions,
+	   node->frames ? (double) node->latencyTotal / node->frames : 0.0,
+	   (unsigned) node->latencyMax, stats.rxDatagrams, stats.crcErrors,
+	   node->overflows);
+  }
+}
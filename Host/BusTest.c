@@ -0,0 +1,157 @@
+#include <string.h>
+#include "BusSim.h"
+#include "AlphaLink.h"
+#include "HostTest.h"
+
+//
+// The bus emulator: frames reach the node they're addressed to (and the
+// master) only, two nodes talking at once collide and carrier sense keeps
+// a node from cutting in
+//
+
+#define TEST_NODES     3
+#define TEST_PAYLOAD   16
+
+typedef struct TestNode {
+  VP_TIME_JIFFIES_T sendAt;
+  uint8_t to, header;
+  bool pending;
+  uint32_t received[DG_MAX_NODES];
+  uint32_t intact;
+} TestNode_t;
+
+static BusSimNode_t simNode[TEST_NODES+1];
+static TestNode_t testNode[TEST_NODES+1];
+
+static void fill(uint8_t *data, uint8_t from)
+{
+  int i = 0;
+
+  for(i = 0; i < TEST_PAYLOAD; i++)
+    data[i] = from + 3*i;
+}
+
+static void receive(void *context, uint8_t node, const uint8_t *data, size_t size)
+{
+  TestNode_t *self = &testNode[(BusSimNode_t*) context - simNode];
+  uint8_t expected[TEST_PAYLOAD];
+
+  self->received[node]++;
+
+  // The master hears the sender's address, the others their own
+
+  fill(expected, data[0]);
+
+  if(size == TEST_PAYLOAD + 1 && !memcmp(&data[1], expected, TEST_PAYLOAD))
+    self->intact++;
+}
+
+static VP_TIME_MICROS_T task(BusSimNode_t *node, void *context)
+{
+  TestNode_t *self = (TestNode_t*) context;
+  uint8_t data[TEST_PAYLOAD];
+
+  if(self->pending && STAP_TimeJiffies() >= self->sendAt) {
+    fill(data, self->header);
+    datagramTxStartNode(&node->link, self->to, self->header);
+    datagramTxOut(&node->link, data, sizeof(data));
+    datagramTxEnd(&node->link);
+    self->pending = false;
+  }
+
+  return 10;
+}
+
+static void setup(BusSim_t *bus, bool carrierSense)
+{
+  int i = 0;
+
+  // Frames after a pause start with a break, let there be one
+
+  hostTimeAdvance(1000000);
+
+  memset((void*) testNode, '\0', sizeof(testNode));
+  busSimInit(bus, AL_BITRATE, carrierSense);
+
+  for(i = 0; i <= TEST_NODES; i++)
+    CHECK(busSimNodeAdd(bus, &simNode[i], i, &testNode[i], receive, task));
+}
+
+static void post(int from, uint8_t to, uint8_t header, VP_TIME_MICROS_T after)
+{
+  testNode[from].to = to;
+  testNode[from].header = header;
+  testNode[from].sendAt = STAP_TimeJiffies() + after;
+  testNode[from].pending = true;
+}
+
+static void testAddressed(void)
+{
+  BusSim_t bus;
+  int i = 0;
+
+  setup(&bus, false);
+
+  // The master queries node 2, node 2 answers to its own address
+
+  post(0, 2, DG_ALPHA_QUERY, 0);
+  busSimRun(&bus, 10000);
+  post(2, 2, DG_ALPHA_RESPONSE, 0);
+  busSimRun(&bus, 10000);
+
+  CHECK(testNode[2].received[2] == 1);
+  CHECK(testNode[2].intact == 1);
+  CHECK(testNode[0].received[2] == 1);
+  CHECK(testNode[0].intact == 1);
+  CHECK(testNode[1].intact == 0);
+  CHECK(testNode[3].intact == 0);
+
+  // A broadcast reaches everyone
+
+  post(0, ALN_BROADCAST, DG_ALPHA_BROADCAST, 0);
+  busSimRun(&bus, 10000);
+
+  for(i = 1; i <= TEST_NODES; i++)
+    CHECK(testNode[i].received[ALN_BROADCAST] == 1);
+
+  CHECK(bus.collisions == 0);
+  CHECK(simNode[0].frames == 2);
+  CHECK(simNode[2].frames == 1);
+  CHECK(simNode[0].collisions == 0);
+}
+
+// Node 1 starts, node 3 wants to talk a few bytes later
+
+static void testOverlap(bool carrierSense)
+{
+  VP_TIME_MICROS_T slot = 10 * 1000000UL / AL_BITRATE;
+  BusSim_t bus;
+
+  setup(&bus, carrierSense);
+
+  post(1, 1, DG_ALPHA_RESPONSE, 0);
+  post(3, 3, DG_ALPHA_RESPONSE, 3*slot);
+  busSimRun(&bus, 20000);
+
+  CHECK(simNode[1].frames == 1);
+  CHECK(simNode[3].frames == 1);
+
+  if(carrierSense) {
+    CHECK(bus.collisions == 0);
+    CHECK(testNode[0].intact == 2);
+  } else {
+    CHECK(bus.collisions > 0);
+    CHECK(simNode[1].collisions == 1);
+    CHECK(simNode[3].collisions == 1);
+    CHECK(testNode[0].intact == 0);
+  }
+}
+
+int main(void)
+{
+  testAddressed();
+  testOverlap(false);
+  testOverlap(true);
+
+  return hostTestResult("BusTest");
+}
@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "ChannelSim.h"
+
+//
+// Datagram link throughput over a simulated channel, plain and COBS framed
+//
+//   ChannelBench [payload [count [bitrate]]]
+//
+
+int main(int argc, char **argv)
+{
+  size_t payload = argc > 1 ? atoi(argv[1]) : 32;
+  uint32_t count = argc > 2 ? atoi(argv[2]) : 20000;
+  uint32_t bitrate = argc > 3 ? atoi(argv[3]) : 115200;
+  const struct {
+    const char *name;
+    ChannelSimConfig_t config;
+  } cases[] = {
+    { "clean",     { bitrate, 2000, 0, 0, 0, 0, 1 } },
+    { "corrupt",   { bitrate, 2000, 20, 0, 0, 0, 1 } },
+    { "drop",      { bitrate, 2000, 0, 20, 0, 0, 1 } },
+    { "burst",     { bitrate, 2000, 0, 0, 5, 16, 1 } },
+    { "unlimited", { 0, 0, 0, 0, 0, 0, 1 } }
+  };
+  ChannelSimReport_t report;
+  char name[32];
+  size_t i = 0;
+  int cobs = 0;
+
+  printf("%u datagrams of %u bytes at %u bps\n",
+	 (unsigned) count, (unsigned) payload, (unsigned) bitrate);
+  
+  for(cobs = 0; cobs < 2; cobs++) {
+    for(i = 0; i < sizeof(cases)/sizeof(cases[0]); i++) {
+      snprintf(name, sizeof(name), "%s%s", cases[i].name, cobs ? " COBS" : "");
+      channelSimBenchmark(&cases[i].config, cobs, payload, count, &report);
+      channelSimReportPrint(name, &report);
+    }
+  }
+
+  return 0;
+}
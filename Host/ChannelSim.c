@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ChannelSim.h"
+
+#define SIM_CHUNK      64
+#define SIM_STORE      0x10000
+
+static uint32_t simRandom(ChannelSim_t *ch)
+{
+  // xorshift32
+  
+  ch->random ^= ch->random << 13;
+  ch->random ^= ch->random >> 17;
+  ch->random ^= ch->random << 5;
+  
+  return ch->random;
+}
+
+static bool simChance(ChannelSim_t *ch, uint32_t ppm)
+{
+  return ppm > 0 && simRandom(ch) % 1000000UL < ppm;
+}
+
+void channelSimInit(ChannelSim_t *ch, const ChannelSimConfig_t *config, DgLink_t *rx,
+		    ChannelSimByte_t *store, size_t size)
+{
+  memset((void*) ch, '\0', sizeof(ChannelSim_t));
+
+  ch->config = *config;
+  ch->rx = rx;
+  ch->store = store;
+  ch->size = size;
+  ch->random = config->seed ? config->seed : 1;
+  ch->lineFree = STAP_TimeJiffies();
+}
+
+void channelSimOut(void *channel, const uint8_t *data, size_t size)
+{
+  ChannelSim_t *ch = (ChannelSim_t*) channel;
+  VP_TIME_JIFFIES_T now = STAP_TimeJiffies();
+  
+  while(size-- > 0) {
+    ChannelSimByte_t *slot = NULL;
+    uint8_t value = *data++;
+
+    // Clocked out after whatever is on the line already
+    
+    if(ch->lineFree < now)
+      ch->lineFree = now;
+    
+    if(ch->config.bitrate > 0)
+      ch->lineFree += (10*1000000UL + ch->config.bitrate/2) / ch->config.bitrate;
+
+    ch->bytes++;
+    
+    if(simChance(ch, ch->config.dropPpm)) {
+      ch->dropped++;
+      continue;
+    }
+
+    if(ch->burst == 0 && simChance(ch, ch->config.burstPpm))
+      ch->burst = ch->config.burstLength;
+    
+    if(ch->burst > 0 || simChance(ch, ch->config.corruptPpm)) {
+      value ^= 1<<(simRandom(ch) & 7);
+      ch->corrupted++;
+
+      if(ch->burst > 0)
+	ch->burst--;
+    }
+
+    if(ch->count == ch->size) {
+      ch->overflows++;
+      continue;
+    }
+
+    slot = &ch->store[(ch->head + ch->count++) % ch->size];
+    slot->due = ch->lineFree + ch->config.latency;
+    slot->value = value;
+  }
+}
+
+VP_TIME_JIFFIES_T channelSimPoll(ChannelSim_t *ch)
+{
+  VP_TIME_JIFFIES_T now = STAP_TimeJiffies();
+  
+  while(ch->count > 0 && ch->store[ch->head].due <= now) {
+    uint8_t buffer[SIM_CHUNK];
+    size_t len = 0;
+    uint64_t start = 0;
+    
+    while(len < sizeof(buffer) && ch->count > 0 && ch->store[ch->head].due <= now) {
+      buffer[len++] = ch->store[ch->head].value;
+      ch->head = (ch->head + 1) % ch->size;
+      ch->count--;
+    }
+
+    start = hostNanos();
+    datagramRxInput(ch->rx, buffer, len);
+    ch->rxNanos += hostNanos() - start;
+  }
+
+  return ch->count > 0 ? ch->store[ch->head].due : 0;
+}
+
+//
+// Benchmark
+//
+
+typedef struct SimSink {
+  uint8_t *buffer;
+  size_t size, len;
+} SimSink_t;
+
+static uint32_t simDelivered;
+
+static void simSinkOut(void *context, const uint8_t *data, size_t size)
+{
+  SimSink_t *sink = (SimSink_t*) context;
+
+  if(sink->len + size <= sink->size) {
+    memcpy(&sink->buffer[sink->len], data, size);
+    sink->len += size;
+  }
+}
+
+static void simDiscard(void *context, const uint8_t *data, size_t size)
+{
+  (void) context;
+  (void) data;
+  (void) size;
+}
+
+static void simHandler(void *context, uint8_t node, const uint8_t *data, size_t size)
+{
+  (void) context;
+  (void) node;
+  (void) data;
+  (void) size;
+  
+  simDelivered++;
+}
+
+static void simLinkInit(DgLink_t *link, uint8_t *rxStore, size_t rxSize, uint8_t *stage,
+			bool cobs, void *context,
+			void (*txOut)(void*, const uint8_t *b, size_t l))
+{
+  datagramLinkInit(link, 0, rxStore, rxSize, context, simHandler, NULL,
+		   txOut, NULL, NULL);
+  datagramLinkSetTxStage(link, stage, DG_TX_STAGE_SIZE);
+  datagramLinkSetCobs(link, cobs);
+}
+
+static void simSend(DgLink_t *link, const uint8_t *payload, size_t size)
+{
+  datagramTxStart(link, DG_HOSTLINK);
+  datagramTxOut(link, payload, size);
+  datagramTxEnd(link);
+}
+
+void channelSimBenchmark(const ChannelSimConfig_t *config, bool cobs,
+			 size_t payload, uint32_t count, ChannelSimReport_t *report)
+{
+  static uint8_t txStore[DG_TRANSMIT_MAX+0x40], rxStore[DG_TRANSMIT_MAX+0x40];
+  static uint8_t txStage[DG_TX_STAGE_SIZE], rxStage[DG_TX_STAGE_SIZE];
+  static ChannelSimByte_t store[SIM_STORE];
+  uint8_t data[DG_TRANSMIT_MAX];
+  DgLink_t tx, rx;
+  ChannelSim_t ch;
+  SimSink_t sink;
+  DgLinkStats_t base, stats;
+  DgNodeStats_t node, nodeBase;
+  VP_TIME_JIFFIES_T start = 0;
+  uint64_t nanos = 0, bytes = 0;
+  uint32_t i = 0;
+
+  memset((void*) report, '\0', sizeof(ChannelSimReport_t));
+
+  if(payload > sizeof(data) || count == 0)
+    return;
+  
+  // Non-zero content, runs would be compressed by the byte stuffing
+  
+  ch.random = 0x12345678;
+  for(i = 0; i < payload; i++)
+    data[i] = 1 + simRandom(&ch) % 0xFF;
+
+  // Encoding cost, the output captured for measuring the decoding cost
+
+  sink.size = (size_t) count * DG_FRAME_ENCODED_MAX(payload+1);
+  sink.len = 0;
+  
+  if(!(sink.buffer = malloc(sink.size)))
+    return;
+  
+  simLinkInit(&tx, txStore, sizeof(txStore), txStage, cobs, &sink, simSinkOut);
+
+  nanos = hostNanos();
+  
+  for(i = 0; i < count; i++)
+    simSend(&tx, data, payload);
+
+  report->txNanosPerByte = (double) (hostNanos() - nanos) / count / payload;
+  
+  simLinkInit(&rx, rxStore, sizeof(rxStore), rxStage, cobs, NULL, simDiscard);
+
+  nanos = hostNanos();
+  
+  for(i = 0; i < sink.len; i += SIM_CHUNK)
+    datagramRxInput(&rx, &sink.buffer[i], sink.len - i < SIM_CHUNK ? sink.len - i : SIM_CHUNK);
+
+  report->rxNanosPerByte = (double) (hostNanos() - nanos) / count / payload;
+
+  free(sink.buffer);
+  
+  // Through the channel
+  
+  simLinkInit(&tx, txStore, sizeof(txStore), txStage, cobs, &ch, channelSimOut);
+  simLinkInit(&rx, rxStore, sizeof(rxStore), rxStage, cobs, NULL, simDiscard);
+  channelSimInit(&ch, config, &rx, store, SIM_STORE);
+
+  // The first datagram synchronizes the receiver's sequence number and
+  // doesn't count
+
+  simSend(&tx, data, payload);
+  
+  while((start = channelSimPoll(&ch)) > 0)
+    hostTimeAdvanceTo(start);
+
+  start = STAP_TimeJiffies();
+  nanos = hostNanos();
+  simDelivered = 0;
+  bytes = ch.bytes;
+  datagramLinkSnapshot(&rx, &base);
+  datagramNodeSnapshot(&rx, 0, &nodeBase);
+  
+  for(;;) {
+    VP_TIME_JIFFIES_T now = STAP_TimeJiffies(), next = channelSimPoll(&ch);
+
+    if(report->sent < count && ch.lineFree <= now) {
+      simSend(&tx, data, payload);
+      report->sent++;
+      continue;
+    }
+
+    if(report->sent < count && (next == 0 || ch.lineFree < next))
+      next = ch.lineFree;
+
+    if(next == 0)
+      break;
+
+    hostTimeAdvanceTo(next);
+  }
+
+  datagramLinkSnapshot(&rx, &stats);
+  datagramNodeSnapshot(&rx, 0, &node);
+  
+  report->delivered = simDelivered;
+  report->lost = node.lost - nodeBase.lost;
+  report->crcErrors = stats.crcErrors - base.crcErrors;
+  report->badStarts = stats.badStarts - base.badStarts;
+  report->overflows = stats.overflows - base.overflows;
+  report->wireBytes = ch.bytes - bytes;
+
+  // Without a bitrate no virtual time passes, the rates are what the host
+  // manages
+
+  if(config->bitrate)
+    report->seconds = (double) (STAP_TimeJiffies() - start) / 1e6;
+  else
+    report->seconds = (double) (hostNanos() - nanos) / 1e9;
+
+  if(report->seconds > 0) {
+    report->framesPerSec = report->delivered / report->seconds;
+    report->goodput = report->delivered * payload / report->seconds;
+  }
+}
+
+void channelSimReportPrint(const char *name, const ChannelSimReport_t *report)
+{
+  printf("%-16s %7u sent %7u delivered %6u lost (%u CRC, %u bad, %u overflow)\n",
+	 name, report->sent, report->delivered, report->lost,
+	 report->crcErrors, report->badStarts, report->overflows);
+  printf("%-16s %9.1f frames/s %10.0f B/s goodput %6.1f wire B/frame"
+	 " TX %5.1f ns/B RX %5.1f ns/B\n",
+	 "", report->framesPerSec, report->goodput,
+	 report->sent ? (double) report->wireBytes / report->sent : 0.0,
+	 report->txNanosPerByte, report->rxNanosPerByte);
+}
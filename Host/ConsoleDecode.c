@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <string.h>
+#include "ConsoleHost.h"
+
+//
+// Console output of a firmware from a capture of its console link (a file
+// or the standard input), binary records looked up in the firmware's ELF
+// file. With -c the link is COBS framed.
+//
+//   ConsoleDecode [-c] firmware.elf [capture]
+//
+
+static void print(void *context, const char *text, size_t size)
+{
+  (void) context;
+  
+  fwrite(text, 1, size, stdout);
+}
+
+static void discard(void *context, const uint8_t *data, size_t size)
+{
+  (void) context;
+  (void) data;
+  (void) size;
+}
+
+int main(int argc, char **argv)
+{
+  static uint8_t rxStore[DG_TRANSMIT_MAX+0x40];
+  ConsoleHostImage_t image;
+  ConsoleHost_t console;
+  DgLink_t link;
+  uint8_t buffer[0x1000];
+  FILE *capture = stdin;
+  bool cobs = false;
+  size_t len = 0;
+  int arg = 1;
+
+  if(arg < argc && !strcmp(argv[arg], "-c")) {
+    cobs = true;
+    arg++;
+  }
+
+  if(arg >= argc) {
+    fprintf(stderr, "usage: %s [-c] firmware.elf [capture]\n", argv[0]);
+    return 2;
+  }
+  
+  if(!consoleHostImageLoad(&image, argv[arg])) {
+    fprintf(stderr, "%s: not a usable ELF file\n", argv[arg]);
+    return 1;
+  }
+
+  if(++arg < argc && !(capture = fopen(argv[arg], "rb"))) {
+    fprintf(stderr, "%s: can't open\n", argv[arg]);
+    return 1;
+  }
+  
+  consoleHostInit(&console, &image, print, NULL);
+  datagramLinkInit(&link, 0, rxStore, sizeof(rxStore), &console, consoleHostDatagram,
+		   NULL, discard, NULL, NULL);
+  datagramLinkSetCobs(&link, cobs);
+
+  while((len = fread(buffer, 1, sizeof(buffer), capture)) > 0)
+    datagramRxInput(&link, buffer, len);
+
+  consoleHostFlush(&console);
+
+  if(console.unknown > 0)
+    fprintf(stderr, "%u of %u binary records with an unknown format\n",
+	    (unsigned) console.unknown, (unsigned) console.records);
+  
+  consoleHostImageFree(&image);
+  
+  return 0;
+}
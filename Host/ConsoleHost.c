@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+#include "ConsoleHost.h"
+#include "StringFmt.h"
+
+//
+// Firmware image
+//
+
+static void imageSection(ConsoleHostImage_t *image, uint32_t type, uint64_t flags,
+			 uint64_t address, uint64_t offset, uint64_t size)
+{
+  // Only what's loaded and has contents in the file
+
+  if(type != SHT_PROGBITS || !(flags & SHF_ALLOC) || size == 0
+     || offset > image->fileSize || size > image->fileSize - offset
+     || image->sections >= CONSOLE_HOST_SECTIONS)
+    return;
+
+  image->section[image->sections].address = address;
+  image->section[image->sections].size = size;
+  image->section[image->sections].data = &image->file[offset];
+  image->sections++;
+}
+
+static bool imageParse(ConsoleHostImage_t *image)
+{
+  const uint8_t *ident = image->file;
+  int i = 0;
+
+  if(image->fileSize < EI_NIDENT || memcmp(ident, ELFMAG, SELFMAG)
+     || ident[EI_DATA] != ELFDATA2LSB)
+    return false;
+
+  if(ident[EI_CLASS] == ELFCLASS32) {
+    Elf32_Ehdr header;
+
+    if(image->fileSize < sizeof(header))
+      return false;
+
+    memcpy(&header, image->file, sizeof(header));
+
+    if(header.e_shentsize != sizeof(Elf32_Shdr)
+       || header.e_shoff > image->fileSize
+       || (uint64_t) header.e_shnum * sizeof(Elf32_Shdr) > image->fileSize - header.e_shoff)
+      return false;
+
+    for(i = 0; i < header.e_shnum; i++) {
+      Elf32_Shdr section;
+
+      memcpy(&section, &image->file[header.e_shoff + i*sizeof(section)], sizeof(section));
+      imageSection(image, section.sh_type, section.sh_flags,
+		   section.sh_addr, section.sh_offset, section.sh_size);
+    }
+  } else if(ident[EI_CLASS] == ELFCLASS64) {
+    Elf64_Ehdr header;
+
+    if(image->fileSize < sizeof(header))
+      return false;
+
+    memcpy(&header, image->file, sizeof(header));
+
+    if(header.e_shentsize != sizeof(Elf64_Shdr)
+       || header.e_shoff > image->fileSize
+       || (uint64_t) header.e_shnum * sizeof(Elf64_Shdr) > image->fileSize - header.e_shoff)
+      return false;
+
+    for(i = 0; i < header.e_shnum; i++) {
+      Elf64_Shdr section;
+
+      memcpy(&section, &image->file[header.e_shoff + i*sizeof(section)], sizeof(section));
+      imageSection(image, section.sh_type, section.sh_flags,
+		   section.sh_addr, section.sh_offset, section.sh_size);
+    }
+  } else
+    return false;
+
+  return image->sections > 0;
+}
+
+bool consoleHostImageLoad(ConsoleHostImage_t *image, const char *path)
+{
+  FILE *file = fopen(path, "rb");
+  long size = 0;
+
+  memset((void*) image, '\0', sizeof(ConsoleHostImage_t));
+
+  if(!file)
+    return false;
+
+  if(fseek(file, 0, SEEK_END) || (size = ftell(file)) <= 0 || fseek(file, 0, SEEK_SET)
+     || !(image->file = malloc(size))
+     || fread(image->file, 1, size, file) != (size_t) size) {
+    fclose(file);
+    consoleHostImageFree(image);
+    return false;
+  }
+
+  fclose(file);
+  image->fileSize = size;
+
+  if(!imageParse(image)) {
+    consoleHostImageFree(image);
+    return false;
+  }
+
+  return true;
+}
+
+void consoleHostImageFree(ConsoleHostImage_t *image)
+{
+  free(image->file);
+  memset((void*) image, '\0', sizeof(ConsoleHostImage_t));
+}
+
+const char *consoleHostString(const ConsoleHostImage_t *image, uint64_t address)
+{
+  int i = 0;
+
+  for(i = 0; i < image->sections; i++) {
+    const ConsoleHostSection_t *section = &image->section[i];
+    uint64_t offset = address - section->address;
+
+    if(address < section->address || offset >= section->size)
+      continue;
+
+    // Must end within the section
+
+    if(!memchr(&section->data[offset], '\0', section->size - offset))
+      return NULL;
+
+    return (const char*) &section->data[offset];
+  }
+
+  return NULL;
+}
+
+//
+// Console datagrams
+//
+
+void consoleHostInit(ConsoleHost_t *host, const ConsoleHostImage_t *image,
+		     void (*out)(void *context, const char *text, size_t size), void *context)
+{
+  memset((void*) host, '\0', sizeof(ConsoleHost_t));
+
+  host->image = image;
+  host->out = out;
+  host->context = context;
+}
+
+static void hostPrintf(ConsoleHost_t *host, const char *f, ...)
+{
+  char buffer[CONSOLE_HOST_TEXT_MAX];
+  va_list args;
+  int len = 0;
+
+  va_start(args, f);
+  len = vsnprintf(buffer, sizeof(buffer), f, args);
+  va_end(args);
+
+  if(len > (int) sizeof(buffer) - 1)
+    len = sizeof(buffer) - 1;
+
+  if(len > 0)
+    (*host->out)(host->context, buffer, len);
+}
+
+static void hostBinary(ConsoleHost_t *host, const uint8_t *data, size_t size)
+{
+  static const char *prefix[] = { "", "// ", "!! ", "## " };
+  struct ConsoleBinaryHeader header;
+  char buffer[CONSOLE_HOST_TEXT_MAX];
+  const char *format = NULL;
+  uint8_t kind = 0;
+  int len = 0;
+
+  if(size < sizeof(header))
+    return;
+
+  memcpy(&header, data, sizeof(header));
+  host->records++;
+
+  kind = header.flags & CONSOLE_BIN_KIND;
+
+  if(!host->image
+     || !(format = consoleHostString(host->image, header.format))) {
+    host->unknown++;
+    hostPrintf(host, "?? Format 0x%08X unknown\n", (unsigned) header.format);
+    return;
+  }
+
+  if(kind < sizeof(prefix)/sizeof(prefix[0]))
+    hostPrintf(host, "%s", prefix[kind]);
+
+  len = stringFmtUnpack(buffer, sizeof(buffer), format,
+			&data[sizeof(header)], size - sizeof(header));
+
+  if(len > (int) sizeof(buffer))
+    len = sizeof(buffer);
+
+  (*host->out)(host->context, buffer, len);
+
+  if(header.flags & CONSOLE_BIN_NL)
+    (*host->out)(host->context, "\n", 1);
+}
+
+static void blobShow(ConsoleHost_t *host)
+{
+  char buffer[CONSOLE_HOST_TEXT_MAX];
+  size_t i = 0;
+
+  if(host->blobBroken || host->blobReceived < host->blobSize) {
+    host->blobsBroken++;
+    hostPrintf(host, "  Blob %s incomplete (%u of %u bytes)\n", host->blobName,
+	       (unsigned) host->blobReceived, (unsigned) host->blobSize);
+  } else {
+    // Like consolePrintBlob() would have printed it
+
+    host->blobs++;
+    hostPrintf(host, "  Blob %s = ", host->blobName);
+
+    while(i < host->blobSize) {
+      size_t n = host->blobSize - i < sizeof(buffer)/2 ? host->blobSize - i : sizeof(buffer)/2;
+
+      (*host->out)(host->context, buffer,
+		   bufferPrintHex(buffer, sizeof(buffer), &host->blob[i], n));
+      i += n;
+    }
+
+    (*host->out)(host->context, "\n", 1);
+  }
+
+  free(host->blob);
+  host->blob = NULL;
+  host->blobSize = host->blobReceived = 0;
+  host->blobBroken = false;
+}
+
+static void hostBlob(ConsoleHost_t *host, const uint8_t *data, size_t size)
+{
+  struct ConsoleBlobHeader header;
+  size_t len = 0;
+
+  if(size < sizeof(header))
+    return;
+
+  memcpy(&header, data, sizeof(header));
+
+  if(header.nameLen > CONSOLE_BLOB_NAME_MAX || sizeof(header) + header.nameLen > size)
+    return;
+
+  len = size - sizeof(header) - header.nameLen;
+
+  if(header.offset == 0) {
+    // A new one, what's left of the previous is reported missing
+
+    if(host->blob)
+      blobShow(host);
+
+    if(header.size > CONSOLE_HOST_BLOB_MAX || !(host->blob = malloc(header.size + 1)))
+      return;
+
+    memcpy(host->blobName, &data[sizeof(header)], header.nameLen);
+    host->blobName[header.nameLen] = '\0';
+    host->blobSize = header.size;
+  } else if(!host->blob)
+    // The start was lost
+    return;
+
+  if(header.offset != host->blobReceived || header.size != host->blobSize
+     || len > host->blobSize - host->blobReceived) {
+    host->blobBroken = true;
+    return;
+  }
+
+  memcpy(&host->blob[host->blobReceived], &data[sizeof(header) + header.nameLen], len);
+  host->blobReceived += len;
+
+  if(host->blobReceived == host->blobSize)
+    blobShow(host);
+}
+
+void consoleHostDatagram(void *context, uint8_t node, const uint8_t *data, size_t size)
+{
+  ConsoleHost_t *host = (ConsoleHost_t*) context;
+
+  (void) node;
+
+  if(size < 1)
+    return;
+
+  switch(data[0]) {
+  case DG_CONSOLE:
+    (*host->out)(host->context, (const char*) &data[1], size - 1);
+    break;
+
+  case DG_CONSOLE_BINARY:
+    hostBinary(host, &data[1], size - 1);
+    break;
+
+  case DG_CONSOLE_BLOB:
+    hostBlob(host, &data[1], size - 1);
+    break;
+
+  default:
+    break;
+  }
+}
+
+void consoleHostFlush(ConsoleHost_t *host)
+{
+  if(host->blob)
+    blobShow(host);
+}
@@ -0,0 +1,283 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <link.h>
+#include "ConsoleHost.h"
+#include "StringFmt.h"
+#include "HostTest.h"
+
+//
+// Binary console records: arguments packed by stringFmtPack() and rebuilt
+// with stringFmtUnpack() must read like the format applied directly, for
+// every conversion. Records are then sent over a link the way the console
+// does, their formats looked up in this program's own ELF file, and blobs
+// are reassembled from their segments.
+//
+
+#define TEST_RECORD   0x100
+#define TEST_BLOB     1000
+
+static char output[CONSOLE_HOST_TEXT_MAX*4];
+static size_t outputLen;
+static uint64_t loadBias;
+
+static void capture(void *context, const char *text, size_t size)
+{
+  (void) context;
+
+  if(outputLen + size < sizeof(output)) {
+    memcpy(&output[outputLen], text, size);
+    outputLen += size;
+    output[outputLen] = '\0';
+  }
+}
+
+static void roundTrip(const char *f, ...)
+{
+  char direct[TEST_RECORD], rebuilt[TEST_RECORD];
+  uint8_t packed[TEST_RECORD];
+  va_list args;
+  int len = 0;
+
+  va_start(args, f);
+  vStringFmt(direct, sizeof(direct), f, args);
+  va_end(args);
+
+  va_start(args, f);
+  len = stringFmtPack(packed, sizeof(packed), f, args);
+  va_end(args);
+
+  stringFmtUnpack(rebuilt, sizeof(rebuilt), f, packed, len);
+
+  if(strcmp(direct, rebuilt)) {
+    printf("\"%s\": \"%s\" rebuilt as \"%s\"\n", f, direct, rebuilt);
+    CHECK(false);
+  }
+}
+
+static void testRoundTrip(void)
+{
+  char longString[300];
+
+  roundTrip("plain %% only");
+  roundTrip("%c%c%c", 'a', '%', '~');
+  roundTrip("%d %d %5d %-5d| %05d", 0, -1, 42, -42, 7);
+  roundTrip("%d %d", 2147483647, -2147483647 - 1);
+  roundTrip("%u %u %.3u", 0U, 4294967295U, 5U);
+  roundTrip("%D %D %8D", 123456789L, -123456789L, -1L);
+  roundTrip("%U %U", 0UL, 4294967295UL);
+  roundTrip("%x %X %#x %08X", 0UL, 0xABCDUL, 0x1234UL, 0xDEADBEEFUL);
+  roundTrip("%p", 0x20001000L);
+  roundTrip("%f %.0f %.3f %10.2f %-10.1f|", 0.0, -1.5, 3.125, 1000.25, -0.5);
+  roundTrip("%f", 3.4028235e38);
+  roundTrip("%s|%10s|%-10s|%s", "text", "right", "left", "");
+  roundTrip("tab%10tstop", 0);
+  roundTrip("%d %s %f %x %c", -7, "mixed", 2.5, 0xFFUL, 'z');
+
+  // Strings are cut at 255 characters
+
+  memset(longString, 'x', sizeof(longString) - 1);
+  longString[sizeof(longString) - 1] = '\0';
+  roundTrip("%s", &longString[sizeof(longString) - 1 - 255]);
+}
+
+static int phdrCallback(struct dl_phdr_info *info, size_t size, void *data)
+{
+  (void) size;
+  (void) data;
+
+  // The program itself comes first
+
+  loadBias = info->dlpi_addr;
+  return 1;
+}
+
+// The address a string has in the ELF file
+
+static uint32_t imageAddress(const char *s)
+{
+  return (uint32_t) ((uintptr_t) s - loadBias);
+}
+
+static void sendRecord(DgLink_t *link, uint8_t flags, const char *f, ...)
+{
+  struct ConsoleBinaryHeader header = { .format = imageAddress(f), .flags = flags };
+  uint8_t packed[TEST_RECORD];
+  va_list args;
+  int len = 0;
+
+  va_start(args, f);
+  len = stringFmtPack(packed, sizeof(packed), f, args);
+  va_end(args);
+
+  datagramTxStart(link, DG_CONSOLE_BINARY);
+  datagramTxOut(link, (const uint8_t*) &header, sizeof(header));
+  datagramTxOut(link, packed, len);
+  datagramTxEnd(link);
+}
+
+static void sendText(DgLink_t *link, const char *text)
+{
+  datagramTxStart(link, DG_CONSOLE);
+  datagramTxOut(link, (const uint8_t*) text, strlen(text));
+  datagramTxEnd(link);
+}
+
+// Segments like consolePrintBlob() sends them, one of them left out
+
+static void sendBlob(DgLink_t *link, const char *name, const uint8_t *data, size_t size,
+		     int skip)
+{
+  size_t nameLen = strlen(name), offset = 0;
+  struct ConsoleBlobHeader header = { .size = size, .nameLen = nameLen };
+  size_t segment = DG_TRANSMIT_MAX - sizeof(header) - nameLen;
+  int i = 0;
+
+  do {
+    size_t len = size - offset < segment ? size - offset : segment;
+
+    if(i++ != skip) {
+      header.offset = offset;
+
+      datagramTxStart(link, DG_CONSOLE_BLOB);
+      datagramTxOut(link, (const uint8_t*) &header, sizeof(header));
+      datagramTxOut(link, (const uint8_t*) name, nameLen);
+      datagramTxOut(link, &data[offset], len);
+      datagramTxEnd(link);
+    }
+
+    offset += len;
+  } while(offset < size);
+}
+
+static DgLink_t firmware, host;
+
+static void toHost(void *context, const uint8_t *data, size_t size)
+{
+  (void) context;
+  datagramRxInput(&host, data, size);
+}
+
+static void discard(void *context, const uint8_t *data, size_t size)
+{
+  (void) context;
+  (void) data;
+  (void) size;
+}
+
+static void testBlob(ConsoleHost_t *console)
+{
+  static uint8_t blob[TEST_BLOB];
+  static char expected[CONSOLE_HOST_TEXT_MAX*4];
+  size_t segment = DG_TRANSMIT_MAX - sizeof(struct ConsoleBlobHeader) - strlen("blob");
+  size_t i = 0;
+  int len = 0;
+
+  for(i = 0; i < sizeof(blob); i++)
+    blob[i] = 7*i;
+
+  len = snprintf(expected, sizeof(expected), "  Blob blob = ");
+  len += bufferPrintHex(&expected[len], sizeof(expected) - len, blob, sizeof(blob));
+  snprintf(&expected[len], sizeof(expected) - len, "\n");
+
+  // Intact
+
+  outputLen = 0;
+  output[0] = '\0';
+
+  sendBlob(&firmware, "blob", blob, sizeof(blob), -1);
+
+  CHECK(!strcmp(output, expected));
+  CHECK(console->blobs == 1);
+
+  // A segment lost in the middle shows at the end of the input
+
+  outputLen = 0;
+  output[0] = '\0';
+
+  sendBlob(&firmware, "blob", blob, sizeof(blob), 1);
+  CHECK(outputLen == 0);
+
+  consoleHostFlush(console);
+  snprintf(expected, sizeof(expected), "  Blob blob incomplete (%u of %u bytes)\n",
+	   (unsigned) segment, (unsigned) sizeof(blob));
+  CHECK(!strcmp(output, expected));
+  CHECK(console->blobsBroken == 1);
+
+  // The last one lost shows when the next blob starts
+
+  outputLen = 0;
+  output[0] = '\0';
+
+  sendBlob(&firmware, "blob", blob, sizeof(blob), 2);
+  sendBlob(&firmware, "next", blob, 3, -1);
+
+  snprintf(expected, sizeof(expected),
+	   "  Blob blob incomplete (%u of %u bytes)\n  Blob next = 00070E\n",
+	   (unsigned) (2*segment), (unsigned) sizeof(blob));
+  CHECK(!strcmp(output, expected));
+  CHECK(console->blobs == 2);
+  CHECK(console->blobsBroken == 2);
+}
+
+static void testDecoder(void)
+{
+  static uint8_t firmwareStore[DG_TRANSMIT_MAX+0x40], hostStore[DG_TRANSMIT_MAX+0x40];
+  struct ConsoleBinaryHeader unknown = { .format = 0, .flags = CONSOLE_BIN_NL };
+  ConsoleHostImage_t image;
+  ConsoleHost_t console;
+
+  dl_iterate_phdr(phdrCallback, NULL);
+
+  CHECK(consoleHostImageLoad(&image, "/proc/self/exe"));
+  CHECK(consoleHostString(&image, imageAddress("%s: unique literal")) != NULL);
+  CHECK(consoleHostString(&image, 0) == NULL);
+
+  consoleHostInit(&console, &image, capture, NULL);
+  datagramLinkInit(&firmware, 0, firmwareStore, sizeof(firmwareStore), NULL, NULL, NULL,
+		   toHost, NULL, NULL);
+  datagramLinkInit(&host, 0, hostStore, sizeof(hostStore), &console, consoleHostDatagram,
+		   NULL, discard, NULL, NULL);
+
+  hostTimeAdvance(1000000);
+
+  sendText(&firmware, "Text as is\n");
+  sendRecord(&firmware, CONSOLE_BIN_NOTE | CONSOLE_BIN_NL, "%s: unique literal", "note");
+  sendRecord(&firmware, CONSOLE_BIN_ERROR, "error %d, ", -5);
+  sendRecord(&firmware, CONSOLE_BIN_PLAIN | CONSOLE_BIN_NL, "%.2f %x", 1.25, 0xBEEFUL);
+  sendRecord(&firmware, CONSOLE_BIN_DEBUG | CONSOLE_BIN_NL, "debug");
+
+  CHECK(!strcmp(output,
+		"Text as is\n"
+		"// note: unique literal\n"
+		"!! error -5, 1.25 BEEF\n"
+		"## debug\n"));
+  CHECK(console.records == 4);
+  CHECK(console.unknown == 0);
+
+  // An address outside the image
+
+  outputLen = 0;
+  output[0] = '\0';
+
+  datagramTxStart(&firmware, DG_CONSOLE_BINARY);
+  datagramTxOut(&firmware, (const uint8_t*) &unknown, sizeof(unknown));
+  datagramTxEnd(&firmware);
+
+  CHECK(console.unknown == 1);
+  CHECK(!strncmp(output, "?? ", 3));
+
+  testBlob(&console);
+
+  consoleHostImageFree(&image);
+}
+
+int main(void)
+{
+  testRoundTrip();
+  testDecoder();
+
+  return hostTestResult("ConsoleTest");
+}
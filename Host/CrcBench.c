@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "CRC16.h"
+#include "StaP.h"
+
+//
+// Throughput of the CRC engine the program is linked with (see the
+// makefile), over a large buffer and over datagram sized pieces
+//
+//   CrcBench-<engine> [megabytes]
+//
+
+#define BENCH_DATA     (1<<16)
+
+int main(int argc, char **argv)
+{
+  static uint8_t data[BENCH_DATA];
+  uint32_t megabytes = argc > 1 ? atoi(argv[1]) : 256;
+  uint32_t rounds = megabytes * ((1<<20) / BENCH_DATA), r = 0;
+  const size_t pieces[] = { 8, 32, 128 };
+  volatile uint16_t crc = 0xFFFF;
+  uint64_t start = 0;
+  size_t i = 0, j = 0;
+
+  for(i = 0; i < BENCH_DATA; i++)
+    data[i] = rand();
+
+  start = hostNanos();
+
+  for(r = 0; r < rounds; r++)
+    crc = crc16(crc, data, BENCH_DATA);
+
+  printf("%-16s %5u B pieces %8.1f MB/s\n", argv[0], BENCH_DATA,
+	 (double) rounds * BENCH_DATA * 1e3 / (hostNanos() - start));
+
+  for(j = 0; j < sizeof(pieces)/sizeof(pieces[0]); j++) {
+    start = hostNanos();
+
+    for(r = 0; r < rounds; r++)
+      for(i = 0; i + pieces[j] <= BENCH_DATA; i += pieces[j])
+	crc = crc16(0xFFFF, &data[i], pieces[j]);
+
+    printf("%-16s %5u B pieces %8.1f MB/s\n", argv[0], (unsigned) pieces[j],
+	   (double) rounds * (BENCH_DATA - BENCH_DATA % pieces[j]) * 1e3 / (hostNanos() - start));
+  }
+  
+  start = hostNanos();
+
+  for(r = 0; r < rounds; r++)
+    for(i = 0; i < BENCH_DATA; i++)
+      crc = crc16_update(crc, data[i]);
+
+  printf("%-16s crc16_update   %8.1f MB/s\n", argv[0],
+	 (double) rounds * BENCH_DATA * 1e3 / (hostNanos() - start));
+
+  return 0;
+}
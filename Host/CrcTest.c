@@ -0,0 +1,58 @@
+#include <stdlib.h>
+#include "CRC16.h"
+#include "HostTest.h"
+
+//
+// The CRC engine the program is linked with (see the makefile) against a
+// bitwise reference, and crc16_combine() at random split points
+//
+
+#define TEST_DATA      (1<<13)
+#define TEST_ROUNDS    5000
+
+static uint16_t reference(uint16_t crc, const uint8_t *data, int len)
+{
+  int i = 0;
+  
+  while(len-- > 0) {
+    crc ^= *data++;
+    
+    for(i = 0; i < 8; i++)
+      crc = crc & 1 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+  }
+
+  return crc;
+}
+
+int main(int argc, char **argv)
+{
+  static uint8_t data[TEST_DATA];
+  int r = 0, i = 0;
+
+  (void) argc;
+  
+  srand(1);
+  
+  for(i = 0; i < TEST_DATA; i++)
+    data[i] = rand();
+
+  for(r = 0; r < TEST_ROUNDS; r++) {
+    int offset = rand() % 64, len = rand() % (TEST_DATA - 64);
+    int split = rand() % (len + 1);
+    uint16_t initial = rand(), a = 0, b = 0;
+    
+    CHECK(crc16(initial, &data[offset], len) == reference(initial, &data[offset], len));
+    CHECK(crc16_update(initial, data[offset]) == reference(initial, &data[offset], 1));
+
+    a = crc16(0xFFFF, &data[offset], split);
+    b = crc16(0xFFFF, &data[offset+split], len - split);
+    
+    CHECK(crc16_combine(a, b, 0xFFFF, len - split)
+	  == reference(0xFFFF, &data[offset], len));
+
+    if(hostTestFailures > 0)
+      break;
+  }
+
+  return hostTestResult(argv[0]);
+}
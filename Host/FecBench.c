@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "ChannelSim.h"
+
+//
+// Goodput of a datagram link with and without parity groups against the
+// bit error rate of the channel. Each bit error flips one bit of a byte,
+// the channel's byte corruption rate is derived from the BER.
+//
+//   FecBench [payload [count [bitrate]]]
+//
+
+#define BENCH_COUNT_MAX   100000
+#define BENCH_HEADER      DG_TELEMLINK
+#define BENCH_STORE       0x10000
+
+typedef struct BenchResult {
+  uint32_t delivered;
+  uint64_t wireBytes;
+  double seconds;
+  uint16_t recovered, failed;
+} BenchResult_t;
+
+static uint8_t seen[BENCH_COUNT_MAX];
+static uint32_t delivered;
+static size_t payload;
+
+static void discard(void *context, const uint8_t *data, size_t size)
+{
+  (void) context;
+  (void) data;
+  (void) size;
+}
+
+static void receive(void *context, uint8_t node, const uint8_t *data, size_t size)
+{
+  uint32_t id = 0;
+
+  (void) context;
+  (void) node;
+  
+  if(size != payload + 1 || data[0] != BENCH_HEADER)
+    return;
+
+  memcpy(&id, &data[1], sizeof(id));
+
+  if(id < BENCH_COUNT_MAX && !seen[id]) {
+    seen[id] = 1;
+    delivered++;
+  }
+}
+
+static void run(uint32_t bitrate, double ber, uint8_t group, uint32_t count,
+		BenchResult_t *result)
+{
+  static uint8_t txRxStore[DG_TRANSMIT_MAX+0x40], rxStore[DG_TRANSMIT_MAX+0x40];
+  static uint8_t txStage[DG_TX_STAGE_SIZE];
+  static uint8_t fecTx[DG_TRANSMIT_MAX], fecRx[DG_TRANSMIT_MAX], fecUnused[DG_TRANSMIT_MAX];
+  static ChannelSimByte_t store[BENCH_STORE];
+  ChannelSimConfig_t config = { bitrate, 2000, 0, 0, 0, 0, 1 };
+  uint8_t data[DG_TRANSMIT_MAX];
+  DgLink_t tx, rx;
+  ChannelSim_t ch;
+  VP_TIME_JIFFIES_T start = STAP_TimeJiffies();
+  uint32_t sent = 0;
+  size_t i = 0;
+
+  config.corruptPpm = (1 - pow(1 - ber, 8)) * 1e6 + 0.5;
+  
+  datagramLinkInit(&tx, 0, txRxStore, sizeof(txRxStore), &ch, NULL, NULL,
+		   channelSimOut, NULL, NULL);
+  datagramLinkSetTxStage(&tx, txStage, sizeof(txStage));
+  datagramLinkInit(&rx, 0, rxStore, sizeof(rxStore), NULL, receive, NULL,
+		   discard, NULL, NULL);
+  channelSimInit(&ch, &config, &rx, store, BENCH_STORE);
+
+  if(group > 0) {
+    datagramLinkSetFec(&tx, group, fecTx, fecUnused, sizeof(fecTx));
+    datagramLinkSetFec(&rx, group, fecUnused, fecRx, sizeof(fecRx));
+  }
+
+  memset(seen, '\0', sizeof(seen));
+  delivered = 0;
+  
+  for(i = 0; i < payload; i++)
+    data[i] = 1 + i % 0xFF;
+  
+  for(;;) {
+    VP_TIME_JIFFIES_T now = STAP_TimeJiffies(), next = channelSimPoll(&ch);
+
+    if(sent < count && ch.lineFree <= now) {
+      memcpy(data, &sent, sizeof(sent));
+      datagramTxStart(&tx, BENCH_HEADER);
+      datagramTxOut(&tx, data, payload);
+      datagramTxEnd(&tx);
+      sent++;
+      continue;
+    }
+
+    if(sent < count && (next == 0 || ch.lineFree < next))
+      next = ch.lineFree;
+
+    if(next == 0)
+      break;
+
+    hostTimeAdvanceTo(next);
+  }
+
+  result->delivered = delivered;
+  result->wireBytes = ch.bytes;
+  result->seconds = (double) (STAP_TimeJiffies() - start) / 1e6;
+  datagramFecStatus(&rx, &result->recovered, &result->failed);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t count = argc > 2 ? atoi(argv[2]) : 20000;
+  uint32_t bitrate = argc > 3 ? atoi(argv[3]) : 115200;
+  const double bers[] = { 0, 1e-6, 1e-5, 1e-4, 3e-4, 1e-3 };
+  const uint8_t groups[] = { 0, 2, 4, 8 };
+  BenchResult_t result;
+  size_t i = 0, j = 0;
+
+  payload = argc > 1 ? atoi(argv[1]) : 28;
+  
+  if(payload < sizeof(uint32_t) || payload >= DG_TRANSMIT_MAX || count > BENCH_COUNT_MAX) {
+    fprintf(stderr, "payload %u..%u bytes, at most %u datagrams\n",
+	    (unsigned) sizeof(uint32_t), DG_TRANSMIT_MAX-1, BENCH_COUNT_MAX);
+    return 1;
+  }
+  
+  printf("%u datagrams of %u bytes at %u bps\n",
+	 (unsigned) count, (unsigned) payload, (unsigned) bitrate);
+  
+  for(i = 0; i < sizeof(bers)/sizeof(bers[0]); i++) {
+    for(j = 0; j < sizeof(groups)/sizeof(groups[0]); j++) {
+      run(bitrate, bers[i], groups[j], count, &result);
+
+      printf("BER %7.1e group %2u %7.2f%% delivered %10.0f B/s goodput"
+	     " %5.1f%% of wire %6u recovered %6u failed\n",
+	     bers[i], groups[j], 100.0 * result.delivered / count,
+	     result.seconds > 0 ? result.delivered * payload / result.seconds : 0.0,
+	     result.wireBytes ? 100.0 * result.delivered * payload / result.wireBytes : 0.0,
+	     result.recovered, result.failed);
+    }
+  }
+
+  return 0;
+}
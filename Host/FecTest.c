@@ -0,0 +1,152 @@
+#include <string.h>
+#include "Datagram.h"
+#include "HostTest.h"
+
+//
+// Parity groups with frames too long for the FEC stores in them
+//
+
+#define FEC_GROUP      2
+#define FEC_STORE      16
+
+typedef struct Capture {
+  uint8_t buffer[0x400];
+  size_t len;
+} Capture_t;
+
+typedef struct Received {
+  uint8_t data[DG_TRANSMIT_MAX];
+  size_t size;
+  int count;
+} Received_t;
+
+static void captureOut(void *context, const uint8_t *data, size_t size)
+{
+  Capture_t *capture = (Capture_t*) context;
+
+  if(capture->len + size <= sizeof(capture->buffer)) {
+    memcpy(&capture->buffer[capture->len], data, size);
+    capture->len += size;
+  }
+}
+
+static void discardOut(void *context, const uint8_t *data, size_t size)
+{
+  (void) context;
+  (void) data;
+  (void) size;
+}
+
+static void receive(void *context, uint8_t node, const uint8_t *data, size_t size)
+{
+  Received_t *received = (Received_t*) context;
+
+  (void) node;
+  
+  if(size <= sizeof(received->data)) {
+    memcpy(received->data, data, size);
+    received->size = size;
+  }
+  
+  received->count++;
+}
+
+static DgLink_t tx, rx;
+static uint8_t txRxStore[DG_TRANSMIT_MAX+0x40], rxStore[DG_TRANSMIT_MAX+0x40];
+static uint8_t txStage[DG_TX_STAGE_SIZE];
+static uint8_t fecTx[FEC_STORE], fecRx[FEC_STORE], fecUnused[FEC_STORE];
+static Capture_t capture;
+static Received_t received;
+
+static void setup(void)
+{
+  datagramLinkInit(&tx, 0, txRxStore, sizeof(txRxStore), &capture, NULL, NULL,
+		   captureOut, NULL, NULL);
+  datagramLinkSetTxStage(&tx, txStage, sizeof(txStage));
+  datagramLinkSetFec(&tx, FEC_GROUP, fecTx, fecUnused, FEC_STORE);
+  
+  datagramLinkInit(&rx, 0, rxStore, sizeof(rxStore), &received, receive, NULL,
+		   discardOut, NULL, NULL);
+  datagramLinkSetFec(&rx, FEC_GROUP, fecUnused, fecRx, FEC_STORE);
+
+  memset((void*) &received, '\0', sizeof(received));
+}
+
+// Send a frame in chunks of the given lengths (zero terminated) filled
+// with the fill byte, and pass it on to the receiver unless it's dropped
+
+static void sendFrame(uint8_t header, uint8_t fill, const size_t *chunks, bool drop)
+{
+  uint8_t data[DG_TRANSMIT_MAX];
+
+  memset(data, fill, sizeof(data));
+  capture.len = 0;
+  
+  datagramTxStart(&tx, header);
+
+  while(*chunks > 0)
+    datagramTxOut(&tx, data, *chunks++);
+  
+  datagramTxEnd(&tx);
+
+  if(!drop)
+    datagramRxInput(&rx, capture.buffer, capture.len);
+}
+
+static void checkRecovered(const uint8_t *expected, size_t size)
+{
+  uint16_t recovered = 0, failed = 0;
+  
+  datagramFecStatus(&rx, &recovered, &failed);
+  
+  CHECK(recovered == 1);
+  CHECK(failed == 0);
+  CHECK(received.size == size);
+  CHECK(!memcmp(received.data, expected, size));
+}
+
+static void testOversizeEndsGroup(void)
+{
+  static const size_t shortFrame[] = { 7, 0 }, longFrame[] = { 10, 30, 0 };
+  static const uint8_t expected[] = { 0x22, 1, 1, 1, 1, 1, 1, 1 };
+  int before = 0;
+  
+  setup();
+
+  // A opens a group, the oversize frame abandons it after XORing its first
+  // chunk in, C and D make the next group and C is lost
+  
+  sendFrame(0x21, 0x11, shortFrame, false);
+  sendFrame(0x20, 0x54, longFrame, false);
+  before = received.count;
+  sendFrame(0x22, 0x01, shortFrame, true);
+  sendFrame(0x23, 0x33, shortFrame, false);
+
+  CHECK(received.count == before + 2);
+  checkRecovered(expected, sizeof(expected));
+}
+
+static void testOversizeFirst(void)
+{
+  static const size_t shortFrame[] = { 7, 0 }, longFrame[] = { 10, 30, 0 };
+  static const uint8_t expected[] = { 0x22, 1, 1, 1, 1, 1, 1, 1 };
+  
+  setup();
+
+  // The oversize frame opens what would be a group, the receiver mustn't
+  // count it as a member
+  
+  sendFrame(0x20, 0x54, longFrame, false);
+  sendFrame(0x22, 0x01, shortFrame, true);
+  sendFrame(0x23, 0x33, shortFrame, false);
+
+  checkRecovered(expected, sizeof(expected));
+}
+
+int main(void)
+{
+  testOversizeEndsGroup();
+  testOversizeFirst();
+  
+  return hostTestResult("FecTest");
+}
@@ -0,0 +1,171 @@
+#include <string.h>
+#include "Datagram.h"
+#include "HostTest.h"
+
+//
+// Flow control corner cases: a handler answering without credit, grants
+// older than the millisecond clock, grants that can't go out at once and
+// grants that mustn't be answered with grants
+//
+
+#define TEST_HEADER    (DG_HOSTLINK | 1)
+
+static DgLink_t linkA, linkB;
+static uint8_t rxStoreA[DG_TRANSMIT_MAX+0x40], rxStoreB[DG_TRANSMIT_MAX+0x40];
+static bool answer;
+
+static void toB(void *context, const uint8_t *data, size_t size)
+{
+  (void) context;
+  datagramRxInput(&linkB, data, size);
+}
+
+static void toA(void *context, const uint8_t *data, size_t size)
+{
+  (void) context;
+  datagramRxInput(&linkA, data, size);
+}
+
+static void receiveA(void *context, uint8_t node, const uint8_t *data, size_t size)
+{
+  (void) context;
+  (void) node;
+  (void) data;
+  (void) size;
+  
+  if(answer) {
+    datagramTxStart(&linkA, TEST_HEADER);
+    datagramTxEnd(&linkA);
+  }
+}
+
+static void receiveB(void *context, uint8_t node, const uint8_t *data, size_t size)
+{
+  (void) context;
+  (void) node;
+  (void) data;
+  (void) size;
+}
+
+static void setup(void)
+{
+  datagramLinkInit(&linkA, 0, rxStoreA, sizeof(rxStoreA), NULL, receiveA, NULL,
+		   toB, NULL, NULL);
+  datagramLinkInit(&linkB, 0, rxStoreB, sizeof(rxStoreB), NULL, receiveB, NULL,
+		   toA, NULL, NULL);
+  answer = false;
+}
+
+// B hands A a grant that leaves it no credit
+
+static void grantNothing(void)
+{
+  uint8_t grant[] = { linkA.txSeq[0], 0 };
+  
+  datagramTxStartNode(&linkB, 0, DG_FLOW_CREDIT);
+  datagramTxOut(&linkB, grant, sizeof(grant));
+  datagramTxEnd(&linkB);
+}
+
+static void testAnswerWithoutCredit(void)
+{
+  VP_TIME_JIFFIES_T start = 0;
+  DgLinkStats_t stats;
+  
+  setup();
+  grantNothing();
+  CHECK(!datagramFlowCredit(&linkA, 0));
+
+  // Waiting in the handler would only delay the grant
+  
+  answer = true;
+  start = STAP_TimeJiffies();
+  
+  datagramTxStartNode(&linkB, 0, TEST_HEADER);
+  datagramTxEnd(&linkB);
+
+  datagramLinkSnapshot(&linkA, &stats);
+  
+  CHECK(STAP_TimeJiffies() == start);
+  CHECK(stats.txDatagrams == 1);
+  CHECK(stats.flowTimeouts == 0);
+}
+
+static void testGrantAcrossWrap(void)
+{
+  setup();
+  vpTimeMillis();
+  grantNothing();
+  CHECK(!datagramFlowCredit(&linkA, 0));
+
+  // A whole turn of the millisecond clock later
+  
+  hostTimeAdvance((VP_TIME_JIFFIES_T) 0x10000 << 10);
+  vpTimeMillis();
+  
+  CHECK(datagramFlowCredit(&linkA, 0));
+}
+
+static void testGrantRetried(void)
+{
+  static DgTxFrame_t frames[1];
+  static DgTxQueue_t queue;
+  DgLinkStats_t stats;
+
+  setup();
+  datagramLinkSetFlow(&linkB, 8);
+  datagramLinkSetTxQueue(&linkB, &queue, frames, 1, NULL);
+
+  // B's only frame is taken, the grant for A's first datagram has to wait
+  
+  datagramTxStartNode(&linkB, 0, TEST_HEADER);
+  datagramTxEnd(&linkB);
+
+  datagramTxStart(&linkA, TEST_HEADER);
+  datagramTxEnd(&linkA);
+
+  datagramLinkSnapshot(&linkB, &stats);
+  CHECK(stats.flowGrantsSent == 0);
+  
+  datagramTxDrain(&linkB);
+  CHECK(datagramFlowTick(&linkB) == DG_FLOW_RETRY);
+  datagramTxDrain(&linkB);
+
+  datagramLinkSnapshot(&linkB, &stats);
+  CHECK(stats.flowGrantsSent == 1);
+  CHECK(stats.txDatagrams == 2);
+  
+  datagramLinkSnapshot(&linkA, &stats);
+  CHECK(stats.flowGrantsReceived == 1);
+}
+
+// Both ends limited, a grant uses none of the receiver's window
+
+static void testGrantNotAnswered(void)
+{
+  DgLinkStats_t stats;
+
+  setup();
+  datagramLinkSetFlow(&linkA, 8);
+  datagramLinkSetFlow(&linkB, 8);
+
+  datagramTxStart(&linkA, TEST_HEADER);
+  datagramTxEnd(&linkA);
+
+  datagramLinkSnapshot(&linkB, &stats);
+  CHECK(stats.flowGrantsSent == 1);
+  
+  datagramLinkSnapshot(&linkA, &stats);
+  CHECK(stats.flowGrantsReceived == 1);
+  CHECK(stats.flowGrantsSent == 0);
+}
+
+int main(void)
+{
+  testAnswerWithoutCredit();
+  testGrantAcrossWrap();
+  testGrantRetried();
+  testGrantNotAnswered();
+  
+  return hostTestResult("FlowTest");
+}
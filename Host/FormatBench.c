@@ -0,0 +1,450 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include "StringFmt.h"
+#include "ConsoleHost.h"
+#include "StaP.h"
+
+//
+// Cost of the formatting primitives per call, next to the C library and
+// for integers the conversion they replaced, and of a blob sent to the
+// console host as hex text or as blob datagrams
+//
+//   FormatBench [rounds]
+//
+
+#define BENCH_VALUES   1024
+
+static float floats[BENCH_VALUES];
+static unsigned long integers[BENCH_VALUES];
+static volatile int sink;
+
+static void report(const char *name, uint64_t nanos, uint32_t calls)
+{
+  printf("%-24s %7.1f ns/call\n", name, (double) nanos / calls);
+}
+
+static void benchFP(uint32_t rounds)
+{
+  char buffer[PRINT_FMT_FIELD];
+  uint64_t start = 0;
+  uint32_t r = 0;
+  int i = 0, p = 0;
+
+  for(p = 0; p <= 6; p += 2) {
+    char name[32];
+    
+    start = hostNanos();
+  
+    for(r = 0; r < rounds; r++)
+      for(i = 0; i < BENCH_VALUES; i++)
+	sink += bufferPrintFP(buffer, sizeof(buffer), floats[i], 1, p);
+
+    snprintf(name, sizeof(name), "bufferPrintFP .%d", p);
+    report(name, hostNanos() - start, rounds*BENCH_VALUES);
+
+    start = hostNanos();
+  
+    for(r = 0; r < rounds; r++)
+      for(i = 0; i < BENCH_VALUES; i++)
+	sink += snprintf(buffer, sizeof(buffer), "%.*f", p, (double) floats[i]);
+
+    snprintf(name, sizeof(name), "snprintf %%.%df", p);
+    report(name, hostNanos() - start, rounds*BENCH_VALUES);
+  }
+}
+
+// bufferPrintUL() before it wrote the digits in place, least significant
+// first and then reversed
+
+static int reversePrintUL(char *buf, int size, unsigned long v, uint8_t base, uint8_t p)
+{
+  int l = 0;
+
+  while(l < size) {
+    uint8_t digit = v % base;
+    buf[l++] = digit < 10 ? ('0' + digit) : ('A' + digit - 10);
+    v /= base;
+    
+    if(!v)
+      break;
+  }
+
+  while(l < p)
+    buf[l++] = '0';
+
+  if(l > 0) {
+    int i = 0, j = l-1;
+    while(i < j) {
+      char c = buf[j];
+      buf[j--] = buf[i];
+      buf[i++] = c;
+    }
+  }
+
+  return l;
+}
+
+static void benchIntegers(uint32_t rounds)
+{
+  char buffer[PRINT_FMT_FIELD];
+  uint64_t start = 0;
+  uint32_t r = 0;
+  int i = 0;
+
+  start = hostNanos();
+  
+  for(r = 0; r < rounds; r++)
+    for(i = 0; i < BENCH_VALUES; i++)
+      sink += bufferPrintUL(buffer, sizeof(buffer), integers[i], 10, 1);
+
+  report("bufferPrintUL decimal", hostNanos() - start, rounds*BENCH_VALUES);
+
+  start = hostNanos();
+  
+  for(r = 0; r < rounds; r++)
+    for(i = 0; i < BENCH_VALUES; i++)
+      sink += reversePrintUL(buffer, sizeof(buffer), integers[i], 10, 1);
+
+  report("  reversed, decimal", hostNanos() - start, rounds*BENCH_VALUES);
+
+  start = hostNanos();
+  
+  for(r = 0; r < rounds; r++)
+    for(i = 0; i < BENCH_VALUES; i++)
+      sink += snprintf(buffer, sizeof(buffer), "%lu", integers[i]);
+
+  report("snprintf %lu", hostNanos() - start, rounds*BENCH_VALUES);
+  
+  start = hostNanos();
+  
+  for(r = 0; r < rounds; r++)
+    for(i = 0; i < BENCH_VALUES; i++)
+      sink += bufferPrintL(buffer, sizeof(buffer), (long) integers[i] - 0x8000, 10, 1);
+
+  report("bufferPrintL decimal", hostNanos() - start, rounds*BENCH_VALUES);
+
+  start = hostNanos();
+  
+  for(r = 0; r < rounds; r++)
+    for(i = 0; i < BENCH_VALUES; i++)
+      sink += bufferPrintUL(buffer, sizeof(buffer), integers[i], 16, 8);
+
+  report("bufferPrintUL hex", hostNanos() - start, rounds*BENCH_VALUES);
+
+  start = hostNanos();
+  
+  for(r = 0; r < rounds; r++)
+    for(i = 0; i < BENCH_VALUES; i++)
+      sink += reversePrintUL(buffer, sizeof(buffer), integers[i], 16, 8);
+
+  report("  reversed, hex", hostNanos() - start, rounds*BENCH_VALUES);
+
+  start = hostNanos();
+  
+  for(r = 0; r < rounds; r++)
+    for(i = 0; i < BENCH_VALUES; i++)
+      sink += snprintf(buffer, sizeof(buffer), "%08lX", integers[i]);
+
+  report("snprintf %08lX", hostNanos() - start, rounds*BENCH_VALUES);
+}
+
+static void benchHex(uint32_t rounds)
+{
+  static uint8_t blob[1024];
+  static char buffer[2*sizeof(blob)+1];
+  uint64_t start = 0;
+  uint32_t r = 0;
+  size_t i = 0;
+
+  for(i = 0; i < sizeof(blob); i++)
+    blob[i] = rand();
+  
+  start = hostNanos();
+  
+  for(r = 0; r < rounds; r++)
+    sink += bufferPrintHex(buffer, sizeof(buffer), blob, sizeof(blob));
+
+  report("bufferPrintHex 1 kB", hostNanos() - start, rounds);
+  
+  start = hostNanos();
+  
+  for(r = 0; r < rounds; r++)
+    for(i = 0; i < sizeof(blob); i++)
+      sink += snprintf(&buffer[2*i], 3, "%.2X", blob[i]);
+
+  report("snprintf %.2X 1 kB", hostNanos() - start, rounds);
+}
+
+// The console link, the host end decodes only when asked to
+
+static DgLink_t benchFirmware, benchHost;
+static uint64_t wireBytes;
+static bool wireDecode;
+
+static void wireOut(void *context, const uint8_t *data, size_t size)
+{
+  (void) context;
+
+  wireBytes += size;
+
+  if(wireDecode)
+    datagramRxInput(&benchHost, data, size);
+}
+
+static void hostOut(void *context, const uint8_t *data, size_t size)
+{
+  (void) context;
+  (void) data;
+  (void) size;
+}
+
+static void discardText(void *context, const char *text, size_t size)
+{
+  (void) context;
+  (void) text;
+
+  sink += size;
+}
+
+// What consolePrintBlob() sends in text mode, the ring flushed in full
+// datagrams
+
+static void blobHex(const uint8_t *data, size_t size)
+{
+  char buffer[DG_TRANSMIT_MAX];
+  size_t i = 0;
+
+  while(i < size) {
+    size_t n = size - i < sizeof(buffer)/2 ? size - i : sizeof(buffer)/2;
+
+    datagramTxStart(&benchFirmware, DG_CONSOLE);
+    datagramTxOut(&benchFirmware, (const uint8_t*) buffer,
+		  bufferPrintHex(buffer, sizeof(buffer), &data[i], n));
+    datagramTxEnd(&benchFirmware);
+    i += n;
+  }
+}
+
+// And with binary logging
+
+static void blobBinary(const char *name, const uint8_t *data, size_t size)
+{
+  size_t nameLen = strlen(name), offset = 0;
+  struct ConsoleBlobHeader header = { .size = size, .nameLen = nameLen };
+  size_t segment = DG_TRANSMIT_MAX - sizeof(header) - nameLen;
+
+  do {
+    size_t len = size - offset < segment ? size - offset : segment;
+
+    header.offset = offset;
+
+    datagramTxStart(&benchFirmware, DG_CONSOLE_BLOB);
+    datagramTxOut(&benchFirmware, (const uint8_t*) &header, sizeof(header));
+    datagramTxOut(&benchFirmware, (const uint8_t*) name, nameLen);
+    datagramTxOut(&benchFirmware, &data[offset], len);
+    datagramTxEnd(&benchFirmware);
+
+    offset += len;
+  } while(offset < size);
+}
+
+static void benchBlob(uint32_t rounds)
+{
+  static uint8_t firmwareStore[DG_TRANSMIT_MAX+0x40], hostStore[DG_TRANSMIT_MAX+0x40];
+  static uint8_t blob[1024];
+  ConsoleHost_t console;
+  uint64_t start = 0;
+  uint32_t r = 0;
+  size_t i = 0;
+  int decode = 0;
+
+  for(i = 0; i < sizeof(blob); i++)
+    blob[i] = rand();
+
+  consoleHostInit(&console, NULL, discardText, NULL);
+  datagramLinkInit(&benchFirmware, 0, firmwareStore, sizeof(firmwareStore), NULL, NULL,
+		   NULL, wireOut, NULL, NULL);
+  datagramLinkInit(&benchHost, 0, hostStore, sizeof(hostStore), &console,
+		   consoleHostDatagram, NULL, hostOut, NULL, NULL);
+
+  // Frames after a pause start with a break
+
+  hostTimeAdvance(1000000);
+
+  printf("Blob of 1 kB to the console host\n");
+
+  for(decode = 0; decode < 2; decode++) {
+    wireDecode = decode;
+
+    wireBytes = 0;
+    start = hostNanos();
+
+    for(r = 0; r < rounds; r++)
+      blobHex(blob, sizeof(blob));
+
+    printf("  %-22s %7.2f ns/byte %5.2f wire bytes/byte\n",
+	   decode ? "hex text, decoded" : "hex text",
+	   (double) (hostNanos() - start) / rounds / sizeof(blob),
+	   (double) wireBytes / rounds / sizeof(blob));
+
+    wireBytes = 0;
+    start = hostNanos();
+
+    for(r = 0; r < rounds; r++)
+      blobBinary("blob", blob, sizeof(blob));
+
+    printf("  %-22s %7.2f ns/byte %5.2f wire bytes/byte\n",
+	   decode ? "blob datagrams, decoded" : "blob datagrams",
+	   (double) (hostNanos() - start) / rounds / sizeof(blob),
+	   (double) wireBytes / rounds / sizeof(blob));
+  }
+
+  if(console.blobs != rounds)
+    printf("  %u of %u blobs decoded\n", (unsigned) console.blobs, (unsigned) rounds);
+}
+
+static void countSink(void *context, const char *data, int size)
+{
+  (void) context;
+  (void) data;
+  
+  sink += size;
+}
+
+static int viaParse(char *buffer, int size, const char *f, ...)
+{
+  va_list args;
+  int len = 0;
+  
+  va_start(args, f);
+  len = vStringFmt(buffer, size, f, args);
+  va_end(args);
+
+  return len;
+}
+
+static int viaSink(const char *f, ...)
+{
+  va_list args;
+  int len = 0;
+  
+  va_start(args, f);
+  len = vStringFmtSink(countSink, NULL, PRINT_FMT_FIELD*4, f, args);
+  va_end(args);
+
+  return len;
+}
+
+static int viaCache(const char *f, ...)
+{
+  va_list args;
+  int len = 0;
+  
+  va_start(args, f);
+  len = vStringFmtSinkCached(countSink, NULL, PRINT_FMT_FIELD*4, f, args);
+  va_end(args);
+
+  return len;
+}
+
+static int viaCompiled(const StringFmtCompiled_t *c, ...)
+{
+  va_list args;
+  int len = 0;
+  
+  va_start(args, c);
+  len = vStringFmtCompiled(countSink, NULL, PRINT_FMT_FIELD*4, c, args);
+  va_end(args);
+
+  return len;
+}
+
+static void benchFormats(uint32_t rounds)
+{
+  static const char *formats[] = {
+    "Sensor status: link %d, errors %d, state %d, retries %d\n",
+    "%d,%d,%d,%d"
+  };
+  char buffer[PRINT_FMT_FIELD*4], name[32];
+  StringFmtCompiled_t compiled;
+  uint64_t start = 0;
+  uint32_t r = 0;
+  size_t f = 0;
+  int i = 0;
+
+  for(f = 0; f < sizeof(formats)/sizeof(formats[0]); f++) {
+    const char *format = formats[f];
+
+    printf("\"%.20s...\"\n", format);
+    
+    start = hostNanos();
+  
+    for(r = 0; r < rounds; r++)
+      for(i = 0; i < BENCH_VALUES; i++)
+	sink += viaParse(buffer, sizeof(buffer), format, i, -i, 7, i>>3);
+
+    report("  parsed every call", hostNanos() - start, rounds*BENCH_VALUES);
+    
+    start = hostNanos();
+  
+    for(r = 0; r < rounds; r++)
+      for(i = 0; i < BENCH_VALUES; i++)
+	sink += viaSink(format, i, -i, 7, i>>3);
+
+    report("  sink, parsed", hostNanos() - start, rounds*BENCH_VALUES);
+    
+    start = hostNanos();
+  
+    for(r = 0; r < rounds; r++)
+      for(i = 0; i < BENCH_VALUES; i++)
+	sink += viaCache(format, i, -i, 7, i>>3);
+
+    snprintf(name, sizeof(name), "  sink, cache of %d", STRING_FMT_CACHE_SLOTS);
+    report(name, hostNanos() - start, rounds*BENCH_VALUES);
+    
+    if(!stringFmtCompile(&compiled, format))
+      continue;
+    
+    start = hostNanos();
+  
+    for(r = 0; r < rounds; r++)
+      for(i = 0; i < BENCH_VALUES; i++)
+	sink += viaCompiled(&compiled, i, -i, 7, i>>3);
+
+    report("  compiled once", hostNanos() - start, rounds*BENCH_VALUES);
+    
+    start = hostNanos();
+  
+    for(r = 0; r < rounds; r++)
+      for(i = 0; i < BENCH_VALUES; i++)
+	sink += snprintf(buffer, sizeof(buffer), format, i, -i, 7, i>>3);
+
+    report("  snprintf", hostNanos() - start, rounds*BENCH_VALUES);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t rounds = argc > 1 ? atoi(argv[1]) : 1000;
+  int i = 0;
+
+  srand(1);
+  
+  for(i = 0; i < BENCH_VALUES; i++)
+    floats[i] = (rand() / (float) RAND_MAX - 0.5f) * 2000;
+
+  // Spread over the digit counts
+  
+  for(i = 0; i < BENCH_VALUES; i++)
+    integers[i] = (unsigned long) rand() >> (rand() % 31);
+
+  benchFP(rounds);
+  benchIntegers(rounds);
+  benchHex(rounds);
+  benchFormats(rounds);
+  benchBlob(rounds);
+  
+  return 0;
+}
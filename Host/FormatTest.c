@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include "StringFmt.h"
+#include "HostTest.h"
+
+//
+// bufferPrintFP() against the C library's "%.*f" for finite floats, every
+// stride'th bit pattern with precisions 0-9 and a dense sweep of [0, 1024)
+// in both signs. The default stride keeps it quick, 1 checks all of them.
+// bufferPrintUL() in decimal and hex around the digit count boundaries,
+// bufferPrintHex() over every byte value and the streaming formatter with
+// a format rebuilt in the same buffer.
+//
+//   FormatTest [stride]
+//
+
+static unsigned long checked, differences;
+
+static void check(float v, int p)
+{
+  char ours[PRINT_FMT_FIELD+1], libc[PRINT_FMT_FIELD+1];
+  int len = bufferPrintFP(ours, sizeof(ours)-1, v, 1, p);
+
+  ours[len] = '\0';
+  snprintf(libc, sizeof(libc), "%.*f", p, (double) v);
+  checked++;
+
+  if(strcmp(ours, libc)) {
+    if(differences++ < 10)
+      printf("%a with %d decimals: \"%s\", expected \"%s\"\n", v, p, ours, libc);
+  }
+}
+
+static void checkInteger(unsigned long v, int p)
+{
+  char ours[PRINT_FMT_FIELD+1], libc[PRINT_FMT_FIELD+1];
+  int len = bufferPrintUL(ours, sizeof(ours)-1, v, 10, p);
+
+  ours[len] = '\0';
+  snprintf(libc, sizeof(libc), "%0*lu", p, v);
+  checked++;
+  
+  if(strcmp(ours, libc) && differences++ < 10)
+    printf("%lu with %d digits: \"%s\", expected \"%s\"\n", v, p, ours, libc);
+
+  len = bufferPrintUL(ours, sizeof(ours)-1, v, 16, p);
+  ours[len] = '\0';
+  snprintf(libc, sizeof(libc), "%0*lX", p, v);
+  checked++;
+  
+  if(strcmp(ours, libc) && differences++ < 10)
+    printf("%lX hex with %d digits: \"%s\", expected \"%s\"\n", v, p, ours, libc);
+}
+
+static void checkHex(void)
+{
+  uint8_t data[256];
+  char ours[2*sizeof(data)], libc[2*sizeof(data)+1];
+  int i = 0;
+
+  for(i = 0; i < (int) sizeof(data); i++) {
+    data[i] = i;
+    snprintf(&libc[2*i], 3, "%.2X", i);
+  }
+
+  checked++;
+  
+  if(bufferPrintHex(ours, sizeof(ours), data, sizeof(data)) != (int) sizeof(ours)
+     || memcmp(ours, libc, sizeof(ours))) {
+    printf("bufferPrintHex() differs\n");
+    differences++;
+  }
+
+  // Only whole bytes
+  
+  checked++;
+  
+  if(bufferPrintHex(ours, 5, data, sizeof(data)) != 4) {
+    printf("bufferPrintHex() split a byte\n");
+    differences++;
+  }
+}
+
+typedef struct {
+  char b[PRINT_FMT_FIELD];
+  int len;
+} SinkBuffer_t;
+
+static void bufferSink(void *context, const char *data, int size)
+{
+  SinkBuffer_t *buffer = (SinkBuffer_t*) context;
+
+  memcpy(&buffer->b[buffer->len], data, size);
+  buffer->len += size;
+}
+
+static void checkSink(bool cached, const char *expected, const char *f, ...)
+{
+  SinkBuffer_t buffer = { .len = 0 };
+  va_list args;
+
+  va_start(args, f);
+
+  if(cached)
+    vStringFmtSinkCached(bufferSink, &buffer, sizeof(buffer.b) - 1, f, args);
+  else
+    vStringFmtSink(bufferSink, &buffer, sizeof(buffer.b) - 1, f, args);
+
+  va_end(args);
+
+  buffer.b[buffer.len] = '\0';
+  checked++;
+
+  if(strcmp(buffer.b, expected)) {
+    printf("\"%s\" gave \"%s\", expected \"%s\"\n", f, buffer.b, expected);
+    differences++;
+  }
+}
+
+static void checkReusedFormat(void)
+{
+  char format[16];
+
+  // The same address, different conversions
+  
+  strcpy(format, "%d-%s");
+  checkSink(false, "42-x", format, 42, "x");
+  strcpy(format, "%s-%d");
+  checkSink(false, "x-42", format, "x", 42);
+
+  // Literals are what the cache is for
+  
+  checkSink(true, "42-x", "%d-%s", 42, "x");
+  checkSink(true, "x-42", "%s-%d", "x", 42);
+  checkSink(true, "42-x", "%d-%s", 42, "x");
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t stride = argc > 1 ? strtoul(argv[1], NULL, 0) : 99991;
+  uint64_t bits = 0;
+  unsigned long v = 0;
+  int i = 0;
+  union {
+    float f;
+    uint32_t u;
+  } x;
+
+  if(stride == 0)
+    stride = 1;
+  
+  for(bits = 0; bits < 0x100000000ULL; bits += stride) {
+    x.u = (uint32_t) bits;
+
+    if(((x.u>>23) & 0xFF) == 0xFF)
+      // Infinities and NaNs
+      continue;
+
+    check(x.f, bits % 10);
+  }
+
+  for(x.f = 0; x.f < 1024.0f; x.u += stride/64 + 1) {
+    check(x.f, 2);
+    check(-x.f, 5);
+  }
+
+  // Ties and carries
+
+  check(0.5f, 0);
+  check(1.5f, 0);
+  check(2.5f, 0);
+  check(0.125f, 2);
+  check(0.375f, 2);
+  check(9.995f, 2);
+  check(999999.9f, 0);
+  check(-0.0f, 2);
+  check(-0.001f, 2);
+  check(3.4028235e38f, 3);
+  check(1.4e-45f, 9);
+  
+  // Integers around every power of two and ten
+
+  for(i = 0; i < 64; i++) {
+    unsigned long v = 1UL << (i % (8*sizeof(long)));
+    
+    checkInteger(v - 1, i % 12);
+    checkInteger(v, i % 12);
+  }
+
+  for(v = 1, i = 0; i < 20; i++, v *= 10) {
+    checkInteger(v - 1, 1);
+    checkInteger(v, 1);
+    checkInteger(v + 1, 0);
+  }
+  
+  checkHex();
+  checkReusedFormat();
+  
+  printf("%lu checked, %lu different\n", checked, differences);
+
+  CHECK(differences == 0);
+  
+  return hostTestResult("FormatTest");
+}
@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Datagram.h"
+#include "FramingRef.h"
+
+//
+// Framing overhead and encode/decode throughput of typical payloads with
+// zero run escaping and COBS, the largest frame next to the COBS bound.
+// The encoded stream is decoded whole and again in random pieces of 1 to
+// 37 bytes like a UART would deliver it, escaped frames also by the byte
+// at a time decoder the bulk one replaced.
+//
+//   FramingBench [frames]
+//
+
+#define BENCH_HEADER   DG_TELEMLINK
+#define BENCH_CHUNK    37
+
+typedef struct Capture {
+  uint8_t *buffer;
+  size_t size, len, frame, frameMax;
+} Capture_t;
+
+static uint32_t random32;
+static uint32_t delivered, damaged;
+static uint8_t expected[DG_TRANSMIT_MAX];
+static size_t expectedSize;
+
+static uint32_t nextRandom(void)
+{
+  // xorshift32
+  
+  random32 ^= random32 << 13;
+  random32 ^= random32 >> 17;
+  random32 ^= random32 << 5;
+  
+  return random32;
+}
+
+static size_t generate(int mix, uint8_t *p)
+{
+  size_t i = 0;
+  
+  switch(mix) {
+  case 0:
+    // IMU, small int16 values
+    for(i = 0; i < 12; i++) {
+      int16_t v = (int16_t) (nextRandom() % 64) - 32;
+      memcpy(&p[2*i], &v, sizeof(v));
+    }
+    return 24;
+    
+  case 1:
+    // Air data
+    for(i = 0; i < 3; i++) {
+      int16_t v = (int16_t) (nextRandom() % 2000);
+      memcpy(&p[2*i], &v, sizeof(v));
+    }
+    return 6;
+
+  case 2:
+    // Position, int32
+    for(i = 0; i < 6; i++) {
+      int32_t v = (int32_t) (nextRandom() % 100000) - 50000;
+      memcpy(&p[4*i], &v, sizeof(v));
+    }
+    return 24;
+
+  case 3:
+    for(i = 0; i < 128; i++)
+      p[i] = nextRandom();
+    return 128;
+
+  case 4:
+    for(i = 0; i < 500; i++)
+      p[i] = i % 7 ? nextRandom() : 0;
+    return 500;
+
+  default:
+    memset(p, '\0', 64);
+    return 64;
+  }
+}
+
+static const char *mixName[] = {
+  "IMU int16", "air data 6 B", "position int32", "random 128 B",
+  "500 B, 1/7 zeros", "all-zero 64 B"
+};
+
+#define MIXES  (sizeof(mixName)/sizeof(mixName[0]))
+
+static void captureOut(void *context, const uint8_t *data, size_t size)
+{
+  Capture_t *capture = (Capture_t*) context;
+
+  if(capture->len + size <= capture->size) {
+    memcpy(&capture->buffer[capture->len], data, size);
+    capture->len += size;
+  }
+
+  capture->frame += size;
+}
+
+static void captureEnd(void *context)
+{
+  Capture_t *capture = (Capture_t*) context;
+
+  if(capture->frame > capture->frameMax)
+    capture->frameMax = capture->frame;
+
+  capture->frame = 0;
+}
+
+static void discard(void *context, const uint8_t *data, size_t size)
+{
+  (void) context;
+  (void) data;
+  (void) size;
+}
+
+static void receive(void *context, uint8_t node, const uint8_t *data, size_t size)
+{
+  (void) context;
+  (void) node;
+
+  // Every frame of a run is the same, the check is cheap
+  
+  if(size == expectedSize && !memcmp(data, expected, size))
+    delivered++;
+  else
+    damaged++;
+}
+
+static void run(int mix, bool cobs, uint32_t frames)
+{
+  static uint8_t txRxStore[DG_TRANSMIT_MAX+0x40], rxStore[DG_TRANSMIT_MAX+0x40];
+  static uint8_t txStage[DG_TX_STAGE_SIZE], rxStage[DG_TX_STAGE_SIZE];
+  static uint8_t refStore[DG_TRANSMIT_MAX+0x40];
+  uint8_t payload[DG_TRANSMIT_MAX];
+  size_t size = 0, offset = 0;
+  DgLink_t tx, rx;
+  FramingRef_t ref;
+  Capture_t capture;
+  uint64_t start = 0, encode = 0, decode = 0, decodeChunked = 0, decodeRef = 0;
+  uint32_t i = 0, expectedFrames = 2*frames;
+  char refRate[16] = "-";
+
+  random32 = 1 + mix;
+  size = generate(mix, payload);
+  expected[0] = BENCH_HEADER;
+  memcpy(&expected[1], payload, size);
+  expectedSize = size + 1;
+  
+  memset((void*) &capture, '\0', sizeof(capture));
+  capture.size = (size_t) frames * DG_FRAME_ENCODED_MAX(size+1);
+
+  if(!(capture.buffer = malloc(capture.size)))
+    return;
+  
+  datagramLinkInit(&tx, 0, txRxStore, sizeof(txRxStore), &capture, NULL, NULL,
+		   captureOut, NULL, captureEnd);
+  datagramLinkSetTxStage(&tx, txStage, sizeof(txStage));
+  datagramLinkSetCobs(&tx, cobs);
+  datagramLinkInit(&rx, 0, rxStore, sizeof(rxStore), NULL, receive, NULL,
+		   discard, NULL, NULL);
+  datagramLinkSetTxStage(&rx, rxStage, sizeof(rxStage));
+  datagramLinkSetCobs(&rx, cobs);
+
+  start = hostNanos();
+  
+  for(i = 0; i < frames; i++) {
+    datagramTxStart(&tx, BENCH_HEADER);
+    datagramTxOut(&tx, payload, size);
+    datagramTxEnd(&tx);
+  }
+
+  encode = hostNanos() - start;
+
+  delivered = damaged = 0;
+  start = hostNanos();
+  datagramRxInput(&rx, capture.buffer, capture.len);
+  decode = hostNanos() - start;
+
+  start = hostNanos();
+  
+  while(offset < capture.len) {
+    size_t chunk = 1 + nextRandom() % BENCH_CHUNK;
+
+    if(chunk > capture.len - offset)
+      chunk = capture.len - offset;
+    
+    datagramRxInput(&rx, &capture.buffer[offset], chunk);
+    offset += chunk;
+  }
+
+  decodeChunked = hostNanos() - start;
+
+  if(!cobs) {
+    framingRefInit(&ref, 0, refStore, sizeof(refStore), NULL, receive);
+    
+    start = hostNanos();
+    framingRefInput(&ref, capture.buffer, capture.len);
+    decodeRef = hostNanos() - start;
+
+    snprintf(refRate, sizeof(refRate), "%.1f",
+	     (double) frames * expectedSize * 1e3 / decodeRef);
+    expectedFrames += frames;
+  }
+  
+  printf("%-16s %-6s %6.1f%% %4u B (%4u) %7.1f %7.1f %7.1f %7s MB/s %s\n",
+	 mixName[mix], cobs ? "COBS" : "escape",
+	 100.0 * ((double) capture.len / frames - expectedSize) / expectedSize,
+	 (unsigned) capture.frameMax, (unsigned) DG_COBS_ENCODED_SIZE(expectedSize),
+	 (double) frames * expectedSize * 1e3 / encode,
+	 (double) frames * expectedSize * 1e3 / decode,
+	 (double) frames * expectedSize * 1e3 / decodeChunked, refRate,
+	 delivered == expectedFrames && damaged == 0 ? "" : "LOSS");
+
+  free(capture.buffer);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t frames = argc > 1 ? atoi(argv[1]) : 40000;
+  size_t mix = 0;
+
+  // Frames sent after a pause start with a break, this isn't one
+  
+  hostTimeAdvance(1000000);
+  
+  printf("%-16s %-6s %7s %6s %6s %7s %7s %7s %7s\n", "payload", "mode", "ovh", "max",
+	 "(COBS)", "encode", "decode", "chunked", "bytewise");
+  
+  for(mix = 0; mix < MIXES; mix++) {
+    run(mix, false, frames);
+    run(mix, true, frames);
+  }
+
+  return 0;
+}
@@ -0,0 +1,83 @@
+#include <string.h>
+#include "FramingRef.h"
+#include "Datagram.h"
+#include "AlphaLink.h"
+#include "CRC16.h"
+
+#define FLAG        ((uint8_t) 0x00)
+
+void framingRefInit(FramingRef_t *ref, uint8_t node, uint8_t *rxStore, size_t rxSize,
+		    void *context,
+		    void (*rxHandler)(void*, uint8_t node, const uint8_t *data, size_t))
+{
+  memset((void*) ref, '\0', sizeof(FramingRef_t));
+
+  ref->node = node;
+  ref->rxStore = rxStore;
+  ref->rxStoreSize = rxSize;
+  ref->context = context;
+  ref->rxHandler = rxHandler;
+}
+
+static void storeByte(FramingRef_t *ref, const uint8_t c)
+{
+  if(ref->datagramSize < ref->rxStoreSize)
+    ref->rxStore[ref->datagramSize++] = c;
+  else
+    ref->overflow = true;
+}
+
+static void handleBreak(FramingRef_t *ref)
+{
+  if(ref->overflow) {
+    ref->overflows++;
+    return;
+  }
+
+  if(ref->datagramSize >= 1+sizeof(uint16_t)) {
+    uint16_t crc = ((uint16_t) ref->rxStore[ref->datagramSize-1]<<8)
+      | ref->rxStore[ref->datagramSize-2];
+    int payload = (int) ref->datagramSize - sizeof(crc);
+
+    if(crc == crc16(ref->crcStateRx, ref->rxStore, payload)) {
+      if(ref->rxHandler)
+	(*ref->rxHandler)(ref->context, ref->rxNode, &ref->rxStore[1], payload-1);
+    } else
+      ref->crcErrors++;
+  }
+}
+
+void framingRefInput(FramingRef_t *ref, const uint8_t *buffer, size_t size)
+{
+  while(size-- > 0) {
+    uint8_t c = *buffer++;
+
+    if(c != FLAG) {
+      if(ref->overflow) {
+	// Ignore the rest
+      } else if(ref->rxBusy) {
+	if(ref->node == 0 || ref->rxNode == ref->node || ref->rxNode == ALN_BROADCAST) {
+	  if(ref->flagCnt) {
+	    while(c-- != FLAG)
+	      storeByte(ref, FLAG);
+	  } else
+	    storeByte(ref, c);
+	}
+      } else {
+	ref->rxNode = (~FLAG) - c;
+
+	if(ref->rxNode < DG_MAX_NODES) {
+	  ref->rxBusy = true;
+	  ref->crcStateRx = crc16_update(0xFFFF, c);
+	  ref->datagramSize = 0;
+	}
+      }
+
+      ref->flagCnt = 0;
+    } else if(++ref->flagCnt > 1 && ref->rxBusy) {
+      if(ref->node == 0 || ref->rxNode == ref->node || ref->rxNode == ALN_BROADCAST)
+	handleBreak(ref);
+      ref->rxBusy = ref->overflow = false;
+    }
+  }
+}
@@ -0,0 +1,239 @@
+#include <stdlib.h>
+#include <string.h>
+#include "Datagram.h"
+#include "FramingRef.h"
+#include "HostTest.h"
+
+//
+// Both framings with random payloads of every size, random runs of
+// zeros and random reception chunks, through a COBS stage smaller than
+// the frames. Every frame must arrive intact, COBS frames within
+// DG_COBS_ENCODED_SIZE() and a corrupted frame must not take the next one
+// with it. Escaped streams, clean and corrupted, must come out of the bulk
+// decoder exactly as out of the byte at a time one it replaced.
+//
+
+#define TEST_FRAMES    3000
+#define TEST_CHUNK     37
+#define TEST_LOG       0x1000
+
+static DgLink_t tx, rx;
+static uint8_t wire[DG_FRAME_ENCODED_MAX(DG_TRANSMIT_MAX+1)];
+static size_t wireLen;
+static uint8_t expected[DG_TRANSMIT_MAX+1];
+static size_t expectedSize;
+static int delivered, damaged;
+
+// What each decoder delivered, as node | size | data
+
+typedef struct TestLog {
+  uint8_t data[TEST_LOG];
+  size_t len;
+} TestLog_t;
+
+static TestLog_t bulkLog, refLog;
+
+static void captureOut(void *context, const uint8_t *data, size_t size)
+{
+  (void) context;
+  
+  if(wireLen + size <= sizeof(wire)) {
+    memcpy(&wire[wireLen], data, size);
+    wireLen += size;
+  }
+}
+
+static void discard(void *context, const uint8_t *data, size_t size)
+{
+  (void) context;
+  (void) data;
+  (void) size;
+}
+
+static void receive(void *context, uint8_t node, const uint8_t *data, size_t size)
+{
+  (void) context;
+  (void) node;
+  
+  if(size == expectedSize && !memcmp(data, expected, size))
+    delivered++;
+  else
+    damaged++;
+}
+
+static void logFrame(void *context, uint8_t node, const uint8_t *data, size_t size)
+{
+  TestLog_t *log = (TestLog_t*) context;
+  uint16_t len = size;
+
+  if(log->len + 1 + sizeof(len) + size > sizeof(log->data))
+    return;
+
+  log->data[log->len++] = node;
+  memcpy(&log->data[log->len], &len, sizeof(len));
+  log->len += sizeof(len);
+  memcpy(&log->data[log->len], data, size);
+  log->len += size;
+}
+
+static void setup(bool cobs)
+{
+  static uint8_t txRxStore[DG_TRANSMIT_MAX+0x40], rxStore[DG_TRANSMIT_MAX+0x40];
+  static uint8_t txStage[DG_COBS_STAGE_MIN], rxStage[DG_COBS_STAGE_MIN];
+  
+  datagramLinkInit(&tx, 0, txRxStore, sizeof(txRxStore), NULL, NULL, NULL,
+		   captureOut, NULL, NULL);
+  datagramLinkSetTxStage(&tx, txStage, sizeof(txStage));
+  CHECK(datagramLinkSetCobs(&tx, cobs));
+  datagramLinkInit(&rx, 0, rxStore, sizeof(rxStore), NULL, receive, NULL,
+		   discard, NULL, NULL);
+  datagramLinkSetTxStage(&rx, rxStage, sizeof(rxStage));
+  CHECK(datagramLinkSetCobs(&rx, cobs));
+  delivered = damaged = 0;
+}
+
+static void encode(void)
+{
+  size_t size = rand() % DG_TRANSMIT_MAX, i = 0;
+  int zeros = rand() % 4;
+  
+  for(i = 0; i < size; i++)
+    // From no zeros at all to mostly zeros
+    expected[1+i] = rand() % 4 < zeros ? 0 : rand();
+
+  expected[0] = DG_HOSTLINK;
+  expectedSize = size + 1;
+  wireLen = 0;
+  
+  datagramTxStart(&tx, DG_HOSTLINK);
+  datagramTxOut(&tx, &expected[1], size);
+  datagramTxEnd(&tx);
+}
+
+static void decode(void)
+{
+  size_t offset = 0;
+  
+  while(offset < wireLen) {
+    size_t chunk = 1 + rand() % TEST_CHUNK;
+
+    if(chunk > wireLen - offset)
+      chunk = wireLen - offset;
+    
+    datagramRxInput(&rx, &wire[offset], chunk);
+    offset += chunk;
+  }
+}
+
+static void testIntact(bool cobs)
+{
+  int i = 0, frames = 0;
+  
+  setup(cobs);
+  
+  for(i = 0; i < TEST_FRAMES; i++) {
+    encode();
+
+    if(cobs)
+      // A break on the first frame
+      CHECK(wireLen <= DG_COBS_ENCODED_SIZE(expectedSize) + (i == 0 ? 1 : 0));
+    
+    decode();
+    frames++;
+  }
+
+  CHECK(delivered == frames);
+  CHECK(damaged == 0);
+}
+
+static void testCorrupted(bool cobs)
+{
+  int i = 0, before = 0;
+  
+  setup(cobs);
+  
+  for(i = 0; i < TEST_FRAMES/10; i++) {
+    encode();
+
+    if(wireLen > 4)
+      wire[2 + rand() % (wireLen - 4)] ^= 1 << (rand() % 8);
+    
+    decode();
+
+    // A flip of a delimiter or a padding byte may well go unnoticed,
+    // what matters is the frame following it
+    
+    before = delivered;
+    
+    encode();
+    decode();
+    
+    CHECK(delivered == before + 1);
+  }
+
+  CHECK(damaged == 0);
+}
+
+static void testReference(void)
+{
+  static uint8_t rxStore[DG_TRANSMIT_MAX+0x40], refStore[DG_TRANSMIT_MAX+0x40];
+  DgLinkStats_t stats;
+  FramingRef_t ref;
+  int i = 0;
+
+  setup(false);
+  datagramLinkInit(&rx, 0, rxStore, sizeof(rxStore), &bulkLog, logFrame, NULL,
+		   discard, NULL, NULL);
+  framingRefInit(&ref, 0, refStore, sizeof(refStore), &refLog, logFrame);
+
+  for(i = 0; i < TEST_FRAMES; i++) {
+    bulkLog.len = refLog.len = 0;
+    encode();
+
+    // Every other frame damaged, now and then a delimiter dropped or
+    // made up
+
+    if(i & 1 && wireLen > 4) {
+      size_t at = 2 + rand() % (wireLen - 4);
+
+      switch(rand() % 4) {
+      case 0:
+	memmove(&wire[at], &wire[at+1], --wireLen - at);
+	break;
+      case 1:
+	wire[at] = 0;
+	break;
+      default:
+	wire[at] ^= 1 << (rand() % 8);
+	break;
+      }
+    }
+
+    decode();
+    framingRefInput(&ref, wire, wireLen);
+
+    CHECK(bulkLog.len == refLog.len);
+    CHECK(!memcmp(bulkLog.data, refLog.data, bulkLog.len));
+  }
+
+  datagramLinkSnapshot(&rx, &stats);
+  CHECK(stats.crcErrors == ref.crcErrors);
+  CHECK(stats.crcErrors > 0);
+}
+
+int main(void)
+{
+  srand(1);
+
+  // Frames sent after a pause start with a break, let there be one
+  
+  hostTimeAdvance(1000000);
+  
+  testIntact(false);
+  testIntact(true);
+  testCorrupted(false);
+  testCorrupted(true);
+  testReference();
+  
+  return hostTestResult("FramingTest");
+}
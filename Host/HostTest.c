@@ -0,0 +1,14 @@
+#include "HostTest.h"
+
+int hostTestFailures;
+
+int hostTestResult(const char *name)
+{
+  if(hostTestFailures > 0) {
+    printf("%s: %d check(s) failed\n", name, hostTestFailures);
+    return 1;
+  }
+
+  printf("%s: OK\n", name);
+  return 0;
+}
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "PRNG.h"
+#include "CRC16.h"
+#include "StaP.h"
+
+//
+// Random number generator rate, in blocks and a word at a time, next to
+// the CRC stepped generator it replaced, and the chi-square of the byte
+// distribution as a sanity check (255 degrees of freedom, expect about
+// 255 +- 23)
+//
+//   PrngBench [megabytes]
+//
+
+#define BENCH_BLOCK    4096
+
+// The previous generator, a CRC step per byte on a shared 16-bit state
+
+static uint16_t crcState;
+
+static void crcEntropyInput(uint16_t input)
+{
+  crcState = crc16_update(crcState, input);
+}
+
+static void crcNumber(uint8_t *buffer, size_t size)
+{
+  while(size-- > 0) {
+    crcState = crc16_update(crcState, 0xFF);
+    *buffer++ = crcState & 0xFF;
+  }
+}
+
+static uint8_t crcUI8(void)
+{
+  uint8_t value = 0;
+  crcNumber(&value, sizeof(value));
+  return value;
+}
+
+static double chiSquare(void (*fill)(uint8_t*, size_t), uint32_t rounds)
+{
+  static uint8_t block[BENCH_BLOCK];
+  uint64_t count[256] = { 0 }, total = 0;
+  double chi = 0, expected = 0;
+  uint32_t r = 0, i = 0;
+
+  for(r = 0; r < rounds; r++) {
+    (*fill)(block, sizeof(block));
+
+    for(i = 0; i < BENCH_BLOCK; i++)
+      count[block[i]]++;
+
+    total += BENCH_BLOCK;
+  }
+
+  expected = total / 256.0;
+  
+  for(i = 0; i < 256; i++)
+    chi += (count[i] - expected) * (count[i] - expected) / expected;
+
+  return chi;
+}
+
+int main(int argc, char **argv)
+{
+  static uint8_t block[BENCH_BLOCK];
+  uint32_t megabytes = argc > 1 ? atoi(argv[1]) : 64;
+  uint32_t rounds = megabytes * ((1<<20) / BENCH_BLOCK), r = 0, i = 0;
+  uint64_t start = 0;
+  volatile uint32_t sink = 0;
+
+  randomEntropyInput(0x1234);
+  crcEntropyInput(0x1234);
+  
+  start = hostNanos();
+
+  for(r = 0; r < rounds; r++)
+    randomNumber(block, sizeof(block));
+
+  printf("randomNumber %u B  %8.1f MB/s\n", BENCH_BLOCK,
+	 (double) rounds * BENCH_BLOCK * 1e3 / (hostNanos() - start));
+
+  start = hostNanos();
+
+  for(r = 0; r < rounds; r++)
+    for(i = 0; i < BENCH_BLOCK/sizeof(uint32_t); i++)
+      sink += randomUI32();
+
+  printf("randomUI32         %8.1f MB/s\n",
+	 (double) rounds * BENCH_BLOCK * 1e3 / (hostNanos() - start));
+
+  start = hostNanos();
+
+  for(r = 0; r < rounds; r++)
+    for(i = 0; i < BENCH_BLOCK; i++)
+      sink += randomUI8();
+
+  printf("randomUI8          %8.1f MB/s\n",
+	 (double) rounds * BENCH_BLOCK * 1e3 / (hostNanos() - start));
+
+  start = hostNanos();
+
+  for(r = 0; r < rounds; r++)
+    crcNumber(block, sizeof(block));
+
+  printf("CRC stepped %u B   %8.1f MB/s\n", BENCH_BLOCK,
+	 (double) rounds * BENCH_BLOCK * 1e3 / (hostNanos() - start));
+
+  start = hostNanos();
+
+  for(r = 0; r < rounds; r++)
+    for(i = 0; i < BENCH_BLOCK; i++)
+      sink += crcUI8();
+
+  printf("CRC stepped UI8    %8.1f MB/s\n",
+	 (double) rounds * BENCH_BLOCK * 1e3 / (hostNanos() - start));
+
+  printf("chi-square over %llu bytes %.1f, CRC stepped %.1f\n",
+	 (unsigned long long) (rounds/16 + 1) * BENCH_BLOCK,
+	 chiSquare(randomNumber, rounds/16 + 1), chiSquare(crcNumber, rounds/16 + 1));
+  
+  return 0;
+}
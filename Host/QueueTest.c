@@ -0,0 +1,147 @@
+#include <string.h>
+#include "Datagram.h"
+#include "HostTest.h"
+
+//
+// Queued transmission of datagrams up to the maximum size, and what
+// becomes of the starts when the pool has run out
+//
+
+#define QUEUE_FRAMES   4
+
+typedef struct Received {
+  uint8_t data[DG_TRANSMIT_MAX+1];
+  size_t size;
+  int count;
+} Received_t;
+
+static DgLink_t tx, rx;
+static Received_t received;
+
+static void forward(void *context, const uint8_t *data, size_t size)
+{
+  (void) context;
+  datagramRxInput(&rx, data, size);
+}
+
+static void discard(void *context, const uint8_t *data, size_t size)
+{
+  (void) context;
+  (void) data;
+  (void) size;
+}
+
+static void receive(void *context, uint8_t node, const uint8_t *data, size_t size)
+{
+  (void) context;
+  (void) node;
+  
+  if(size <= sizeof(received.data)) {
+    memcpy(received.data, data, size);
+    received.size = size;
+  }
+  
+  received.count++;
+}
+
+static void testFullSize(void)
+{
+  static uint8_t txRxStore[DG_TRANSMIT_MAX+0x40], rxStore[DG_TRANSMIT_MAX+0x40];
+  static DgTxFrame_t frames[QUEUE_FRAMES];
+  static DgTxQueue_t queue;
+  uint8_t payload[DG_TRANSMIT_MAX];
+  DgTxQueueStats_t stats;
+  size_t i = 0;
+
+  datagramLinkInit(&tx, 0, txRxStore, sizeof(txRxStore), NULL, NULL, NULL,
+		   forward, NULL, NULL);
+  datagramLinkSetTxQueue(&tx, &queue, frames, QUEUE_FRAMES, NULL);
+  datagramLinkInit(&rx, 0, rxStore, sizeof(rxStore), NULL, receive, NULL,
+		   discard, NULL, NULL);
+
+  for(i = 0; i < sizeof(payload); i++)
+    payload[i] = i * 7;
+
+  // A full payload in two pieces and one in a single call
+  
+  datagramTxStart(&tx, DG_HOSTLINK);
+  datagramTxOut(&tx, payload, sizeof(payload)/2);
+  datagramTxOut(&tx, &payload[sizeof(payload)/2], sizeof(payload) - sizeof(payload)/2);
+  datagramTxEnd(&tx);
+  
+  datagramTxStart(&tx, DG_HOSTLINK);
+  datagramTxOut(&tx, payload, sizeof(payload));
+  datagramTxEnd(&tx);
+
+  datagramTxDrain(&tx);
+  datagramTxQueueStatus(&tx, &stats);
+
+  CHECK(stats.dropped == 0);
+  CHECK(stats.sent == 2);
+  CHECK(received.count == 2);
+  CHECK(received.size == sizeof(payload) + 1);
+  CHECK(received.data[0] == DG_HOSTLINK);
+  CHECK(!memcmp(&received.data[1], payload, sizeof(payload)));
+
+  // One byte more doesn't fit
+  
+  datagramTxStart(&tx, DG_HOSTLINK);
+  datagramTxOut(&tx, payload, sizeof(payload));
+  datagramTxOut(&tx, payload, 1);
+  datagramTxEnd(&tx);
+  
+  datagramTxDrain(&tx);
+  datagramTxQueueStatus(&tx, &stats);
+
+  CHECK(stats.dropped == 1);
+  CHECK(received.count == 2);
+}
+
+static void testPoolOut(void)
+{
+  static uint8_t txRxStore[DG_TRANSMIT_MAX+0x40], rxStore[DG_TRANSMIT_MAX+0x40];
+  static DgTxFrame_t frames[QUEUE_FRAMES];
+  static DgTxQueue_t queue;
+  uint8_t payload[4] = { 1, 2, 3, 4 };
+  DgTxQueueStats_t stats;
+  int i = 0;
+
+  memset((void*) &queue, '\0', sizeof(queue));
+  memset((void*) &received, '\0', sizeof(received));
+  
+  datagramLinkInit(&tx, 0, txRxStore, sizeof(txRxStore), NULL, NULL, NULL,
+		   forward, NULL, NULL);
+  datagramLinkSetTxQueue(&tx, &queue, frames, QUEUE_FRAMES, NULL);
+  datagramLinkInit(&rx, 0, rxStore, sizeof(rxStore), NULL, receive, NULL,
+		   discard, NULL, NULL);
+
+  for(i = 0; i < QUEUE_FRAMES; i++) {
+    datagramTxStart(&tx, DG_HOSTLINK);
+    datagramTxOut(&tx, payload, sizeof(payload));
+    datagramTxEnd(&tx);
+  }
+
+  // A non-blocking start fails, a blocking one loses its frame
+  
+  CHECK(!datagramTxStartNB(&tx, DG_HOSTLINK));
+  
+  datagramTxStart(&tx, DG_HOSTLINK);
+  datagramTxOut(&tx, payload, sizeof(payload));
+  datagramTxEnd(&tx);
+
+  datagramTxDrain(&tx);
+  datagramTxQueueStatus(&tx, &stats);
+
+  CHECK(stats.refused == 1);
+  CHECK(stats.dropped == 1);
+  CHECK(stats.sent == QUEUE_FRAMES);
+  CHECK(received.count == QUEUE_FRAMES);
+}
+
+int main(void)
+{
+  testFullSize();
+  testPoolOut();
+  
+  return hostTestResult("QueueTest");
+}
@@ -0,0 +1,183 @@
+#include <string.h>
+#include "Reliable.h"
+#include "ChannelSim.h"
+#include "HostTest.h"
+
+//
+// Reliable channel over a lossy simulated channel in both directions,
+// long enough for the sequence numbers to wrap many times, and a frame
+// repeated more times than its 8-bit transmission count holds
+//
+
+#define TEST_HEADER    (DG_HOSTLINK | 3)
+#define TEST_PAYLOAD   32
+#define TEST_FRAMES    2000
+#define TEST_STORE     0x4000
+#define TEST_TIMEOUT   (600*1000000UL)
+
+static DgLink_t linkA, linkB;
+static DgReliable_t chA, chB;
+static ChannelSim_t simAB, simBA;
+static uint32_t expected;
+static int outOfOrder;
+
+static void receiveA(void *context, uint8_t node, const uint8_t *data, size_t size)
+{
+  (void) context;
+  reliableRxInput(&chA, node, data, size);
+}
+
+static void receiveB(void *context, uint8_t node, const uint8_t *data, size_t size)
+{
+  (void) context;
+  reliableRxInput(&chB, node, data, size);
+}
+
+static void deliver(void *context, uint8_t header, const uint8_t *data, size_t size)
+{
+  uint32_t id = 0;
+
+  (void) context;
+  
+  if(header != TEST_HEADER || size != TEST_PAYLOAD) {
+    outOfOrder++;
+    return;
+  }
+
+  memcpy(&id, data, sizeof(id));
+
+  if(id != expected)
+    outOfOrder++;
+
+  expected = id + 1;
+}
+
+static VP_TIME_JIFFIES_T earliest(VP_TIME_JIFFIES_T a, VP_TIME_JIFFIES_T b)
+{
+  return a == 0 || (b > 0 && b < a) ? b : a;
+}
+
+static void run(uint8_t window, uint32_t dropPpm)
+{
+  static uint8_t rxStoreA[DG_TRANSMIT_MAX+0x40], rxStoreB[DG_TRANSMIT_MAX+0x40];
+  static DgReliableSlot_t txA[DG_RELIABLE_WINDOW_MAX], rxA[DG_RELIABLE_WINDOW_MAX];
+  static DgReliableSlot_t txB[DG_RELIABLE_WINDOW_MAX], rxB[DG_RELIABLE_WINDOW_MAX];
+  static ChannelSimByte_t storeAB[TEST_STORE], storeBA[TEST_STORE];
+  ChannelSimConfig_t config = { 115200, 2000, 0, dropPpm, 0, 0, 1 };
+  VP_TIME_JIFFIES_T start = STAP_TimeJiffies();
+  DgReliableStats_t stats;
+  uint8_t data[TEST_PAYLOAD];
+  uint32_t sent = 0;
+
+  datagramLinkInit(&linkA, 0, rxStoreA, sizeof(rxStoreA), &simAB, receiveA, NULL,
+		   channelSimOut, NULL, NULL);
+  datagramLinkInit(&linkB, 0, rxStoreB, sizeof(rxStoreB), &simBA, receiveB, NULL,
+		   channelSimOut, NULL, NULL);
+  channelSimInit(&simAB, &config, &linkB, storeAB, TEST_STORE);
+  config.seed = 2;
+  channelSimInit(&simBA, &config, &linkA, storeBA, TEST_STORE);
+  
+  reliableInit(&chA, &linkA, 0, txA, rxA, window, NULL, NULL);
+  reliableInit(&chB, &linkB, 0, txB, rxB, window, NULL, deliver);
+  reliableEnable(&chA, TEST_HEADER);
+  reliableEnable(&chB, TEST_HEADER);
+
+  memset(data, 0x5A, sizeof(data));
+  expected = 0;
+  outOfOrder = 0;
+  
+  while(expected < TEST_FRAMES && STAP_TimeJiffies() - start < TEST_TIMEOUT) {
+    VP_TIME_JIFFIES_T now = STAP_TimeJiffies(), next = 0;
+
+    channelSimPoll(&simAB);
+    channelSimPoll(&simBA);
+    
+    while(sent < TEST_FRAMES && simAB.lineFree <= now) {
+      memcpy(data, &sent, sizeof(sent));
+
+      if(!reliableSend(&chA, TEST_HEADER, data, sizeof(data)))
+	break;
+
+      sent++;
+    }
+
+    if(sent < TEST_FRAMES && simAB.lineFree > now)
+      next = earliest(next, simAB.lineFree);
+    
+    next = earliest(next, now + reliableTick(&chA));
+    next = earliest(next, now + reliableTick(&chB));
+
+    // After the ticks, they may have sent something
+    
+    next = earliest(next, channelSimPoll(&simAB));
+    next = earliest(next, channelSimPoll(&simBA));
+
+    // Millisecond timers, make sure the clock moves on
+
+    hostTimeAdvanceTo(next > now ? next : now + 100);
+  }
+
+  reliableStatus(&chA, &stats);
+  
+  printf("window %2u drop %5u ppm: %u delivered in %.1f s, %u repeated\n",
+	 window, (unsigned) dropPpm, (unsigned) expected,
+	 (double) (STAP_TimeJiffies() - start) / 1e6, (unsigned) stats.retransmitted);
+  
+  CHECK(expected == TEST_FRAMES);
+  CHECK(outOfOrder == 0);
+  CHECK(dropPpm == 0 || stats.retransmitted > 0);
+}
+
+static void discard(void *context, const uint8_t *data, size_t size)
+{
+  (void) context;
+  (void) data;
+  (void) size;
+}
+
+// Nothing gets through for 256 timeouts, then the frame is acknowledged.
+// The round trip of a frame sent that often can't be measured.
+
+static void testManyRepeats(void)
+{
+  static uint8_t rxStore[DG_TRANSMIT_MAX+0x40];
+  static DgReliableSlot_t tx[1], rx[1];
+  uint8_t data[TEST_PAYLOAD], ack[] = { DG_RELIABLE_ACK, 1, 0, 0, 0, 0 };
+  DgReliableStats_t stats;
+  int i = 0;
+
+  datagramLinkInit(&linkA, 0, rxStore, sizeof(rxStore), NULL, NULL, NULL,
+		   discard, NULL, NULL);
+  reliableInit(&chA, &linkA, 0, tx, rx, 1, NULL, NULL);
+  reliableEnable(&chA, TEST_HEADER);
+
+  memset(data, 0x5A, sizeof(data));
+  CHECK(reliableSend(&chA, TEST_HEADER, data, sizeof(data)));
+
+  for(i = 0; i < 256; i++) {
+    hostTimeAdvance((VP_TIME_JIFFIES_T) DG_RELIABLE_RTO_MAX << 10);
+    reliableTick(&chA);
+  }
+
+  reliableRxInput(&chA, 0, ack, sizeof(ack));
+  reliableStatus(&chA, &stats);
+
+  CHECK(stats.sent == 1);
+  CHECK(stats.retransmitted == 256);
+  CHECK(stats.inFlight == 0);
+  CHECK(stats.srtt == 0);
+}
+
+int main(void)
+{
+  uint8_t window = 0;
+
+  for(window = 1; window <= DG_RELIABLE_WINDOW_MAX; window <<= 1) {
+    run(window, 0);
+    run(window, 5000);
+  }
+
+  testManyRepeats();
+  
+  return hostTestResult("ReliableTest");
+}
@@ -0,0 +1,67 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+#include "StaP.h"
+
+bool failSafeMode;
+uint16_t hostForbidDepth;
+
+static VP_TIME_JIFFIES_T hostJiffies;
+
+VP_TIME_JIFFIES_T STAP_TimeJiffies(void)
+{
+  return hostJiffies;
+}
+
+VP_TIME_SECS_T STAP_TimeSecs(void)
+{
+  return (VP_TIME_SECS_T) (hostJiffies / 1000000UL);
+}
+
+void hostTimeAdvance(VP_TIME_JIFFIES_T jiffies)
+{
+  hostJiffies += jiffies;
+}
+
+void hostTimeAdvanceTo(VP_TIME_JIFFIES_T jiffies)
+{
+  if(jiffies > hostJiffies)
+    hostJiffies = jiffies;
+}
+
+uint64_t hostNanos(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  
+  return (uint64_t) ts.tv_sec*1000000000UL + ts.tv_nsec;
+}
+
+void STAP_DelayMillis(VP_TIME_MILLIS_T value)
+{
+  hostTimeAdvance((VP_TIME_JIFFIES_T) value*1000);
+}
+
+void STAP_Panic(uint8_t reason)
+{
+  STAP_Panicf(reason, "");
+}
+
+void STAP_Panicf(uint8_t reason, const char *format, ...)
+{
+  va_list argp;
+
+  fprintf(stderr, "PANIC %d ", reason);
+  
+  va_start(argp, format);
+  vfprintf(stderr, format, argp);
+  va_end(argp);
+
+  fprintf(stderr, "\n");
+  
+  abort();
+}
@@ -0,0 +1,88 @@
+#ifndef BUSSIM_H
+#define BUSSIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "Datagram.h"
+
+//
+// Shared half-duplex bus (AlphaLink style) with any number of virtual
+// nodes, each a DgLink_t of its own with the node address it was given.
+// Time advances one byte slot (10 bit times) at a time. Every node with
+// something queued puts a byte on the bus in a slot, a node that's sending
+// doesn't hear the bus and the others receive the byte. Two or more
+// senders in the same slot collide, the listeners get the wired AND of the
+// bytes and the frames involved are counted as collided.
+//
+// With carrierSense a node holds back the start of a frame while the bus
+// was busy in the previous slot. Without it nodes simply talk whenever
+// they have something to say and the polling scheme has to keep them
+// apart.
+//
+// Each node has a task called when due, like a periodic task with no
+// period it returns the microseconds until it wants to run again. The
+// tasks send with the usual datagram calls on &node->link and see what
+// arrives through the receive handler, the link context being the node.
+//
+
+#ifndef BUS_SIM_NODES_MAX
+#define BUS_SIM_NODES_MAX    64
+#endif
+
+#ifndef BUS_SIM_TX_SIZE
+#define BUS_SIM_TX_SIZE      0x800
+#endif
+
+#define BUS_SIM_FRAMES       16
+
+struct BusSim;
+
+typedef struct BusSimFrame {
+  uint32_t end;
+  VP_TIME_JIFFIES_T queued;
+} BusSimFrame_t;
+
+typedef struct BusSimNode {
+  struct BusSim *bus;
+  DgLink_t link;
+  uint8_t rxStore[DG_TRANSMIT_MAX+0x40];
+  uint8_t txStage[DG_TX_STAGE_SIZE];
+  uint8_t txData[BUS_SIM_TX_SIZE];
+  uint32_t txIn, txOut;
+  BusSimFrame_t frame[BUS_SIM_FRAMES];
+  uint8_t frameHead, frameCount;
+  VP_TIME_JIFFIES_T queued, wake;
+  bool sending, collided;
+  void *context;
+  VP_TIME_MICROS_T (*task)(struct BusSimNode*, void *context);
+  uint32_t frames, bytes, collisions, overflows;
+  uint64_t latencyTotal;
+  VP_TIME_MICROS_T latencyMax;
+} BusSimNode_t;
+
+typedef struct BusSim {
+  uint32_t bitrate;
+  bool carrierSense, busyLast;
+  BusSimNode_t *node[BUS_SIM_NODES_MAX];
+  uint8_t nodes;
+  VP_TIME_JIFFIES_T start;
+  uint64_t slots, busy, collisions;
+} BusSim_t;
+
+void busSimInit(BusSim_t*, uint32_t bitrate, bool carrierSense);
+bool busSimNodeAdd(BusSim_t*, BusSimNode_t *node, uint8_t address, void *context,
+		   void (*rxHandler)(void*, uint8_t node, const uint8_t *data, size_t size),
+		   VP_TIME_MICROS_T (*task)(BusSimNode_t*, void *context));
+
+// Run for the given (virtual) time
+
+void busSimRun(BusSim_t*, VP_TIME_MICROS_T duration);
+
+// Utilization and collisions of the bus, then frames, collided frames and
+// queueing plus transmission latency (from datagramTxStart() to the last
+// byte on the bus) and receive counts per node
+
+void busSimReportPrint(BusSim_t*);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef CHANNELSIM_H
+#define CHANNELSIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "Datagram.h"
+
+//
+// Simulated serial channel between two datagram links on the host. The
+// sending link gets channelSimOut() as its txOut callback, the bytes are
+// clocked out at the configured bitrate (10 bits per byte, like 8N1),
+// delayed by the latency and damaged on the way, and channelSimPoll()
+// hands the ones that have arrived by the (virtual) time to the receiving
+// link.
+//
+// Damage is random per byte: corruption flips one bit, a drop loses the
+// byte and a burst corrupts the following burstLength bytes. The
+// probabilities are in parts per million and the generator is seeded from
+// the configuration, the same configuration gives the same run.
+//
+
+typedef struct ChannelSimConfig {
+  uint32_t bitrate;              // 0 for no limit
+  VP_TIME_MICROS_T latency;
+  uint32_t corruptPpm, dropPpm, burstPpm;
+  uint16_t burstLength;
+  uint32_t seed;
+} ChannelSimConfig_t;
+
+typedef struct ChannelSimByte {
+  VP_TIME_JIFFIES_T due;
+  uint8_t value;
+} ChannelSimByte_t;
+
+typedef struct ChannelSim {
+  ChannelSimConfig_t config;
+  DgLink_t *rx;
+  ChannelSimByte_t *store;
+  size_t size, head, count;
+  VP_TIME_JIFFIES_T lineFree;
+  uint32_t random;
+  uint16_t burst;
+  uint64_t bytes, corrupted, dropped, overflows;
+  uint64_t rxNanos;
+} ChannelSim_t;
+
+void channelSimInit(ChannelSim_t*, const ChannelSimConfig_t *config, DgLink_t *rx,
+		    ChannelSimByte_t *store, size_t size);
+void channelSimOut(void *channel, const uint8_t *data, size_t size);
+
+// Deliver what's due, returns the time the next byte is (or zero if
+// nothing is in flight)
+
+VP_TIME_JIFFIES_T channelSimPoll(ChannelSim_t*);
+
+//
+// Benchmark: count datagrams of payload bytes (plus the header) sent as
+// fast as the channel takes them. The rates are over virtual time (wall
+// clock time for a channel without a bitrate), the CPU cost of encoding
+// and decoding is measured separately without the channel in the way and
+// given per payload byte.
+//
+
+typedef struct ChannelSimReport {
+  uint32_t sent, delivered, lost, crcErrors, badStarts, overflows;
+  uint64_t wireBytes;
+  double seconds, framesPerSec, goodput;
+  double txNanosPerByte, rxNanosPerByte;
+} ChannelSimReport_t;
+
+void channelSimBenchmark(const ChannelSimConfig_t *config, bool cobs,
+			 size_t payload, uint32_t count, ChannelSimReport_t *report);
+void channelSimReportPrint(const char *name, const ChannelSimReport_t *report);
+
+#endif
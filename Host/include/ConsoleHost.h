@@ -0,0 +1,65 @@
+#ifndef CONSOLEHOST_H
+#define CONSOLEHOST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "Console.h"
+
+//
+// Host end of the console link: DG_CONSOLE text, DG_CONSOLE_BINARY records
+// and DG_CONSOLE_BLOB segments turned back into the text the firmware
+// would have printed. A binary record names its format by the address in
+// the firmware, consoleHostImageLoad() reads the allocated sections of the
+// firmware's ELF file (32 or 64 bit, little endian) for looking it up.
+//
+
+#ifndef CONSOLE_HOST_SECTIONS
+#define CONSOLE_HOST_SECTIONS   32
+#endif
+
+#define CONSOLE_HOST_TEXT_MAX   0x400
+#define CONSOLE_HOST_BLOB_MAX   0x100000
+
+typedef struct ConsoleHostSection {
+  uint64_t address, size;
+  const uint8_t *data;
+} ConsoleHostSection_t;
+
+typedef struct ConsoleHostImage {
+  uint8_t *file;
+  size_t fileSize;
+  ConsoleHostSection_t section[CONSOLE_HOST_SECTIONS];
+  int sections;
+} ConsoleHostImage_t;
+
+bool consoleHostImageLoad(ConsoleHostImage_t*, const char *path);
+void consoleHostImageFree(ConsoleHostImage_t*);
+
+// The terminated string at the address or NULL
+
+const char *consoleHostString(const ConsoleHostImage_t*, uint64_t address);
+
+typedef struct ConsoleHost {
+  const ConsoleHostImage_t *image;
+  void (*out)(void *context, const char *text, size_t size);
+  void *context;
+  char blobName[CONSOLE_BLOB_NAME_MAX+1];
+  uint8_t *blob;
+  size_t blobSize, blobReceived;
+  bool blobBroken;
+  uint32_t records, unknown, blobs, blobsBroken;
+} ConsoleHost_t;
+
+void consoleHostInit(ConsoleHost_t*, const ConsoleHostImage_t *image,
+		     void (*out)(void *context, const char *text, size_t size), void *context);
+
+// A receive handler for the console link, the link context is the host
+
+void consoleHostDatagram(void *host, uint8_t node, const uint8_t *data, size_t size);
+
+// Reports a blob still being collected, at the end of the input
+
+void consoleHostFlush(ConsoleHost_t*);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef FRAMINGREF_H
+#define FRAMINGREF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+//
+// The datagram receiver as it was before it took literal runs in bulk: a
+// state machine fed a byte at a time, the CRC computed over the whole
+// frame at the break. Zero run escaping only, no FEC or flow control. The
+// bulk decoder is timed and checked against it.
+//
+
+typedef struct FramingRef {
+  uint8_t node, rxNode, flagCnt;
+  bool rxBusy, overflow;
+  uint16_t crcStateRx;
+  uint8_t *rxStore;
+  size_t rxStoreSize, datagramSize;
+  void *context;
+  void (*rxHandler)(void*, uint8_t node, const uint8_t *data, size_t size);
+  uint32_t crcErrors, overflows;
+} FramingRef_t;
+
+void framingRefInit(FramingRef_t*, uint8_t node, uint8_t *rxStore, size_t rxSize,
+		    void *context,
+		    void (*rxHandler)(void*, uint8_t node, const uint8_t *data, size_t));
+void framingRefInput(FramingRef_t*, const uint8_t *data, size_t size);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef HOSTTEST_H
+#define HOSTTEST_H
+
+#include <stdio.h>
+
+//
+// Minimal checks for the host tests, a failure is reported with where it
+// happened and counted, main() returns hostTestResult()
+//
+
+extern int hostTestFailures;
+
+#define CHECK(c) do {							\
+    if(!(c)) {								\
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #c);	\
+      hostTestFailures++;						\
+    }									\
+  } while(0)
+
+int hostTestResult(const char *name);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef STAP_CONFIG_H
+#define STAP_CONFIG_H
+
+//
+// Host build configuration
+//
+
+#include <stdint.h>
+
+#define STAP_MACHINE_BIG     1
+
+typedef uint8_t StaP_LinkId_T;
+typedef uint8_t StaP_Signal_T;
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef STAP_TARGET_H
+#define STAP_TARGET_H
+
+//
+// POSIX stand-in for the target layer, for running the portable parts of
+// the tree on a development host. There's a single thread so forbidding
+// only keeps count, there are no mutexes (STAP_MutexCreate stays
+// undefined) and time is virtual: it stands still until hostTimeAdvance()
+// or STAP_DelayMillis() moves it, which makes every run repeatable.
+//
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "VPTime.h"
+
+typedef uint32_t StaP_SignalSet_T;
+typedef uint16_t ForbidContext_T;
+typedef VP_TIME_JIFFIES_T STAP_NativeTime_T;
+
+extern uint16_t hostForbidDepth;
+
+#define STAP_FORBID              hostForbidDepth++
+#define STAP_PERMIT              hostForbidDepth--
+#define STAP_FORBID_SAFE         hostForbidDepth++
+#define STAP_PERMIT_SAFE(c)      ((void) (c), hostForbidDepth--)
+#define STAP_EnterSystem
+
+// A jiffy is a microsecond
+
+#define STAP_JiffiesToMicros(j)  ((VP_TIME_MICROS_T) (j))
+
+VP_TIME_JIFFIES_T STAP_TimeJiffies(void);
+VP_TIME_SECS_T STAP_TimeSecs(void);
+
+void hostTimeAdvance(VP_TIME_JIFFIES_T jiffies);
+void hostTimeAdvanceTo(VP_TIME_JIFFIES_T jiffies);
+
+// Wall clock for measuring the CPU cost of things
+
+uint64_t hostNanos(void);
+
+#endif